@@ -0,0 +1,144 @@
+#include "prisma.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/* region allocation.
+
+   everything loaded for a map (or a world) is carved out of
+   a handful of big chunks, and released all at once with a
+   single arena_free().  things that aren't plain memory, like
+   SDL surfaces or mmap'd files, are handed to arena_defer()
+   so they get torn down along with it, newest first. */
+
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+struct chunk {
+	struct chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct cleanup {
+	struct cleanup *next;
+	void (*fn)(void *);
+	void  *p;
+};
+
+struct arena {
+	int             tag;
+	struct chunk   *chunks;
+	struct cleanup *cleanups;
+};
+
+static struct chunk *
+s_chunk(int tag, size_t size)
+{
+	struct chunk *c;
+
+	c = tallocate(tag, 1, sizeof(struct chunk) + size);
+	c->size = size;
+	return c;
+}
+
+struct arena *
+arena_new(int tag)
+{
+	struct arena *a;
+
+	a = tallocate(tag, 1, sizeof(struct arena));
+	a->tag    = tag;
+	a->chunks = s_chunk(tag, ARENA_CHUNK);
+	return a;
+}
+
+void
+arena_free(struct arena *a)
+{
+	struct chunk *c;
+	struct cleanup *d;
+
+	if (!a) return;
+
+	while ((d = a->cleanups) != NULL) {
+		a->cleanups = d->next;
+		d->fn(d->p);
+	}
+	while ((c = a->chunks) != NULL) {
+		a->chunks = c->next;
+		release(c);
+	}
+	release(a);
+}
+
+void *
+arena_alloc(struct arena *a, size_t n, size_t size)
+{
+	struct chunk *c;
+	size_t want;
+	void *p;
+
+	assert(a != NULL);
+	if (size && n > SIZE_MAX / size) {
+		fprintf(stderr, "failed to allocate memory: %lu x %lu bytes is too large\n",
+				(unsigned long)n, (unsigned long)size);
+		exit(EXIT_INT_FAILURE);
+	}
+
+	want = (n * size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	c = a->chunks;
+	if (c->used + want > c->size) {
+		if (want > ARENA_CHUNK / 4) {
+			/* big blocks get a chunk of their own, filed
+			   behind the current one so it keeps filling. */
+			c = s_chunk(a->tag, want);
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c = s_chunk(a->tag, ARENA_CHUNK);
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+	}
+
+	p = (char *)c->data + c->used;
+	c->used += want;
+	return p; /* chunks come zeroed from tallocate() */
+}
+
+char *
+arena_string(struct arena *a, const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		fprintf(stderr, "failed to format string: %s (error %d)\n",
+				strerror(errno), errno);
+		exit(EXIT_INT_FAILURE);
+	}
+
+	s = arena_alloc(a, n + 1, sizeof(char));
+	va_start(ap, fmt);
+	vsnprintf(s, n + 1, fmt, ap);
+	va_end(ap);
+	return s;
+}
+
+void
+arena_defer(struct arena *a, void (*fn)(void *), void *p)
+{
+	struct cleanup *d;
+
+	d = arena_alloc(a, 1, sizeof(struct cleanup));
+	d->fn   = fn;
+	d->p    = p;
+	d->next = a->cleanups;
+	a->cleanups = d;
+}
@@ -0,0 +1,411 @@
+#include "prisma.h"
+#include <math.h>
+
+/* sound.
+
+   everything is mixed in SDL's audio callback, which runs on
+   a thread of its own and must never block, so:
+
+     - samples are decoded (and converted to the device's
+       rate and format) when they are loaded, not as they
+       play; the mixer just adds them up.
+
+     - there are AUDIO_VOICES voices, set up front.  playing
+       a sound with all of them busy cuts the oldest one
+       short (preferring one-shots over loops) rather than
+       allocating another.
+
+     - the game thread never touches the voices.  it sends
+       play and stop commands through a single-producer,
+       single-consumer ring, which the callback drains at the
+       top of every buffer.  neither side ever waits on the
+       other: a full ring drops the command (and counts it).
+
+   the callback times itself, and keeps the numbers that
+   audio_stats() reports: how long it takes, how regularly
+   it's called, and how often it ran over its budget. */
+
+#define AUDIO_PLAY  1
+#define AUDIO_STOP  2
+
+struct sample {
+	int16_t *pcm;           /* interleaved, in the device's format */
+	int      frames;
+};
+
+struct voice {
+	int id;                 /* 0 when free */
+	int sample;
+	int pos;                /* in frames */
+	int volume;             /* 0 - AUDIO_VOLUME */
+	int loop;
+	unsigned long started;  /* for picking who to cut short */
+};
+
+struct audiocmd {
+	int op;
+	int voice;
+	int sample, volume, loop;
+};
+
+struct audio {
+	SDL_AudioDeviceID dev;
+	SDL_AudioSpec     spec;
+
+	int           nsamples;
+	struct sample samples[AUDIO_SAMPLES];
+
+	/* the ring; tail is the game thread's, head the mixer's */
+	struct audiocmd cmds[AUDIO_QUEUE];
+	SDL_atomic_t    head, tail;
+	int             next;      /* voice ids, handed out by audio_play() */
+	unsigned long   dropped;
+
+	/* the mixer's own */
+	struct voice  voices[AUDIO_VOICES];
+	int32_t      *acc;         /* spec.samples * spec.channels */
+	unsigned long plays;
+	struct audiostats stats;
+	Uint64        last;        /* performance counter, at the last callback */
+	double        sum;         /* of callback times, for the mean */
+};
+
+static int
+s_push(struct audio *a, struct audiocmd *c)
+{
+	int head, tail;
+
+	tail = SDL_AtomicGet(&a->tail);
+	head = SDL_AtomicGet(&a->head);
+	if (tail - head == AUDIO_QUEUE) {
+		a->dropped++;
+		return 0;
+	}
+	a->cmds[tail & (AUDIO_QUEUE - 1)] = *c;
+	SDL_AtomicSet(&a->tail, tail + 1);  /* publishes the command */
+	return 1;
+}
+
+static void
+s_start(struct audio *a, struct audiocmd *c)
+{
+	struct voice *v, *oldest;
+	int i;
+
+	v = oldest = NULL;
+	for (i = 0; i < AUDIO_VOICES; i++) {
+		if (!a->voices[i].id) {
+			v = &a->voices[i];
+			break;
+		}
+		if (!oldest
+		 || a->voices[i].loop < oldest->loop
+		 || (a->voices[i].loop == oldest->loop && a->voices[i].started < oldest->started))
+			oldest = &a->voices[i];
+	}
+	if (!v) {
+		v = oldest;
+		a->stats.stolen++;
+	}
+
+	v->id      = c->voice;
+	v->sample  = c->sample;
+	v->pos     = 0;
+	v->volume  = c->volume;
+	v->loop    = c->loop;
+	v->started = ++a->plays;
+}
+
+static void
+s_drain(struct audio *a)
+{
+	struct audiocmd *c;
+	int head, tail, i;
+
+	head = SDL_AtomicGet(&a->head);
+	tail = SDL_AtomicGet(&a->tail);
+	for (; head != tail; head++) {
+		c = &a->cmds[head & (AUDIO_QUEUE - 1)];
+		switch (c->op) {
+		case AUDIO_PLAY:
+			s_start(a, c);
+			break;
+		case AUDIO_STOP:
+			for (i = 0; i < AUDIO_VOICES; i++)
+				if (a->voices[i].id == c->voice || c->voice == 0)
+					a->voices[i].id = 0;
+			break;
+		}
+	}
+	SDL_AtomicSet(&a->head, head);
+}
+
+/* add one voice into the accumulator, for up to n frames */
+static void
+s_voice(struct audio *a, struct voice *v, int n)
+{
+	struct sample *s = &a->samples[v->sample];
+	int32_t *acc = a->acc;
+	int16_t *pcm;
+	int i, k, ch;
+
+	ch = a->spec.channels;
+	while (n > 0 && v->id) {
+		k   = s->frames - v->pos < n ? s->frames - v->pos : n;
+		pcm = s->pcm + v->pos * ch;
+		for (i = 0; i < k * ch; i++)
+			acc[i] += pcm[i] * v->volume / AUDIO_VOLUME;
+
+		acc    += k * ch;
+		n      -= k;
+		v->pos += k;
+		if (v->pos == s->frames) {
+			if (v->loop) v->pos = 0;
+			else         v->id  = 0;
+		}
+	}
+}
+
+static void
+s_mix(void *data, Uint8 *stream, int len)
+{
+	struct audio *a = data;
+	int16_t *out = (int16_t *)stream;
+	Uint64 t0, t1;
+	double took, gap, budget, f;
+	int i, n, chunk, active;
+
+	t0 = SDL_GetPerformanceCounter();
+	f  = (double)SDL_GetPerformanceFrequency();
+	s_drain(a);
+
+	n = len / (int)sizeof(int16_t) / a->spec.channels;
+	active = 0;
+	while (n > 0) {
+		chunk = n < a->spec.samples ? n : a->spec.samples;
+		memset(a->acc, 0, chunk * a->spec.channels * sizeof(int32_t));
+		for (i = 0; i < AUDIO_VOICES; i++)
+			if (a->voices[i].id)
+				s_voice(a, &a->voices[i], chunk);
+
+		for (i = 0; i < chunk * a->spec.channels; i++)
+			out[i] = a->acc[i] >  32767 ?  32767
+			       : a->acc[i] < -32768 ? -32768 : a->acc[i];
+		out += chunk * a->spec.channels;
+		n   -= chunk;
+	}
+	for (i = 0; i < AUDIO_VOICES; i++)
+		active += a->voices[i].id != 0;
+
+	/* how long did that take, and how long since last time? */
+	t1     = SDL_GetPerformanceCounter();
+	took   = (t1 - t0) * 1e6 / f;
+	budget = 1e6 * (len / (int)sizeof(int16_t) / a->spec.channels) / a->spec.freq;
+
+	a->stats.callbacks++;
+	a->stats.active = active;
+	a->sum += took;
+	a->stats.mean = a->sum / a->stats.callbacks;
+	if (took > a->stats.max) a->stats.max = took;
+	if (took > budget)       a->stats.overruns++;
+	if (a->last) {
+		gap = (t0 - a->last) * 1e6 / f;
+		a->stats.period += (gap - a->stats.period) / (a->stats.callbacks - 1);
+		if (fabs(gap - budget) > a->stats.jitter)
+			a->stats.jitter = fabs(gap - budget);
+	}
+	a->last = t0;
+}
+
+struct audio *
+audio_open(int freq, int frames)
+{
+	struct audio *a;
+	SDL_AudioSpec want;
+
+	a = tallocate(MEM_AUDIO, 1, sizeof(struct audio));
+
+	memset(&want, 0, sizeof(want));
+	want.freq     = freq;
+	want.format   = AUDIO_S16SYS;
+	want.channels = 2;
+	want.samples  = frames;
+	want.callback = s_mix;
+	want.userdata = a;
+
+	/* no changes allowed: SDL converts, if it has to, so
+	   the mixer only ever deals in one format */
+	a->dev = SDL_OpenAudioDevice(NULL, 0, &want, &a->spec, 0);
+	if (!a->dev) {
+		fprintf(stderr, "failed to open audio device: %s\n", SDL_GetError());
+		release(a);
+		return NULL;
+	}
+	a->acc  = tallocate(MEM_AUDIO, a->spec.samples * a->spec.channels, sizeof(int32_t));
+	a->next = 1;
+
+	SDL_PauseAudioDevice(a->dev, 0);
+	return a;
+}
+
+void
+audio_close(struct audio *a)
+{
+	int i;
+
+	if (!a) return;
+	SDL_CloseAudioDevice(a->dev);
+	for (i = 0; i < a->nsamples; i++)
+		release(a->samples[i].pcm);
+	release(a->acc);
+	release(a);
+}
+
+/* add a sample from memory: frames of 16-bit pcm, at the
+   given rate and channel count; it's converted here, once */
+int
+audio_sample(struct audio *a, const int16_t *pcm, int frames, int channels, int freq)
+{
+	struct sample *s;
+	SDL_AudioCVT cvt;
+	int rc;
+
+	if (!a || frames <= 0) return -1;
+	if (a->nsamples == AUDIO_SAMPLES) {
+		fprintf(stderr, "too many audio samples (max %d)\n", AUDIO_SAMPLES);
+		return -1;
+	}
+
+	rc = SDL_BuildAudioCVT(&cvt, AUDIO_S16SYS, channels, freq,
+	                             AUDIO_S16SYS, a->spec.channels, a->spec.freq);
+	if (rc < 0) {
+		fprintf(stderr, "failed to convert audio sample: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	cvt.len = frames * channels * sizeof(int16_t);
+	cvt.buf = tallocate(MEM_AUDIO, cvt.len * cvt.len_mult, 1);
+	memcpy(cvt.buf, pcm, cvt.len);
+	if (cvt.needed && SDL_ConvertAudio(&cvt) != 0) {
+		fprintf(stderr, "failed to convert audio sample: %s\n", SDL_GetError());
+		release(cvt.buf);
+		return -1;
+	}
+
+	/* the mixer only looks at samples it's been told to play,
+	   and the ring orders this before any such command */
+	s = &a->samples[a->nsamples];
+	s->pcm    = (int16_t *)cvt.buf;
+	s->frames = (cvt.needed ? cvt.len_cvt : cvt.len) / (int)sizeof(int16_t) / a->spec.channels;
+	if (s->frames <= 0) {
+		release(cvt.buf);
+		return -1;
+	}
+	return a->nsamples++;
+}
+
+int
+audio_load(struct audio *a, const char *path)
+{
+	SDL_AudioSpec spec;
+	SDL_AudioCVT cvt;
+	Uint8 *buf;
+	Uint32 len;
+	int id;
+
+	if (!a) return -1;
+	if (!SDL_LoadWAV(path, &spec, &buf, &len)) {
+		fprintf(stderr, "failed to load sound %s: %s\n", path, SDL_GetError());
+		return -1;
+	}
+
+	/* to 16-bit first, at the file's own rate and channels */
+	if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+	                      AUDIO_S16SYS, spec.channels, spec.freq) < 0) {
+		fprintf(stderr, "failed to convert sound %s: %s\n", path, SDL_GetError());
+		SDL_FreeWAV(buf);
+		return -1;
+	}
+	cvt.len = len;
+	cvt.buf = tallocate(MEM_AUDIO, len * cvt.len_mult, 1);
+	memcpy(cvt.buf, buf, len);
+	SDL_FreeWAV(buf);
+	if (cvt.needed && SDL_ConvertAudio(&cvt) != 0) {
+		fprintf(stderr, "failed to convert sound %s: %s\n", path, SDL_GetError());
+		release(cvt.buf);
+		return -1;
+	}
+
+	id = audio_sample(a, (int16_t *)cvt.buf,
+	                  (cvt.needed ? cvt.len_cvt : cvt.len) / (int)sizeof(int16_t) / spec.channels,
+	                  spec.channels, spec.freq);
+	release(cvt.buf);
+	return id;
+}
+
+/* start a sample playing; returns the voice, for audio_stop(),
+   or 0 if the command couldn't be queued */
+int
+audio_play(struct audio *a, int sample, int volume, int loop)
+{
+	struct audiocmd c;
+
+	if (!a || sample < 0 || sample >= a->nsamples)
+		return 0;
+
+	c.op     = AUDIO_PLAY;
+	c.voice  = a->next;
+	c.sample = sample;
+	c.volume = volume < 0 ? 0 : volume > AUDIO_VOLUME ? AUDIO_VOLUME : volume;
+	c.loop   = loop;
+	if (!s_push(a, &c))
+		return 0;
+
+	if (++a->next <= 0) a->next = 1;
+	return c.voice;
+}
+
+/* stop a voice, or (voice 0) all of them */
+void
+audio_stop(struct audio *a, int voice)
+{
+	struct audiocmd c;
+
+	if (!a) return;
+	memset(&c, 0, sizeof(c));
+	c.op    = AUDIO_STOP;
+	c.voice = voice;
+	s_push(a, &c);
+}
+
+void
+audio_stats(struct audio *a, struct audiostats *st)
+{
+	memset(st, 0, sizeof(*st));
+	if (!a) return;
+
+	/* holds the callback off just long enough to copy */
+	SDL_LockAudioDevice(a->dev);
+	*st = a->stats;
+	SDL_UnlockAudioDevice(a->dev);
+	st->dropped = a->dropped;
+	st->freq    = a->spec.freq;
+	st->frames  = a->spec.samples;
+}
+
+void
+audio_report(struct audio *a, FILE *out)
+{
+	struct audiostats st;
+
+	if (!a) return;
+	audio_stats(a, &st);
+	fprintf(out, "audio: %s driver, %dHz, %d-frame buffers (%.2fms)\n",
+		SDL_GetCurrentAudioDriver(), st.freq, st.frames, 1e3 * st.frames / st.freq);
+	fprintf(out, "audio: %lu callbacks, %.1fus mean, %.1fus worst, %lu over budget\n",
+		st.callbacks, st.mean, st.max, st.overruns);
+	fprintf(out, "audio: every %.2fms, give or take %.2fms at worst\n",
+		st.period / 1e3, st.jitter / 1e3);
+	fprintf(out, "audio: %d voices playing, %lu cut short, %lu commands dropped\n",
+		st.active, st.stolen, st.dropped);
+}
@@ -0,0 +1,1276 @@
+#include "prisma.h"
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+
+/* micro-benchmarks for the engine's hot paths.
+
+   USAGE: bench SUBSYSTEM [OPTIONS...]
+
+   each benchmark works on maps generated in memory, so
+   results are reproducible from the seed alone. */
+
+static double
+s_seconds()
+{
+	return SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+/* a castle-ish grid of ROOM x ROOM rooms, with a door or two
+   knocked through each wall and some furniture scattered
+   about at (clutter) percent. */
+#define ROOM 12
+static struct map *
+s_generate(int w, int h, int clutter, unsigned seed)
+{
+	struct map *map;
+	int x, y;
+
+	srand(seed);
+	map = map_new(w, h);
+	for (x = 0; x < w; x++) {
+		for (y = 0; y < h; y++) {
+			if (x % ROOM == 0 || y % ROOM == 0)
+				map_set(map, MAP_FLOOR, x, y, (1 << 24) | TILE_SOLID);
+			else
+				map_set(map, MAP_FLOOR, x, y, (1 << 24));
+			if (rand() % 100 < clutter && !map_solid(map, x, y))
+				map_set(map, MAP_OBJECTS, x, y, (2 << 24) | TILE_SOLID);
+		}
+	}
+	for (x = 0; x < w; x += ROOM) {
+		for (y = 0; y < h; y += ROOM) {
+			/* one door east, one door south */
+			if (y + ROOM / 2 < h && x > 0)
+				map_set(map, MAP_FLOOR, x, y + 1 + rand() % (ROOM - 1), (1 << 24));
+			if (x + ROOM / 2 < w && y > 0)
+				map_set(map, MAP_FLOOR, x + 1 + rand() % (ROOM - 1), y, (1 << 24));
+		}
+	}
+	return map;
+}
+
+static struct coords
+s_open_cell(struct map *map)
+{
+	struct coords c;
+	do {
+		c.x = rand() % map->width;
+		c.y = rand() % map->height;
+	} while (map_solid(map, c.x, c.y));
+	return c;
+}
+
+static int
+bench_path(int argc, char **argv)
+{
+	struct map *map;
+	struct pathfinder *pf;
+	struct pathquery *q;
+	struct path p;
+	double t0, t1, t2;
+	int size, n, i, found, steps;
+
+	size = argc > 0 ? atoi(argv[0]) : 1024;
+	n    = argc > 1 ? atoi(argv[1]) : 1000;
+
+	map = s_generate(size, size, 10, 42);
+
+	t0 = s_seconds();
+	pf = path_new(map);
+	t1 = s_seconds();
+	fprintf(stderr, "path: %dx%d map, cluster build %.1fms\n", size, size, (t1 - t0) * 1e3);
+
+	q = allocate(n, sizeof(struct pathquery));
+	for (i = 0; i < n; i++) {
+		q[i].from = s_open_cell(map);
+		q[i].to   = s_open_cell(map);
+	}
+
+	memset(&p, 0, sizeof(p));
+	found = steps = 0;
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		if (path_find(pf, q[i].from, q[i].to, &p)) {
+			found++;
+			steps += p.len;
+		}
+	}
+	t1 = s_seconds();
+	fprintf(stderr, "path: %d queries, %d found, avg %d steps: %.3fms/query (caller thread)\n",
+		n, found, found ? steps / found : 0, (t1 - t0) * 1e3 / n);
+
+	t1 = s_seconds();
+	path_batch(pf, q, n);
+	path_wait(pf);
+	t2 = s_seconds();
+	for (found = i = 0; i < n; i++)
+		if (q[i].status == PATH_FOUND) found++;
+	fprintf(stderr, "path: %d queries, %d found: %.3fms/query (worker batch)\n",
+		n, found, (t2 - t1) * 1e3 / n);
+
+	t0 = s_seconds();
+	for (i = 0; i < 100; i++) {
+		struct coords c = s_open_cell(map);
+		map_set(map, MAP_OBJECTS, c.x, c.y, (2 << 24) | TILE_SOLID);
+	}
+	path_find(pf, q[0].from, q[0].to, &p);
+	t1 = s_seconds();
+	fprintf(stderr, "path: 100 cell changes re-clustered in %.3fms\n", (t1 - t0) * 1e3);
+
+	for (i = 0; i < n; i++)
+		path_release(&q[i].path);
+	path_release(&p);
+	release(q);
+	path_free(pf);
+	map_free(map);
+	return 0;
+}
+
+static int
+bench_flow(int argc, char **argv)
+{
+	struct map *map;
+	struct flowfield *ff;
+	struct coords goal, *agents, step;
+	double t0, t1;
+	int size, n, i, tick, arrived;
+
+	size = argc > 0 ? atoi(argv[0]) : 1024;
+	n    = argc > 1 ? atoi(argv[1]) : 10000;
+
+	map  = s_generate(size, size, 10, 42);
+	goal = s_open_cell(map);
+
+	t0 = s_seconds();
+	ff = flow_new(map, goal.x, goal.y);
+	t1 = s_seconds();
+	fprintf(stderr, "flow: %dx%d map, full integration pass %.1fms\n", size, size, (t1 - t0) * 1e3);
+
+	agents = allocate(n, sizeof(struct coords));
+	for (i = 0; i < n; i++)
+		agents[i] = s_open_cell(map);
+
+	/* the goal wanders a cell at a time, like a hero would */
+	t0 = s_seconds();
+	for (tick = 0; tick < 100; tick++) {
+		step.x = (rand() % 3) - 1;
+		step.y = (rand() % 3) - 1;
+		if (!map_solid(map, goal.x + step.x, goal.y + step.y)) {
+			goal.x += step.x;
+			goal.y += step.y;
+		}
+		flow_goal(ff, goal.x, goal.y);
+		flow_update(ff);
+	}
+	t1 = s_seconds();
+	fprintf(stderr, "flow: 100 goal moves, %.3fms/move on the caller\n", (t1 - t0) * 10);
+
+	flow_wait(ff);
+	t0 = s_seconds();
+	for (tick = 0; tick < 100; tick++) {
+		for (i = 0; i < n; i++) {
+			if (flow_sample(ff, agents[i].x, agents[i].y, &step)) {
+				agents[i].x += step.x;
+				agents[i].y += step.y;
+			}
+		}
+	}
+	t1 = s_seconds();
+	for (arrived = i = 0; i < n; i++)
+		if (agents[i].x == goal.x && agents[i].y == goal.y) arrived++;
+	fprintf(stderr, "flow: %d agents x 100 ticks, %.1fns/sample, %d arrived\n",
+		n, (t1 - t0) * 1e9 / (n * 100.0), arrived);
+
+	release(agents);
+	flow_free(ff);
+	map_free(map);
+	return 0;
+}
+
+/* the old way: sample points along the ray every 1/8th of
+   a cell, the way s_solid() probes a sprite's corners. */
+static int
+s_sample(struct map *map, float ox, float oy, float dx, float dy, float maxt, float *t)
+{
+	float len;
+
+	len = sqrtf(dx * dx + dy * dy);
+	dx /= len;
+	dy /= len;
+	for (*t = 0; *t <= maxt; *t += 0.125f)
+		if (map_solid(map, (int)floorf(ox + dx * *t), (int)floorf(oy + dy * *t)))
+			return 1;
+	*t = maxt;
+	return 0;
+}
+
+static int
+bench_ray(int argc, char **argv)
+{
+	struct map *map;
+	struct raybatch b;
+	struct rayhit hit;
+	double t0, t1;
+	float t;
+	int size, n, i, hits, agree;
+
+	size = argc > 0 ? atoi(argv[0]) : 512;
+	n    = argc > 1 ? atoi(argv[1]) : 100000;
+
+	map = s_generate(size, size, 10, 42);
+	memset(&b, 0, sizeof(b));
+	rays_reserve(&b, n);
+	b.n = n;
+	for (i = 0; i < n; i++) {
+		struct coords c = s_open_cell(map);
+		b.ox[i]   = c.x + (rand() % 1000) / 1000.0f;
+		b.oy[i]   = c.y + (rand() % 1000) / 1000.0f;
+		b.dx[i]   = (rand() % 2001 - 1000) / 1000.0f;
+		b.dy[i]   = (rand() % 2001 - 1000) / 1000.0f;
+		b.maxt[i] = 4 + rand() % 60;
+	}
+
+	t0 = s_seconds();
+	for (hits = i = 0; i < n; i++)
+		hits += s_sample(map, b.ox[i], b.oy[i], b.dx[i], b.dy[i], b.maxt[i], &t);
+	t1 = s_seconds();
+	fprintf(stderr, "ray: point sampling   %8.1f rays/ms  (%d hits)\n", n / ((t1 - t0) * 1e3), hits);
+
+	t0 = s_seconds();
+	for (hits = agree = i = 0; i < n; i++) {
+		hits += ray_cast(map, b.ox[i], b.oy[i], b.dx[i], b.dy[i], b.maxt[i], &hit);
+	}
+	t1 = s_seconds();
+	fprintf(stderr, "ray: DDA, one at a time %6.1f rays/ms  (%d hits)\n", n / ((t1 - t0) * 1e3), hits);
+
+	/* once untimed, so the output arrays' first-touch page
+	   faults aren't billed to the batch */
+	rays_cast(map, &b);
+	t0 = s_seconds();
+	rays_cast(map, &b);
+	t1 = s_seconds();
+	for (hits = i = 0; i < n; i++)
+		hits += b.hit[i];
+	fprintf(stderr, "ray: DDA, batched     %8.1f rays/ms  (%d hits)\n", n / ((t1 - t0) * 1e3), hits);
+
+	for (agree = i = 0; i < n; i++) {
+		ray_cast(map, b.ox[i], b.oy[i], b.dx[i], b.dy[i], b.maxt[i], &hit);
+		if (hit.hit == b.hit[i] && (!hit.hit || (hit.cell.x == b.cx[i] && hit.cell.y == b.cy[i])))
+			agree++;
+	}
+	fprintf(stderr, "ray: batched and scalar agree on %d/%d rays\n", agree, n);
+
+	rays_free(&b);
+	map_free(map);
+	return 0;
+}
+
+/* a world where things keep changing: crates get pushed
+   about and doors open and shut, while a hero's light, a
+   crowd's flow field and someone's path all keep up. */
+static int
+bench_mutate(int argc, char **argv)
+{
+	struct map *map;
+	struct pathfinder *pf;
+	struct flowfield *ff;
+	struct fov *fov;
+	struct coords from, to, c;
+	struct path p;
+	double t0, t1, total, worst;
+	int size, n, tick, i, v;
+
+	size = argc > 0 ? atoi(argv[0]) : 512;
+	n    = argc > 1 ? atoi(argv[1]) : 100;
+
+	map  = s_generate(size, size, 5, 42);
+	from = s_open_cell(map);
+	to   = s_open_cell(map);
+	pf   = path_new(map);
+	ff   = flow_new(map, to.x, to.y);
+	fov  = fov_new(map, 9);
+	memset(&p, 0, sizeof(p));
+
+	total = worst = 0;
+	for (tick = 0; tick < 100; tick++) {
+		t0 = s_seconds();
+		for (i = 0; i < n; i++) {
+			/* most changes near the action, the rest anywhere */
+			if (i % 4) {
+				c.x = bounded(1, to.x + rand() % 33 - 16, size - 2);
+				c.y = bounded(1, to.y + rand() % 33 - 16, size - 2);
+			} else {
+				c.x = 1 + rand() % (size - 2);
+				c.y = 1 + rand() % (size - 2);
+			}
+			if (c.x % ROOM == 0 || c.y % ROOM == 0) {
+				v = map_get(map, MAP_FLOOR, c.x, c.y);
+				map_set(map, MAP_FLOOR, c.x, c.y, v ^ TILE_SOLID);
+			} else if ((c.x != from.x || c.y != from.y) && (c.x != to.x || c.y != to.y)) {
+				v = map_get(map, MAP_OBJECTS, c.x, c.y);
+				map_set(map, MAP_OBJECTS, c.x, c.y, v ? TILE_NONE : (2 << 24) | TILE_SOLID);
+			}
+		}
+		path_find(pf, from, to, &p);
+		flow_update(ff);
+		fov_update(fov, to.x, to.y);
+		t1 = s_seconds();
+
+		total += t1 - t0;
+		if (t1 - t0 > worst) worst = t1 - t0;
+	}
+	fprintf(stderr, "mutate: %dx%d map, %d changes/tick: %.3fms/tick avg, %.3fms worst\n",
+		size, size, n, total * 10, worst * 1e3);
+
+	path_release(&p);
+	fov_free(fov);
+	flow_free(ff);
+	path_free(pf);
+	map_free(map);
+	return 0;
+}
+
+/* floor-plus-object cells drawn the old way (blend both,
+   always) and the opacity-aware way, off screen. */
+static int
+bench_tiles(int argc, char **argv)
+{
+	struct arena *arena;
+	struct tileset *tiles;
+	SDL_Surface *plain, *dst;
+	SDL_Rect src, to;
+	const char *path;
+	double t0, t1, t2;
+	int n, i, k, f, o, counts[3] = { 0, 0, 0 };
+	int *cells;
+
+	n    = argc > 0 ? atoi(argv[0]) : 100000;
+	path = argc > 1 ? argv[1] : "assets/tileset";
+
+	arena = arena_new(MEM_TILESET);
+	tiles = tileset_read(arena, path);
+	if (!tiles) return 1;
+	plain = IMG_Load(arena_string(arena, "%s.png", path));
+	dst   = SDL_CreateRGBSurface(0, 16 * tiles->tile.width, 16 * tiles->tile.height, 32, 0, 0, 0, 0);
+	if (!plain || !dst) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	for (i = 0; i < tiles->count; i++)
+		counts[tiles->opacity[i]]++;
+	fprintf(stderr, "tiles: %d tiles: %d clear, %d mixed, %d opaque\n",
+		tiles->count, counts[OPACITY_CLEAR], counts[OPACITY_MIXED], counts[OPACITY_OPAQUE]);
+
+	cells = allocate(2 * n, sizeof(int));
+	for (i = 0; i < 2 * n; i++)
+		cells[i] = rand() % tiles->count;
+
+	src.w = to.w = tiles->tile.width;
+	src.h = to.h = tiles->tile.height;
+
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		to.x = (i % 16) * tiles->tile.width;
+		to.y = (i / 16 % 16) * tiles->tile.height;
+		for (k = 0; k < 2; k++) {
+			src.x = tiles->tile.width  * (cells[2*i+k] % tiles->width);
+			src.y = tiles->tile.height * (cells[2*i+k] / tiles->width);
+			SDL_BlitSurface(plain, &src, dst, &to);
+		}
+	}
+	t1 = s_seconds();
+	for (i = 0; i < n; i++) {
+		to.x = (i % 16) * tiles->tile.width;
+		to.y = (i / 16 % 16) * tiles->tile.height;
+		f = cells[2*i];
+		o = cells[2*i+1];
+		if (tiles->opacity[o] != OPACITY_OPAQUE && tiles->opacity[f] != OPACITY_CLEAR) {
+			src.x = tiles->tile.width  * (f % tiles->width);
+			src.y = tiles->tile.height * (f / tiles->width);
+			SDL_BlitSurface(tiles->surface, &src, dst, &to);
+		}
+		if (tiles->opacity[o] != OPACITY_CLEAR) {
+			src.x = tiles->tile.width  * (o % tiles->width);
+			src.y = tiles->tile.height * (o / tiles->width);
+			SDL_BlitSurface(tiles->surface, &src, dst, &to);
+		}
+	}
+	t2 = s_seconds();
+
+	fprintf(stderr, "tiles: %d cells, blend everything:  %.1fns/cell\n", n, (t1 - t0) * 1e9 / n);
+	fprintf(stderr, "tiles: %d cells, opacity-aware/RLE: %.1fns/cell\n", n, (t2 - t1) * 1e9 / n);
+
+	release(cells);
+	SDL_FreeSurface(dst);
+	SDL_FreeSurface(plain);
+	arena_free(arena);
+	return 0;
+}
+
+/* tileset loads with and without the decoded atlas cache;
+   each load draws the whole atlas once, so that pages the
+   warm path maps in lazily are paid for too. */
+static int
+bench_atlas(int argc, char **argv)
+{
+	struct arena *arena;
+	struct tileset *tiles;
+	SDL_Surface *dst = NULL;
+	const char *path;
+	char *cache;
+	double t0, cold = 0, warm = 0;
+	int n, i, k;
+
+	n    = argc > 0 ? atoi(argv[0]) : 20;
+	path = argc > 1 ? argv[1] : "assets/tileset";
+	cache = tileset_cachefile(path);
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 2; k++) {
+			if (k == 0) unlink(cache);
+
+			t0 = s_seconds();
+			arena = arena_new(MEM_TILESET);
+			tiles = tileset_read(arena, path);
+			if (!tiles) return 1;
+			if (!dst)
+				dst = SDL_CreateRGBSurface(0, tiles->surface->w, tiles->surface->h, 32, 0, 0, 0, 0);
+			SDL_BlitSurface(tiles->surface, NULL, dst, NULL);
+			arena_free(arena);
+
+			if (k == 0) cold += s_seconds() - t0;
+			else        warm += s_seconds() - t0;
+		}
+	}
+	fprintf(stderr, "atlas: %s, %d rounds\n", cache, n);
+	fprintf(stderr, "atlas: cold (decode .png, write atlas): %.3fms/load\n", cold * 1e3 / n);
+	fprintf(stderr, "atlas: warm (map atlas):                %.3fms/load\n", warm * 1e3 / n);
+
+	SDL_FreeSurface(dst);
+	release(cache);
+	return 0;
+}
+
+/* a line of HUD text put up each frame: laid out afresh,
+   glyph by glyph (cycling through more strings than the
+   cache holds, so that every one misses), and then the same
+   line again, from its cached strip. */
+static int
+bench_text(int argc, char **argv)
+{
+	struct tileset *strip;
+	struct text *text;
+	SDL_Surface *dst;
+	SDL_Rect src, to;
+	char lines[64][64];
+	double t0, t1, t2;
+	int n, i, glyphs;
+
+	n = argc > 0 ? atoi(argv[0]) : 100000;
+
+	text = text_new(argc > 1 ? argv[1] : "assets/font");
+	if (!text) return 1;
+	dst = SDL_CreateRGBSurface(0, 512, 64, 32, 0, 0, 0, 0);
+	if (!dst) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	glyphs = 0;
+	for (i = 0; i < 64; i++)
+		glyphs += snprintf(lines[i], sizeof(lines[i]), "%3d FPS  %d,%d  %dK", 60 - i % 3, i, 64 - i, 1000 + i);
+
+	to.x = to.y = 0;
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		strip = text_layout(text, lines[i % 64]);
+		src.x = src.y = 0;
+		src.w = strip->tile.width;
+		src.h = strip->tile.height;
+		SDL_BlitSurface(strip->surface, &src, dst, &to);
+	}
+	t1 = s_seconds();
+	for (i = 0; i < n; i++) {
+		strip = text_layout(text, lines[0]);
+		src.x = src.y = 0;
+		src.w = strip->tile.width;
+		src.h = strip->tile.height;
+		SDL_BlitSurface(strip->surface, &src, dst, &to);
+	}
+	t2 = s_seconds();
+
+	fprintf(stderr, "text: %d lines of ~%d glyphs\n", n, glyphs / 64);
+	fprintf(stderr, "text: laid out every time (blit per glyph): %.1fns/line\n", (t1 - t0) * 1e9 / n);
+	fprintf(stderr, "text: cached strip (one blit):              %.1fns/line\n", (t2 - t1) * 1e9 / n);
+
+	SDL_FreeSurface(dst);
+	text_free(text);
+	return 0;
+}
+
+/* a world around a generated map, as world_load() would
+   leave it, but without a tileset */
+static struct world *
+s_world(struct map *map)
+{
+	struct world *w;
+
+	w = world_new(1);
+	w->map   = map;
+	w->arena = arena_new(MEM_ENTITY);
+	w->hero  = arena_alloc(w->arena, 1, sizeof(struct sprite));
+	return w;
+}
+
+static uint64_t
+s_fingerprint(struct map *map)
+{
+	uint64_t h = 0;
+	int x, y;
+
+	for (x = 0; x < map->width; x++)
+		for (y = 0; y < map->height; y++)
+			h = h * 31 + (uint32_t)map_get(map, MAP_FLOOR, x, y) * 7 + (uint32_t)map_get(map, MAP_OBJECTS, x, y);
+	return h;
+}
+
+/* a steady COUNT particles in flight, scattered over four screens'
+   worth of world around a 640x480 view: updated, culled and
+   drawn a frame at a time, with the dead topped back up in
+   between (untimed). */
+static int
+bench_particles(int argc, char **argv)
+{
+	struct particles *p;
+	struct world *w;
+	double t0, t1, t2, update, draw;
+	int n, frames, f, drawn;
+
+	n      = argc > 0 ? atoi(argv[0]) : 10000;
+	frames = argc > 1 ? atoi(argv[1]) : 200;
+
+	p = particles_new("assets/particles", n);
+	if (!p) return 1;
+	p->gravity = 40;
+
+	w = s_world(s_generate(64, 64, 0, 1));
+	w->particles = p;
+	w->surface   = SDL_CreateRGBSurface(0, 640, 480, 32, 0, 0, 0, 0);
+	if (!w->surface) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+	w->viewport.at.x   = 320;
+	w->viewport.at.y   = 240;
+	w->viewport.width  = 640;
+	w->viewport.height = 480;
+
+	srand(1);
+	update = draw = 0;
+	drawn  = 0;
+	for (f = 0; f < frames; f++) {
+		while (p->n < n)
+			particles_emit(p, rand() % 1280, rand() % 960,
+				rand() % 121 - 60, rand() % 121 - 60,
+				(rand() % 1000) / 1000.0, rand() % p->tiles->count);
+
+		t0 = s_seconds();
+		particles_update(p, 1 / 60.0);
+		t1 = s_seconds();
+		drawn += particles_draw(p, w);
+		t2 = s_seconds();
+
+		update += t1 - t0;
+		draw   += t2 - t1;
+	}
+
+	fprintf(stderr, "particles: %d in flight, %d frames, %.0f%% in view\n",
+		n, frames, drawn * 100.0 / ((double)n * frames));
+	fprintf(stderr, "particles: update (and compact):  %.1fus per 10k\n", update * 1e6 / frames * 10000 / n);
+	fprintf(stderr, "particles: cull and draw:         %.1fus per 10k\n", draw * 1e6 / frames * 10000 / n);
+
+	SDL_FreeSurface(w->surface);
+	w->surface = NULL;
+	world_free(w);
+	return 0;
+}
+
+/* full and delta snapshots, saved and restored, as the
+   number of placed objects grows */
+static int
+bench_snapshot(int argc, char **argv)
+{
+	static const int CLUTTER[] = { 0, 1, 5, 10, 25, 50 };
+	struct snapshot full, delta;
+	struct world *w;
+	struct map *map;
+	struct coords c;
+	double t0, t1, t2, t3, t4;
+	uint64_t want;
+	int size, n, rounds, i, k, r, v;
+
+	size   = argc > 0 ? atoi(argv[0]) : 256;
+	n      = argc > 1 ? atoi(argv[1]) : 64;
+	rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+	memset(&full,  0, sizeof(full));
+	memset(&delta, 0, sizeof(delta));
+	fprintf(stderr, "snapshot: %dx%d map, %d changes per delta, %d rounds\n", size, size, n, rounds);
+	fprintf(stderr, "snapshot: %8s %10s %10s %10s %10s %12s\n",
+		"objects", "full", "save", "delta", "save", "restore x2");
+
+	for (k = 0; k < (int)(sizeof(CLUTTER) / sizeof(CLUTTER[0])); k++) {
+		map = s_generate(size, size, CLUTTER[k], 42);
+		w   = s_world(map);
+
+		t0 = s_seconds();
+		for (r = 0; r < rounds; r++)
+			snapshot_save(w, NULL, &full);
+		t1 = s_seconds();
+
+		for (i = 0; i < n; i++) {
+			c = s_open_cell(map);
+			v = map_get(map, MAP_OBJECTS, c.x, c.y);
+			map_set(map, MAP_OBJECTS, c.x, c.y, v ? TILE_NONE : (2 << 24));
+		}
+		w->hero->at.x += 100;
+		want = s_fingerprint(map);
+
+		t2 = s_seconds();
+		for (r = 0; r < rounds; r++)
+			snapshot_save(w, &full, &delta);
+		t3 = s_seconds();
+
+		/* back and forth between the two, so every restore
+		   has n changes to undo (or redo) */
+		for (r = 0; r < rounds; r++) {
+			snapshot_restore(w, &full, NULL);
+			snapshot_restore(w, &delta, &full);
+		}
+		t4 = s_seconds();
+		if (s_fingerprint(map) != want) {
+			fprintf(stderr, "snapshot: restored map differs!\n");
+			return 1;
+		}
+
+		fprintf(stderr, "snapshot: %8d %9zuK %8.1fus %9zuB %8.1fus %10.1fus\n",
+			layer_count(map->objects), full.size / 1024, (t1 - t0) * 1e6 / rounds,
+			delta.size, (t3 - t2) * 1e6 / rounds, (t4 - t3) * 1e6 / rounds);
+		world_free(w);
+	}
+
+	snapshot_release(&full);
+	snapshot_release(&delta);
+	return 0;
+}
+
+/* the mixer, under whatever SDL_AUDIODRIVER says (dummy
+   or disk, on a machine with no sound card), with sounds
+   started at the given rate, to see how the callback holds up */
+static int
+bench_audio(int argc, char **argv)
+{
+	static const double PITCH[] = { 220, 330, 440, 660 };
+	struct audio *a;
+	int16_t *pcm;
+	double t0;
+	int secs, rate, i, k, frames, ids[4], played;
+
+	secs = argc > 0 ? atoi(argv[0]) : 5;
+	rate = argc > 1 ? atoi(argv[1]) : 50;
+
+	if (SDL_Init(SDL_INIT_AUDIO) != 0) {
+		fprintf(stderr, "sdl_init() failed: %s\n", SDL_GetError());
+		return 1;
+	}
+	a = audio_open(44100, 512);
+	if (!a) return 1;
+
+	/* a quarter second of each tone, mono, at 22kHz, so
+	   that loading exercises the conversion too */
+	frames = 22050 / 4;
+	pcm = allocate(frames, sizeof(int16_t));
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < frames; i++)
+			pcm[i] = (int16_t)(8000 * sin(2 * M_PI * PITCH[k] * i / 22050));
+		ids[k] = audio_sample(a, pcm, frames, 1, 22050);
+	}
+	release(pcm);
+
+	played = 0;
+	t0 = s_seconds();
+	while (s_seconds() - t0 < secs) {
+		for (; played < (s_seconds() - t0) * rate; played++) {
+			audio_play(a, ids[played % 4], AUDIO_VOLUME / 2, played % 97 == 0);
+			if (played % 53 == 0)
+				audio_stop(a, 0);
+		}
+		SDL_Delay(5);
+	}
+
+	fprintf(stderr, "audio: %d sounds over %ds\n", played, secs);
+	audio_report(a, stderr);
+	audio_close(a);
+	SDL_Quit();
+	return 0;
+}
+
+/* npcs wandering a generated map (about one cell every 8 ticks,
+   turning at random when they hit something), run a tick at a
+   time; then the same number spinning through arithmetic, 40
+   times round a loop a tick, for the interpreter's raw speed.
+   nothing collides (the wanderers look before they step), so
+   only the scripts are timed. */
+#define WANDER "\
+	d = 1; e = 0\n\
+look:	a = solid d e\n\
+	if a goto pick\n\
+	move d e\n\
+	wait 8\n\
+	move 0 0\n\
+	goto look\n\
+pick:	a = rand 4\n\
+	d = 0; e = 0\n\
+	if a == 0 goto w\n\
+	if a == 1 goto east\n\
+	if a == 2 goto n\n\
+	e = 1; goto look\n\
+w:	d = -1; goto look\n\
+east:	d = 1; goto look\n\
+n:	e = -1; goto look\n"
+
+#define SPIN "\
+tick:	i = 0\n\
+loop:	a = a * 1103515245\n\
+	a = a + 12345\n\
+	b = a & 255\n\
+	i = i + 1\n\
+	if i < 40 goto loop\n\
+	yield\n\
+	goto tick\n"
+
+static int
+bench_script(int argc, char **argv)
+{
+	static const struct { const char *name, *src; } SCRIPTS[] = {
+		{ "wander", WANDER },
+		{ "spin",   SPIN   },
+	};
+	struct program *prog;
+	struct world *w;
+	struct map *map;
+	struct sprite *s;
+	double t0, t;
+	unsigned long ran;
+	int n, ticks, k, i, f;
+
+	n     = argc > 0 ? atoi(argv[0]) : 10000;
+	ticks = argc > 1 ? atoi(argv[1]) : 200;
+
+	for (k = 0; k < (int)(sizeof(SCRIPTS) / sizeof(SCRIPTS[0])); k++) {
+		map  = s_generate(256, 256, 5, 42);
+		prog = script_compile(map->arena, SCRIPTS[k].src, SCRIPTS[k].name, 1);
+		if (!prog) return 1;
+
+		map->nnpcs = n;
+		map->npcs  = arena_alloc(map->arena, n, sizeof(struct npcdef));
+		for (i = 0; i < n; i++) {
+			map->npcs[i].at      = s_open_cell(map);
+			map->npcs[i].program = prog;
+		}
+
+		w = s_world(map);
+		w->npcs = npcs_new(map, 64, 64);
+
+		ran = 0;
+		t0  = s_seconds();
+		for (f = 0; f < ticks; f++) {
+			ran += npcs_run(w->npcs, w, INT_MAX);
+			for (i = 0; i < n; i++) {
+				s = &w->npcs->sprites[i];
+				s->at.x += s->delta.x;
+				s->at.y += s->delta.y;
+			}
+		}
+		t = s_seconds() - t0;
+
+		fprintf(stderr, "script: %-6s (%d instructions) %d npcs: %8.1fus a tick, %6.1f instructions an npc a tick, %.0fM instructions/s (%.2fns each)\n",
+			SCRIPTS[k].name, script_length(prog), n, t * 1e6 / ticks,
+			(double)ran / ticks / n, ran / t / 1e6, t * 1e9 / ran);
+
+		/* and a tick under the game's own budget */
+		w->npcs->starved = w->npcs->preempted = 0;
+		ran = npcs_run(w->npcs, w, SCRIPT_BUDGET);
+		fprintf(stderr, "script: %-6s a tick on a budget of %d: %lu run, %lu npcs' turns put off, %lu cut short\n",
+			SCRIPTS[k].name, SCRIPT_BUDGET, ran, w->npcs->starved, w->npcs->preempted);
+		world_free(w);
+	}
+	return 0;
+}
+
+/* resident set size, in KiB (Linux only) */
+static long
+s_rss()
+{
+	FILE *f;
+	long pages = 0;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) return 0;
+	if (fscanf(f, "%*s %ld", &pages) != 1) pages = 0;
+	fclose(f);
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int
+bench_soak(int argc, char **argv)
+{
+	struct world *world;
+	const char *map;
+	double t0, t1;
+	long first, rss;
+	int n, i;
+
+	n   = argc > 0 ? atoi(argv[0]) : 1000;
+	map = argc > 1 ? argv[1] : "maps/base";
+
+	world = world_new(4);
+	world_load(world, map, "assets/purple-hair-sprite");
+	first = s_rss();
+
+	t0 = s_seconds();
+	for (i = 1; i <= n; i++) {
+		world_load(world, map, "assets/purple-hair-sprite");
+		if (i % (n / 10 ? n / 10 : 1) == 0) {
+			rss = s_rss();
+			fprintf(stderr, "soak: %6d loads, rss %ldKiB (%+ldKiB)\n", i, rss, rss - first);
+		}
+	}
+	t1 = s_seconds();
+	fprintf(stderr, "soak: %.2fms per map switch\n", (t1 - t0) * 1e3 / n);
+
+	world_free(world);
+	mem_report(stderr);
+	return 0;
+}
+
+/* the game loop, for FRAMES ticks at one every MS milliseconds
+   (0 for flat out), on a 1280x720 screen: serially (update,
+   draw, present, wait) and then with drawing on its own thread
+   (update, publish, wait), with the hero wandering about. */
+static void
+s_wander(struct world *world, int f)
+{
+	int r;
+
+	if (f % 30 == 0) {
+		r = rand();
+		sprite_move_all(world->hero, r & 1, r & 2, r & 4, r & 8);
+	}
+}
+
+static int
+bench_render(int argc, char **argv)
+{
+	struct renderstats st;
+	struct renderer *r;
+	struct world *world;
+	SDL_Surface *screen;
+	const char *map;
+	double t0, t1, d, sum, max;
+	int n, ms, f;
+
+	n   = argc > 0 ? atoi(argv[0]) : 300;
+	ms  = argc > 1 ? atoi(argv[1]) : 16;
+	map = argc > 2 ? argv[2] : "maps/base";
+
+	world = world_new(4);
+	world->surface = SDL_CreateRGBSurface(0, 1280, 720, 32, 0, 0, 0, 0);
+	if (!world->surface) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+	world->viewport.width  = world->surface->w;
+	world->viewport.height = world->surface->h;
+	world_load(world, map, "assets/purple-hair-sprite");
+
+	srand(1);
+	sum = max = 0;
+	t0 = s_seconds();
+	for (f = 0; f < n; f++) {
+		s_wander(world, f);
+		t1 = s_seconds();
+		world_update(world);
+		world_render(world);
+		d = s_seconds() - t1;
+		sum += d;
+		if (d > max) max = d;
+		if (ms) SDL_Delay(ms);
+	}
+	t1 = s_seconds();
+	fprintf(stderr, "render: serial:   %.1f ticks/s; %.2fms update to present, mean (%.2fms worst)\n",
+		n / (t1 - t0), sum * 1e3 / n, max * 1e3);
+
+	srand(1);
+	r = renderer_new(world);
+	sum = max = 0;
+	t0 = s_seconds();
+	for (f = 0; f < n; f++) {
+		s_wander(world, f);
+		t1 = s_seconds();
+		world_update(world);
+		renderer_publish(r, world);
+		d = s_seconds() - t1;
+		sum += d;
+		if (d > max) max = d;
+		if (ms) SDL_Delay(ms);
+	}
+	t1 = s_seconds();
+	renderer_sync(r);
+	renderer_stats(r, &st);
+	fprintf(stderr, "render: threaded: %.1f ticks/s; %.2fms update and publish, mean (%.2fms worst)\n",
+		n / (t1 - t0), sum * 1e3 / n, max * 1e3);
+	fprintf(stderr, "render: threaded: %.2fms publish to present, mean (%.2fms worst); %lu of %lu frames drawn\n",
+		st.mean / 1e3, st.max / 1e3, st.drawn, st.published);
+	renderer_free(r, world);
+
+	screen = world->surface;
+	world_free(world);
+	SDL_FreeSurface(screen);
+	return 0;
+}
+
+/* a 1280x720 screen captured every frame, at a frame every
+   MS milliseconds (0 for flat out), to PATH: "/dev/null" to
+   see just the cost to the game thread, a %d pattern for PNGs
+   to see the writer fall behind, and frames dropped. */
+static int
+bench_capture(int argc, char **argv)
+{
+	struct capture *c;
+	SDL_Surface *screen;
+	const char *path;
+	int n, ms, i;
+
+	n    = argc > 0 ? atoi(argv[0]) : 300;
+	path = argc > 1 ? argv[1] : "/dev/null";
+	ms   = argc > 2 ? atoi(argv[2]) : 16;
+
+	screen = SDL_CreateRGBSurface(0, 1280, 720, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+	if (!screen) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+	c = capture_open(path, screen, CAPTURE_BUFFERS);
+	if (!c) return 1;
+
+	for (i = 0; i < n; i++) {
+		SDL_FillRect(screen, NULL, SDL_MapRGB(screen->format, i * 3, i * 5, i * 7));
+		capture_frame(c, screen);
+		if (ms) SDL_Delay(ms);
+	}
+	capture_report(c, stderr);
+	capture_close(c);
+	SDL_FreeSurface(screen);
+	return 0;
+}
+
+/* a 2560x1440 screen over a SIZE x SIZE map, drawn whole,
+   then split two and four ways, with each player in a
+   quarter of the map of their own, nowhere near the others.
+   the views share one chunk cache, sized for all of them,
+   so once they're up a frame should load next to nothing. */
+static int
+bench_split(int argc, char **argv)
+{
+	struct world *world;
+	struct sprite *h;
+	struct coords c;
+	SDL_Surface *screen;
+	double t0, t[WORLD_VIEWS + 1];
+	unsigned long loads;
+	int frames, size, n, i, f;
+
+	frames = argc > 0 ? atoi(argv[0]) : 200;
+	size   = argc > 1 ? atoi(argv[1]) : 512;
+
+	world = world_new(4);
+	world->surface = SDL_CreateRGBSurface(0, 2560, 1440, 32, 0, 0, 0, 0);
+	if (!world->surface) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+	world->viewport.width  = world->surface->w;
+	world->viewport.height = world->surface->h;
+	world_begin(world);
+	world->map = s_generate(size, size, 10, 1);
+	world->map->tiles = tileset_read(world->map->arena, "assets/tileset");
+	world_load_hero(world, "assets/purple-hair-sprite");
+	world_finish(world);
+
+	for (n = 1; n <= WORLD_VIEWS; n *= 2) {
+		world_split(world, n);
+		srand(n);
+		for (i = 0; i < n; i++) {
+			do {
+				c.x = (i % 2) * size / 2 + rand() % (size / 2);
+				c.y = (i / 2) * size / 2 + rand() % (size / 2);
+			} while (map_solid(world->map, c.x, c.y));
+			h = world->views[i].hero;
+			h->at.x = c.x * world->map->tiles->tile.width  * world->scale;
+			h->at.y = c.y * world->map->tiles->tile.height * world->scale;
+		}
+		world_update(world);
+		world_render(world);
+
+		loads = rcache_loads(world->cache);
+		t0 = s_seconds();
+		for (f = 0; f < frames; f++)
+			world_render(world);
+		t[n] = (s_seconds() - t0) / frames;
+		loads = rcache_loads(world->cache) - loads;
+		fprintf(stderr, "split: %d view%s %.3fms/frame, %lu chunk loads in %d frames\n",
+		        n, n == 1 ? ": " : "s:", t[n] * 1e3, loads, frames);
+	}
+	fprintf(stderr, "split: four views cost %.2fx one (four whole screens would be 4x)\n", t[4] / t[1]);
+
+	screen = world->surface;
+	world_free(world);
+	SDL_FreeSurface(screen);
+	return 0;
+}
+
+/* a SIZE x SIZE map, on a 1280x720 screen at 4x: a normal
+   frame from the chunk cache, then zoomed out a step at a
+   time, from the overview; and, while it's bearable, tile by
+   tile too, for comparison.  then what it costs to keep the
+   overview up to date as cells change. */
+static int
+bench_overview(int argc, char **argv)
+{
+	struct overview *ov;
+	struct rcache *rc;
+	struct map *map;
+	SDL_Surface *screen;
+	SDL_Rect view, to, src, at;
+	double t0, normal, zoomed, tiled;
+	long cells;
+	int size, frames, z, f, i, n, x, y, dx, dy;
+
+	size   = argc > 0 ? atoi(argv[0]) : 2048;
+	frames = argc > 1 ? atoi(argv[1]) : 100;
+
+	map = s_generate(size, size, 10, 1);
+	map->tiles = tileset_read(map->arena, "assets/tileset");
+	screen = SDL_CreateRGBSurface(0, 1280, 720, 32, 0, 0, 0, 0);
+	if (!map->tiles || !screen) {
+		fprintf(stderr, "failed to set up surfaces: %s\n", SDL_GetError());
+		return 1;
+	}
+	dx = map->tiles->tile.width  * 4;
+	dy = map->tiles->tile.height * 4;
+	to.x = to.y = 0;
+	to.w = screen->w;
+	to.h = screen->h;
+
+	t0 = s_seconds();
+	ov = overview_new(map);
+	fprintf(stderr, "overview: %dx%d map: built in %.1fms\n", size, size, (s_seconds() - t0) * 1e3);
+
+	rc = rcache_new(map);
+	view = to;
+	view.x = size * dx / 2;
+	view.y = size * dy / 2;
+	rcache_draw(rc, screen, 4, &view);
+	t0 = s_seconds();
+	for (f = 0; f < frames; f++)
+		rcache_draw(rc, screen, 4, &view);
+	normal = (s_seconds() - t0) / frames;
+	fprintf(stderr, "overview: zoom 0: %8ld cells, chunk cache: %.3fms/frame\n",
+		(long)(to.w / dx) * (to.h / dy), normal * 1e3);
+
+	for (z = 1; z <= WORLD_ZOOM && (to.w << (z - 1)) < size * dx; z++) {
+		view.w = to.w << z;
+		view.h = to.h << z;
+		view.x = (size * dx - view.w) / 2;
+		view.y = (size * dy - view.h) / 2;
+
+		t0 = s_seconds();
+		for (f = 0; f < frames; f++)
+			overview_draw(ov, screen, &view, dx, dy, &to);
+		zoomed = (s_seconds() - t0) / frames;
+
+		/* every cell in view, shrunk to its share of the screen */
+		cells = (long)bounded(0, view.w / dx, size) * bounded(0, view.h / dy, size);
+		tiled = 0;
+		if (cells <= 1 << 22) {
+			src.w = map->tiles->tile.width;
+			src.h = map->tiles->tile.height;
+			at.w  = dx >> z ? dx >> z : 1;
+			at.h  = dy >> z ? dy >> z : 1;
+			t0 = s_seconds();
+			for (x = bounded(0, view.x / dx, size); x < bounded(0, (view.x + view.w) / dx, size); x++) {
+				for (y = bounded(0, view.y / dy, size); y < bounded(0, (view.y + view.h) / dy, size); y++) {
+					n = tileof(map, mapat(map, MAP_FLOOR, x, y));
+					src.x = src.w * (n % map->tiles->width);
+					src.y = src.h * (n / map->tiles->width);
+					at.x  = (x * dx - view.x) >> z;
+					at.y  = (y * dy - view.y) >> z;
+					SDL_BlitScaled(map->tiles->surface, &src, screen, &at);
+				}
+			}
+			tiled = s_seconds() - t0;
+		}
+
+		if (tiled > 0)
+			fprintf(stderr, "overview: zoom %d: %8ld cells, overview: %.3fms/frame (%.2fx zoom 0); tile by tile: %.1fms/frame\n",
+				z, cells, zoomed * 1e3, zoomed / normal, tiled * 1e3);
+		else
+			fprintf(stderr, "overview: zoom %d: %8ld cells, overview: %.3fms/frame (%.2fx zoom 0)\n",
+				z, cells, zoomed * 1e3, zoomed / normal);
+	}
+
+	/* objects come and go, a frame's worth at a time */
+	n = 100000;
+	srand(1);
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		x = rand() % size;
+		y = rand() % size;
+		map_set(map, MAP_OBJECTS, x, y, map_get(map, MAP_OBJECTS, x, y) ? TILE_NONE : (2 << 24));
+		if (i % 16 == 15)
+			overview_update(ov);
+	}
+	overview_update(ov);
+	fprintf(stderr, "overview: %d changes: %.1fns/change, map_set() included\n",
+		n, (s_seconds() - t0) * 1e9 / n);
+
+	overview_free(ov);
+	rcache_free(rc);
+	map_free(map);
+	SDL_FreeSurface(screen);
+	return 0;
+}
+
+/* the map parser, on a SIZE x SIZE map from mapgen.c with
+   OBJECTS objects, some npcs, and a few ragged rows: from
+   memory (map_parse()), then from disk (map_read(), tileset
+   and all), and the most the map and parser ever had in use
+   at once. */
+static int
+bench_parse(int argc, char **argv)
+{
+	struct memstats map, parser;
+	struct mapgen g;
+	struct map *m;
+	FILE *key, *grid;
+	char *k, *c, dir[] = "/tmp/prisma-parse-XXXXXX", *path;
+	size_t nk, nc;
+	double t0, mem, disk;
+	int n, i;
+
+	g.width   = argc > 0 ? atoi(argv[0]) : 1024;
+	g.height  = g.width;
+	g.objects = argc > 1 ? atoi(argv[1]) : 10000;
+	n         = argc > 2 ? atoi(argv[2]) : 20;
+	g.density = 20;
+	g.ragged  = 10;
+	g.npcs    = 64;
+	g.seed    = 1;
+
+	key  = open_memstream(&k, &nk);
+	grid = open_memstream(&c, &nc);
+	if (!key || !grid) {
+		fprintf(stderr, "failed to generate map: %s (error %d)\n", strerror(errno), errno);
+		return 1;
+	}
+	mapgen(&g, key, grid);
+	fclose(key);
+	fclose(grid);
+
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		m = map_parse(k, nk, c, "generated.mf");
+		if (!m) return 1;
+		map_free(m);
+	}
+	mem = (s_seconds() - t0) / n;
+
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "failed to make a directory for the map: %s (error %d)\n", strerror(errno), errno);
+		return 1;
+	}
+	path = astring("%s/map", dir);
+	if (mapgen_write(&g, path) != 0)
+		return 1;
+	t0 = s_seconds();
+	for (i = 0; i < n; i++) {
+		m = map_read(path);
+		if (!m) return 1;
+		map_free(m);
+	}
+	disk = (s_seconds() - t0) / n;
+	unlink(path);
+	release(path);
+	path = astring("%s/map.mf", dir);
+	unlink(path);
+	release(path);
+	rmdir(dir);
+
+	mem_stats(MEM_MAP, &map);
+	mem_stats(MEM_PARSER, &parser);
+	fprintf(stderr, "parse: %dx%d, %d objects, %d npcs: %.1fKiB of key, %.1fKiB of grid\n",
+		g.width, g.height, g.objects, g.npcs, nk / 1024.0, nc / 1024.0);
+	fprintf(stderr, "parse: from memory: %.2fms/map, %.1fMiB/s, %.1fM cells/s\n",
+		mem * 1e3, (nk + nc) / mem / (1 << 20), (double)g.width * g.height / mem / 1e6);
+	fprintf(stderr, "parse: from disk:   %.2fms/map, tileset included\n", disk * 1e3);
+	fprintf(stderr, "parse: peak: %luKiB map, %luKiB parser\n",
+		(unsigned long)(map.peak + 1023) / 1024, (unsigned long)(parser.peak + 1023) / 1024);
+
+	free(k);
+	free(c);
+	return 0;
+}
+
+static struct {
+	const char *name;
+	int (*fn)(int, char **);
+	const char *usage;
+} BENCHMARKS[] = {
+	{ "path", bench_path, "path [SIZE [QUERIES]]" },
+	{ "flow", bench_flow, "flow [SIZE [AGENTS]]" },
+	{ "ray",  bench_ray,  "ray [SIZE [RAYS]]" },
+	{ "mutate", bench_mutate, "mutate [SIZE [CHANGES]]" },
+	{ "tiles",  bench_tiles,  "tiles [CELLS [TILESET]]" },
+	{ "atlas",  bench_atlas,  "atlas [ROUNDS [TILESET]]" },
+	{ "text",   bench_text,   "text [LINES [FONT]]" },
+	{ "particles", bench_particles, "particles [COUNT [FRAMES]]" },
+	{ "audio",  bench_audio,  "audio [SECONDS [SOUNDS/SEC]]" },
+	{ "snapshot", bench_snapshot, "snapshot [SIZE [CHANGES [ROUNDS]]]" },
+	{ "script", bench_script,  "script [NPCS [TICKS]]" },
+	{ "split",  bench_split,  "split [FRAMES [SIZE]]" },
+	{ "capture", bench_capture, "capture [FRAMES [PATH [MS]]]" },
+	{ "render", bench_render,  "render [FRAMES [MS [MAP]]]" },
+	{ "overview", bench_overview, "overview [SIZE [FRAMES]]" },
+	{ "parse",  bench_parse,  "parse [SIZE [OBJECTS [ROUNDS]]]" },
+	{ "soak",   bench_soak,   "soak [LOADS [MAP]]" },
+	{ NULL, NULL, NULL },
+};
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc > 1) {
+		for (i = 0; BENCHMARKS[i].name; i++)
+			if (strcmp(argv[1], BENCHMARKS[i].name) == 0)
+				return BENCHMARKS[i].fn(argc - 2, argv + 2);
+	}
+
+	fprintf(stderr, "USAGE: %s SUBSYSTEM [OPTIONS...]\n", argv[0]);
+	for (i = 0; BENCHMARKS[i].name; i++)
+		fprintf(stderr, "       %s %s\n", argv[0], BENCHMARKS[i].usage);
+	return 1;
+}
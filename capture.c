@@ -0,0 +1,307 @@
+#include "prisma.h"
+#include <limits.h>
+#include <unistd.h>
+
+/* frame capture, for screenshots and recordings.
+
+   at the end of a frame, capture_frame() copies the screen
+   into one of a handful of buffers, set up front, and hands
+   it to a thread of its own, which writes it out (as a
+   numbered PNG, or onto the end of a raw stream) and gives
+   the buffer back.  the game thread pays for one copy of the
+   screen, and nothing else: it never waits on the writer.
+   if the writer falls so far behind that every buffer is
+   still queued, the frame is dropped (and counted).
+
+   buffers go back and forth through two single-producer,
+   single-consumer rings of buffer numbers, as in audio.c:
+   full ones to the writer, and empty ones back.  the writer
+   sleeps on a semaphore, posted once a frame. */
+
+#define CAPTURE_RING 8   /* a power of two, >= CAPTURE_BUFFERS */
+
+struct ring {
+	int          slots[CAPTURE_RING];
+	SDL_atomic_t head, tail;  /* tail is the producer's */
+};
+
+struct capture {
+	char *path;           /* a printf() pattern, for PNGs */
+	FILE *raw;            /* or a stream, for raw frames */
+
+	int w, h, pitch, bpp;
+	int n;
+	unsigned char *pixels;          /* n x pitch x h */
+	SDL_Surface   *frames[CAPTURE_BUFFERS];
+	int            number[CAPTURE_BUFFERS];
+
+	struct ring  empty, full;
+	SDL_sem     *ready;
+	SDL_Thread  *writer;
+	SDL_atomic_t quit;
+
+	/* the game thread's */
+	int    first;         /* the first frame's number */
+	int    taken;
+	unsigned long dropped;
+	double sum, max;
+
+	/* the writer's */
+	SDL_atomic_t written, failed;
+};
+
+static int
+s_push(struct ring *r, int i)
+{
+	int tail = SDL_AtomicGet(&r->tail);
+
+	if (tail - SDL_AtomicGet(&r->head) == CAPTURE_RING)
+		return 0;
+	r->slots[tail & (CAPTURE_RING - 1)] = i;
+	SDL_AtomicSet(&r->tail, tail + 1);
+	return 1;
+}
+
+static int
+s_pop(struct ring *r)
+{
+	int head = SDL_AtomicGet(&r->head), i;
+
+	if (head == SDL_AtomicGet(&r->tail))
+		return -1;
+	i = r->slots[head & (CAPTURE_RING - 1)];
+	SDL_AtomicSet(&r->head, head + 1);
+	return i;
+}
+
+static int
+s_write(struct capture *c, int i)
+{
+	unsigned char *p;
+	char file[PATH_MAX];
+	int y;
+
+	if (c->raw) {
+		p = c->pixels + (size_t)i * c->pitch * c->h;
+		for (y = 0; y < c->h; y++)
+			if (fwrite(p + y * c->pitch, c->w * c->bpp, 1, c->raw) != 1)
+				return -1;
+		return 0;
+	}
+
+	snprintf(file, sizeof(file), c->path, c->number[i]);
+	return IMG_SavePNG(c->frames[i], file);
+}
+
+static int
+s_writer(void *data)
+{
+	struct capture *c = data;
+	int i;
+
+	for (;;) {
+		SDL_SemWait(c->ready);
+		i = s_pop(&c->full);
+		if (i < 0) {
+			if (SDL_AtomicGet(&c->quit))
+				return 0;
+			continue;
+		}
+
+		if (s_write(c, i) != 0) {
+			if (SDL_AtomicAdd(&c->failed, 1) == 0)
+				fprintf(stderr, "capture: failed to write frame %d: %s\n",
+					c->number[i], c->raw ? strerror(errno) : SDL_GetError());
+		} else {
+			SDL_AtomicAdd(&c->written, 1);
+		}
+		s_push(&c->empty, i);
+	}
+}
+
+/* is p a pattern with one %d (perhaps with a width, or
+   zero-padded) and no other conversion, but %%? */
+static int
+s_pattern(const char *p)
+{
+	int n = 0;
+
+	for (; *p; p++) {
+		if (*p != '%' || *++p == '%')
+			continue;
+		while (*p == '0')
+			p++;
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p != 'd')
+			return 0;
+		n++;
+	}
+	return n == 1;
+}
+
+/* capture frames the size and format of like, into path:
+   a pattern like "shot%04d.png" (one %d, for the frame
+   number) for a PNG per frame, or any other file (or "-",
+   for stdout) for a raw stream.  nothing already there is
+   overwritten: frames are numbered on from the first free
+   number, and a raw stream that exists becomes path.1, or
+   path.2, and so on. */
+struct capture *
+capture_open(const char *path, SDL_Surface *like, int buffers)
+{
+	struct capture *c;
+	SDL_PixelFormat *f = like->format;
+	const char *base;
+	char file[PATH_MAX], *alt = NULL;
+	int i;
+
+	assert(buffers > 0 && buffers <= CAPTURE_BUFFERS);
+
+	c = tallocate(MEM_RENDER, 1, sizeof(struct capture));
+	c->w     = like->w;
+	c->h     = like->h;
+	c->bpp   = f->BytesPerPixel;
+	c->pitch = c->w * c->bpp;
+	c->n     = buffers;
+
+	if (strchr(path, '%')) {
+		if (!s_pattern(path)) {
+			fprintf(stderr, "capture pattern %s should have one %%d, and no other conversion\n", path);
+			release(c);
+			return NULL;
+		}
+		c->path = astring("%s", path);
+		for (;; c->first++) {
+			snprintf(file, sizeof(file), c->path, c->first);
+			if (access(file, F_OK) != 0)
+				break;
+		}
+	} else {
+		for (base = path, i = 1; strcmp(path, "-") != 0 && access(path, F_OK) == 0; i++) {
+			release(alt);
+			path = alt = astring("%s.%d", base, i);
+		}
+		c->raw = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+		if (!c->raw) {
+			fprintf(stderr, "failed to open %s for capture: %s (error %d)\n",
+					path, strerror(errno), errno);
+			release(alt);
+			release(c);
+			return NULL;
+		}
+		release(alt);
+	}
+
+	c->pixels = tallocate(MEM_RENDER, (size_t)c->n * c->h, c->pitch);
+	for (i = 0; i < c->n; i++) {
+		c->frames[i] = SDL_CreateRGBSurfaceFrom(c->pixels + (size_t)i * c->pitch * c->h,
+			c->w, c->h, f->BitsPerPixel, c->pitch, f->Rmask, f->Gmask, f->Bmask, f->Amask);
+		if (!c->frames[i]) {
+			fprintf(stderr, "failed to create capture buffer: %s\n", SDL_GetError());
+			exit(EXIT_INT_FAILURE);
+		}
+		s_push(&c->empty, i);
+	}
+
+	c->ready  = SDL_CreateSemaphore(0);
+	c->writer = c->ready ? SDL_CreateThread(s_writer, "capture", c) : NULL;
+	if (!c->writer) {
+		fprintf(stderr, "failed to start capture thread: %s\n", SDL_GetError());
+		exit(EXIT_INT_FAILURE);
+	}
+	return c;
+}
+
+/* write out whatever is still queued, and stop */
+void
+capture_close(struct capture *c)
+{
+	int i;
+
+	if (!c) return;
+
+	SDL_AtomicSet(&c->quit, 1);
+	SDL_SemPost(c->ready);
+	SDL_WaitThread(c->writer, NULL);
+	SDL_DestroySemaphore(c->ready);
+
+	if (c->raw && c->raw != stdout)
+		fclose(c->raw);
+	else if (c->raw)
+		fflush(c->raw);
+	for (i = 0; i < c->n; i++)
+		SDL_FreeSurface(c->frames[i]);
+	release(c->pixels);
+	release(c->path);
+	release(c);
+}
+
+/* take a copy of s (at frame end), for the writer */
+void
+capture_frame(struct capture *c, SDL_Surface *s)
+{
+	unsigned char *to, *from;
+	uint64_t t0;
+	double us;
+	int i, y;
+
+	t0 = clock_monotonic();
+
+	i = s->w == c->w && s->h == c->h ? s_pop(&c->empty) : -1;
+	if (i < 0) {
+		c->dropped++;
+		goto done;
+	}
+
+	if (SDL_MUSTLOCK(s))
+		SDL_LockSurface(s);
+	to   = c->pixels + (size_t)i * c->pitch * c->h;
+	from = s->pixels;
+	for (y = 0; y < c->h; y++)
+		memcpy(to + y * c->pitch, from + y * s->pitch, c->pitch);
+	if (SDL_MUSTLOCK(s))
+		SDL_UnlockSurface(s);
+
+	c->number[i] = c->first + c->taken++;
+	s_push(&c->full, i);
+	SDL_SemPost(c->ready);
+
+done:
+	us = (clock_monotonic() - t0) / 1e3;
+	c->sum += us;
+	if (us > c->max)
+		c->max = us;
+}
+
+void
+capture_stats(struct capture *c, struct capturestats *st)
+{
+	unsigned long frames;
+
+	frames = c->taken + c->dropped;
+	st->frames  = frames;
+	st->taken   = c->taken;
+	st->dropped = c->dropped;
+	st->written = SDL_AtomicGet(&c->written);
+	st->failed  = SDL_AtomicGet(&c->failed);
+	st->mean    = frames ? c->sum / frames : 0;
+	st->max     = c->max;
+}
+
+void
+capture_report(struct capture *c, FILE *out)
+{
+	struct capturestats st;
+
+	if (!c) return;
+	capture_stats(c, &st);
+	fprintf(out, "capture: %dx%d, %d-bit, %d buffers, to %s\n",
+		c->w, c->h, c->bpp * 8, c->n, c->path ? c->path : "a raw stream");
+	fprintf(out, "capture: %lu frames, %lu taken, %lu dropped (all buffers queued)\n",
+		st.frames, st.taken, st.dropped);
+	fprintf(out, "capture: %lu written so far, %lu failed\n",
+		st.written, st.failed);
+	fprintf(out, "capture: %.1fus mean, %.1fus worst, on the game thread\n",
+		st.mean, st.max);
+}
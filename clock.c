@@ -0,0 +1,66 @@
+#include "prisma.h"
+#include <time.h>
+
+uint64_t
+clock_monotonic()
+{
+	int rc;
+	struct timespec now;
+
+	rc = clock_gettime(CLOCK_MONOTONIC, &now);
+	if (rc != 0) {
+		fprintf(stderr, "failed to read CLOCK_MONOTONIC: %s (error %d)\n",
+			strerror(errno), errno);
+		exit(EXIT_ENV_FAILURE);
+	}
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+void
+clock_init(struct clock *c, int virtual)
+{
+	memset(c, 0, sizeof(*c));
+	c->scale   = 1.0;
+	c->virtual = virtual;
+	if (!virtual)
+		c->real = clock_monotonic();
+}
+
+uint64_t
+clock_tick(struct clock *c)
+{
+	uint64_t real, elapsed;
+
+	if (c->virtual) return 0;
+
+	real = clock_monotonic();
+	elapsed = real - c->real;
+	c->real = real;
+
+	if (c->paused) return 0;
+
+	if (c->scale != 1.0)
+		elapsed = (uint64_t)(elapsed * c->scale);
+	c->now += elapsed;
+	return elapsed;
+}
+
+void
+clock_advance(struct clock *c, uint64_t ns)
+{
+	if (!c->paused)
+		c->now += ns;
+}
+
+void
+clock_pause(struct clock *c, int paused)
+{
+	c->paused = paused;
+}
+
+void
+clock_scale(struct clock *c, double scale)
+{
+	assert(scale >= 0);
+	c->scale = scale;
+}
@@ -0,0 +1,358 @@
+#include "prisma.h"
+
+/* flow fields, for crowds that all want the same thing.
+
+   one breadth-first integration pass from the goal gives
+   every cell its walking distance to the goal; each cell
+   then points at its cheapest neighbour.  any number of
+   agents can follow the field with a single lookup.
+
+   the full pass runs on a worker thread, into the back half
+   of a double buffer; flow_update() flips it in once done.
+   small goal moves don't wait on the worker: a little patch
+   field around the new goal is recomputed right away, and
+   agents inside the patch steer by that instead.  since the
+   old goal sits inside the patch, the stale global field
+   still funnels everyone else into it.
+
+   the worker never looks at the map itself, which the game
+   goes on changing under it: each pass gets its own copy of
+   the solidity bitmap, taken when the pass is handed over. */
+
+#define FLOW_PATCH   16   /* patch radius, in cells */
+#define FLOW_SLACK    8   /* goal drift tolerated before a full pass */
+#define FLOW_SIDE    (2 * FLOW_PATCH + 1)
+#define FLOW_FAR     0xffff
+#define FLOW_NONE    4
+
+struct field {
+	struct coords   goal;
+	unsigned short *cost;
+	unsigned char  *dir;
+};
+
+struct flowfield {
+	struct map *map;
+	int watch;   /* our cursor into the map's journal */
+
+	struct field  buf[2];
+	struct field *front;  /* sampled by the caller */
+	struct field *back;   /* written by the worker */
+	int          *queue;
+	uint32_t     *solid;  /* the worker's copy of map->solid */
+
+	struct {
+		struct coords  at;    /* top-left of the window */
+		int            w, h;
+		unsigned short cost[FLOW_SIDE * FLOW_SIDE];
+		unsigned char  dir[FLOW_SIDE * FLOW_SIDE];
+		int            queue[FLOW_SIDE * FLOW_SIDE];
+	} patch;
+
+	struct coords goal;   /* where everyone wants to be */
+	int           stale;  /* front field needs a full pass */
+
+	SDL_Thread *worker;
+	SDL_mutex  *lock;
+	SDL_cond   *wake;
+	SDL_cond   *done;     /* signalled when a pass is ready */
+	int         quit;
+	int         busy;     /* worker owns the back buffer */
+	int         ready;    /* back buffer holds a finished pass */
+	struct coords want;   /* goal for the worker's next pass */
+};
+
+static const int DX[4] = { 0, 1, 0, -1 };
+static const int DY[4] = { -1, 0, 1, 0 };
+
+#define s_index(ff,x,y) ((ff)->map->height * (x) + (y))
+#define s_words(map)    (((map)->width * (map)->height + 31) / 32)
+#define s_solid(map,solid,x,y) \
+	(((solid)[((map)->height * (x) + (y)) / 32] >> (((map)->height * (x) + (y)) % 32)) & 1)
+
+/* integrate distances outward from the goal, then point each
+   cell downhill.  only cells in [x0,x1) x [y0,y1) are visited;
+   cost / dir are laid out column-major over that region.
+   walls come from solid, laid out as map->solid is. */
+static void
+s_integrate(struct map *map, const uint32_t *solid, struct coords goal,
+            int x0, int y0, int x1, int y1,
+            unsigned short *cost, unsigned char *dir, int *queue)
+{
+	int w, h, head, tail, i, x, y, nx, ny, c, n, best, low;
+
+	w = x1 - x0;
+	h = y1 - y0;
+	for (i = 0; i < w * h; i++) {
+		cost[i] = FLOW_FAR;
+		dir[i]  = FLOW_NONE;
+	}
+	if (goal.x < x0 || goal.x >= x1 || goal.y < y0 || goal.y >= y1
+	 || s_solid(map, solid, goal.x, goal.y))
+		return;
+
+	head = tail = 0;
+	c = (goal.x - x0) * h + (goal.y - y0);
+	cost[c] = 0;
+	queue[tail++] = c;
+
+	while (head < tail) {
+		c = queue[head++];
+		x = x0 + c / h;
+		y = y0 + c % h;
+		for (i = 0; i < 4; i++) {
+			nx = x + DX[i];
+			ny = y + DY[i];
+			if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1)
+				continue;
+			n = (nx - x0) * h + (ny - y0);
+			if (cost[n] != FLOW_FAR || s_solid(map, solid, nx, ny))
+				continue;
+			cost[n] = cost[c] == FLOW_FAR - 1 ? cost[c] : cost[c] + 1;
+			queue[tail++] = n;
+		}
+	}
+
+	/* every reached cell (in BFS order) points at its lowest
+	   neighbour; the goal itself points nowhere. */
+	for (head = 1; head < tail; head++) {
+		c = queue[head];
+		x = x0 + c / h;
+		y = y0 + c % h;
+		for (best = FLOW_NONE, low = cost[c], i = 0; i < 4; i++) {
+			nx = x + DX[i];
+			ny = y + DY[i];
+			if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1)
+				continue;
+			n = (nx - x0) * h + (ny - y0);
+			if (cost[n] < low) {
+				low  = cost[n];
+				best = i;
+			}
+		}
+		dir[c] = best;
+	}
+}
+
+static void
+s_patch(struct flowfield *ff)
+{
+	int x0, y0, x1, y1;
+
+	x0 = bounded(0, ff->goal.x - FLOW_PATCH, ff->map->width);
+	y0 = bounded(0, ff->goal.y - FLOW_PATCH, ff->map->height);
+	x1 = bounded(0, ff->goal.x + FLOW_PATCH + 1, ff->map->width);
+	y1 = bounded(0, ff->goal.y + FLOW_PATCH + 1, ff->map->height);
+
+	ff->patch.at.x = x0;
+	ff->patch.at.y = y0;
+	ff->patch.w    = x1 - x0;
+	ff->patch.h    = y1 - y0;
+	s_integrate(ff->map, ff->map->solid, ff->goal, x0, y0, x1, y1,
+	            ff->patch.cost, ff->patch.dir, ff->patch.queue);
+}
+
+static int
+s_worker(void *data)
+{
+	struct flowfield *ff = data;
+	struct coords goal;
+
+	SDL_LockMutex(ff->lock);
+	for (;;) {
+		while (!ff->quit && !(ff->busy && !ff->ready))
+			SDL_CondWait(ff->wake, ff->lock);
+		if (ff->quit) break;
+
+		goal = ff->want;
+		SDL_UnlockMutex(ff->lock);
+
+		ff->back->goal = goal;
+		s_integrate(ff->map, ff->solid, goal, 0, 0, ff->map->width, ff->map->height,
+		            ff->back->cost, ff->back->dir, ff->queue);
+
+		SDL_LockMutex(ff->lock);
+		ff->ready = 1;
+		SDL_CondSignal(ff->done);
+	}
+	SDL_UnlockMutex(ff->lock);
+	return 0;
+}
+
+/* hand the worker a new pass, if it is free to take one,
+   along with the map's walls as they stand now */
+static void
+s_request(struct flowfield *ff)
+{
+	SDL_LockMutex(ff->lock);
+	if (!ff->busy) {
+		memcpy(ff->solid, ff->map->solid, s_words(ff->map) * sizeof(uint32_t));
+		ff->want  = ff->goal;
+		ff->busy  = 1;
+		ff->ready = 0;
+		ff->stale = 0;
+		SDL_CondSignal(ff->wake);
+	}
+	SDL_UnlockMutex(ff->lock);
+}
+
+struct flowfield *
+flow_new(struct map *map, int x, int y)
+{
+	struct flowfield *ff;
+	int i, n;
+
+	assert(map != NULL);
+
+	n  = map->width * map->height;
+	ff = tallocate(MEM_NAV, 1, sizeof(struct flowfield));
+	ff->map = map;
+	ff->watch = map_watch(map);
+	for (i = 0; i < 2; i++) {
+		ff->buf[i].cost = tallocate(MEM_NAV, n, sizeof(unsigned short));
+		ff->buf[i].dir  = tallocate(MEM_NAV, n, sizeof(unsigned char));
+	}
+	ff->queue = tallocate(MEM_NAV, n, sizeof(int));
+	ff->solid = tallocate(MEM_NAV, s_words(map), sizeof(uint32_t));
+	ff->front = &ff->buf[0];
+	ff->back  = &ff->buf[1];
+
+	/* the first pass is done up front, on the caller */
+	ff->goal.x = x;
+	ff->goal.y = y;
+	ff->front->goal = ff->goal;
+	s_integrate(map, map->solid, ff->goal, 0, 0, map->width, map->height,
+	            ff->front->cost, ff->front->dir, ff->queue);
+	s_patch(ff);
+
+	ff->lock = SDL_CreateMutex();
+	ff->wake = SDL_CreateCond();
+	ff->done = SDL_CreateCond();
+	ff->worker = SDL_CreateThread(s_worker, "flowfield", ff);
+	if (!ff->lock || !ff->wake || !ff->done || !ff->worker) {
+		fprintf(stderr, "failed to start flow field worker: %s\n", SDL_GetError());
+		exit(EXIT_INIT_FAILED);
+	}
+	return ff;
+}
+
+void
+flow_free(struct flowfield *ff)
+{
+	int i;
+
+	if (!ff) return;
+
+	SDL_LockMutex(ff->lock);
+	ff->quit = 1;
+	SDL_CondSignal(ff->wake);
+	SDL_UnlockMutex(ff->lock);
+	SDL_WaitThread(ff->worker, NULL);
+	SDL_DestroyCond(ff->wake);
+	SDL_DestroyCond(ff->done);
+	SDL_DestroyMutex(ff->lock);
+
+	map_unwatch(ff->map, ff->watch);
+	for (i = 0; i < 2; i++) {
+		release(ff->buf[i].cost);
+		release(ff->buf[i].dir);
+	}
+	release(ff->queue);
+	release(ff->solid);
+	release(ff);
+}
+
+void
+flow_goal(struct flowfield *ff, int x, int y)
+{
+	if (x == ff->goal.x && y == ff->goal.y)
+		return;
+
+	ff->goal.x = x;
+	ff->goal.y = y;
+	s_patch(ff);
+
+	if (abs(x - ff->front->goal.x) > FLOW_SLACK
+	 || abs(y - ff->front->goal.y) > FLOW_SLACK)
+		ff->stale = 1;
+}
+
+void
+flow_invalidate(struct flowfield *ff, int x, int y)
+{
+	ff->stale = 1;
+	if (abs(x - ff->goal.x) <= FLOW_PATCH && abs(y - ff->goal.y) <= FLOW_PATCH)
+		s_patch(ff);
+}
+
+void
+flow_update(struct flowfield *ff)
+{
+	const struct mapchange *c;
+	struct field *t;
+	int i, n, near;
+
+	/* any wall that comes or goes needs a full pass, but
+	   the patch only needs redoing once, however many of
+	   them landed inside it. */
+	n = map_changes(ff->map, ff->watch, &c);
+	for (near = i = 0; i < n; i++) {
+		if (!c[i].solid) continue;
+		ff->stale = 1;
+		if (abs(c[i].x - ff->goal.x) <= FLOW_PATCH && abs(c[i].y - ff->goal.y) <= FLOW_PATCH)
+			near = 1;
+	}
+	if (near) s_patch(ff);
+
+	SDL_LockMutex(ff->lock);
+	if (ff->busy && ff->ready) {
+		t = ff->front;
+		ff->front = ff->back;
+		ff->back  = t;
+		ff->busy  = ff->ready = 0;
+	}
+	SDL_UnlockMutex(ff->lock);
+
+	if (ff->stale)
+		s_request(ff);
+}
+
+void
+flow_wait(struct flowfield *ff)
+{
+	int busy;
+
+	for (;;) {
+		flow_update(ff);
+		SDL_LockMutex(ff->lock);
+		while (ff->busy && !ff->ready)
+			SDL_CondWait(ff->done, ff->lock);
+		busy = ff->busy;
+		SDL_UnlockMutex(ff->lock);
+		if (!busy && !ff->stale) break;
+	}
+}
+
+int
+flow_sample(struct flowfield *ff, int x, int y, struct coords *step)
+{
+	int px, py, d;
+
+	step->x = step->y = 0;
+	if (x < 0 || x >= ff->map->width || y < 0 || y >= ff->map->height)
+		return 0;
+
+	px = x - ff->patch.at.x;
+	py = y - ff->patch.at.y;
+	if (px >= 0 && px < ff->patch.w && py >= 0 && py < ff->patch.h
+	 && ff->patch.cost[px * ff->patch.h + py] != FLOW_FAR) {
+		d = ff->patch.dir[px * ff->patch.h + py];
+	} else {
+		d = ff->front->dir[s_index(ff, x, y)];
+	}
+
+	if (d == FLOW_NONE) return 0;
+	step->x = DX[d];
+	step->y = DY[d];
+	return 1;
+}
@@ -0,0 +1,194 @@
+#include "prisma.h"
+
+/* field of view, by recursive shadowcasting (Bergström).
+
+   each of the eight octants around the viewer is scanned row
+   by row, outward; an opaque cell splits the visible wedge
+   and recursion carries on with the part beyond it.  only the
+   (2r+1)^2 square around the viewer is ever touched, so the
+   cost doesn't grow with the map.
+
+   light[] holds this frame's light level for visible cells;
+   seen[] remembers every cell that has ever been lit, so the
+   renderer can dim explored-but-not-visible areas instead of
+   blacking them out. */
+
+#define FOV_REMEMBERED  40  /* light level of seen, but not visible, cells */
+#define FOV_AMBIENT     72  /* light level at the edge of the radius */
+
+struct fov {
+	struct map *map;
+	int watch;   /* our cursor into the map's journal */
+	int radius;
+
+	unsigned char *light;
+	unsigned char *seen;
+
+	struct coords viewer;
+	int x0, y0, x1, y1;  /* bounds of the last lit region */
+	int dirty;
+};
+
+/* octant transforms: (col,row) -> (dx,dy) */
+static const int OCTANT[8][4] = {
+	{ 1,  0,  0,  1 }, { 0,  1,  1,  0 }, { 0, -1,  1,  0 }, {-1,  0,  0,  1 },
+	{-1,  0,  0, -1 }, { 0, -1, -1,  0 }, { 0,  1, -1,  0 }, { 1,  0,  0, -1 },
+};
+
+#define s_index(f,x,y) ((f)->map->height * (x) + (y))
+
+static inline int
+s_opaque(struct fov *f, int x, int y)
+{
+	return x < 0 || x >= f->map->width
+	    || y < 0 || y >= f->map->height
+	    || mapat(f->map, 0, x, y) & TILE_SOLID;
+}
+
+static inline void
+s_lit(struct fov *f, int x, int y, int d2)
+{
+	int r2, l;
+
+	if (x < 0 || x >= f->map->width || y < 0 || y >= f->map->height)
+		return;
+
+	r2 = f->radius * f->radius;
+	l  = FOV_AMBIENT + (255 - FOV_AMBIENT) * (r2 - d2) / r2;
+	f->light[s_index(f, x, y)] = l;
+	f->seen[s_index(f, x, y)]  = 1;
+}
+
+static void
+s_cast(struct fov *f, int row, double start, double end, const int *m)
+{
+	int dx, dy, x, y, blocked, r2, d2;
+	double l, r, next;
+
+	if (start < end) return;
+
+	r2 = f->radius * f->radius;
+	next = start;
+	for (; row <= f->radius; row++) {
+		blocked = 0;
+		for (dx = -row, dy = -row; dx <= 0; dx++) {
+			l = (dx - 0.5) / (dy + 0.5);
+			r = (dx + 0.5) / (dy - 0.5);
+			if (start < r) continue;
+			if (end > l)   break;
+
+			x = f->viewer.x + dx * m[0] + dy * m[1];
+			y = f->viewer.y + dx * m[2] + dy * m[3];
+			d2 = dx * dx + dy * dy;
+			if (d2 <= r2)
+				s_lit(f, x, y, d2);
+
+			if (blocked) {
+				if (s_opaque(f, x, y)) {
+					next = r;
+					continue;
+				}
+				blocked = 0;
+				start = next;
+			} else if (s_opaque(f, x, y) && row < f->radius) {
+				blocked = 1;
+				s_cast(f, row + 1, start, l, m);
+				next = r;
+			}
+		}
+		if (blocked) break;
+	}
+}
+
+struct fov *
+fov_new(struct map *map, int radius)
+{
+	struct fov *f;
+
+	assert(map != NULL);
+	assert(radius > 0);
+
+	f = tallocate(MEM_RENDER, 1, sizeof(struct fov));
+	f->map    = map;
+	f->watch  = map_watch(map);
+	f->radius = radius;
+	f->light  = tallocate(MEM_RENDER, map->width * map->height, sizeof(unsigned char));
+	f->seen   = tallocate(MEM_RENDER, map->width * map->height, sizeof(unsigned char));
+	f->viewer.x = f->viewer.y = -1;
+	f->dirty  = 1;
+	return f;
+}
+
+void
+fov_free(struct fov *f)
+{
+	if (!f) return;
+	map_unwatch(f->map, f->watch);
+	release(f->light);
+	release(f->seen);
+	release(f);
+}
+
+void
+fov_invalidate(struct fov *f, int x, int y)
+{
+	if (abs(x - f->viewer.x) <= f->radius && abs(y - f->viewer.y) <= f->radius)
+		f->dirty = 1;
+}
+
+/* skip the journal, unread, without looking; the next
+   fov_update() starts afresh */
+void
+fov_forget(struct fov *f)
+{
+	const struct mapchange *c;
+
+	map_changes(f->map, f->watch, &c);
+	f->dirty = 1;
+}
+
+void
+fov_update(struct fov *f, int x, int y)
+{
+	const struct mapchange *c;
+	int i, n, cx, cy;
+
+	/* only walls block sight; see s_opaque() */
+	n = map_changes(f->map, f->watch, &c);
+	for (i = 0; i < n; i++)
+		if (c[i].layer == MAP_FLOOR && (c[i].was ^ c[i].now) & TILE_SOLID)
+			fov_invalidate(f, c[i].x, c[i].y);
+
+	if (!f->dirty && x == f->viewer.x && y == f->viewer.y)
+		return;
+
+	/* darken what we lit last time; only that square */
+	for (cx = f->x0; cx < f->x1; cx++)
+		for (cy = f->y0; cy < f->y1; cy++)
+			f->light[s_index(f, cx, cy)] = 0;
+
+	f->viewer.x = x;
+	f->viewer.y = y;
+	f->x0 = bounded(0, x - f->radius, f->map->width);
+	f->y0 = bounded(0, y - f->radius, f->map->height);
+	f->x1 = bounded(0, x + f->radius + 1, f->map->width);
+	f->y1 = bounded(0, y + f->radius + 1, f->map->height);
+	f->dirty = 0;
+
+	s_lit(f, x, y, 0);
+	for (i = 0; i < 8; i++)
+		s_cast(f, 1, 1.0, 0.0, OCTANT[i]);
+}
+
+int
+fov_light(struct fov *f, int x, int y)
+{
+	int i;
+
+	if (x < 0 || x >= f->map->width || y < 0 || y >= f->map->height)
+		return 0;
+
+	i = s_index(f, x, y);
+	return f->light[i] ? f->light[i]
+	     : f->seen[i]  ? FOV_REMEMBERED : 0;
+}
@@ -0,0 +1,81 @@
+#include "prisma.h"
+
+/* a fuzzing harness for the map parser.
+
+   each input is a map key (.mf), a NUL, and then its grid;
+   with no NUL, it's all key, and the grid is empty.  the key
+   goes to the parser as it came, unterminated, the way an
+   mmap()ed file would, so a read past its end is caught.
+
+   under libFuzzer (clang):
+
+       make fuzz-map CC=clang
+       ./fuzz-map -close_fd_mask=2 CORPUS/
+
+   or, with FUZZ_REPLAY, each file named on the command line
+   is run once, to replay a crash, or check over a corpus,
+   with gcc's sanitizers (name every file in CORPUS/, for all of it):
+
+       make fuzz-map FUZZ="-fsanitize=address,undefined -DFUZZ_REPLAY"
+       ./fuzz-map CORPUS/base crash-...
+
+   any map makes a seed, joined to its key:
+
+       (cat maps/base.mf; printf '\0'; cat maps/base) > CORPUS/base
+
+   and prisma-mapgen will make bigger ones. */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const uint8_t *nul;
+	struct map *map;
+	char *grid;
+	size_t n;
+
+	nul = memchr(data, '\0', size);
+	n   = nul ? (size_t)(nul - data) : size;
+
+	grid = tallocate(MEM_PARSER, size - n + 1, 1);
+	if (nul)
+		memcpy(grid, nul + 1, size - n - 1);
+
+	map = map_parse((const char *)data, n, grid, "fuzz.mf");
+	map_free(map);
+	release(grid);
+	return 0;
+}
+
+#ifdef FUZZ_REPLAY
+int main(int argc, char **argv)
+{
+	uint8_t *data;
+	size_t n, cap;
+	FILE *f;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		f = fopen(argv[i], "rb");
+		if (!f) {
+			fprintf(stderr, "failed to open %s: %s (error %d)\n",
+				argv[i], strerror(errno), errno);
+			return 1;
+		}
+		n = 0;
+		cap = 4096;
+		data = allocate(cap, 1);
+		while ((n += fread(data + n, 1, cap - n, f)) == cap)
+			data = reallocate(MEM_MISC, data, cap *= 2, 1);
+		fclose(f);
+
+		/* exactly n bytes, so that overruns show */
+		data = reallocate(MEM_MISC, data, n ? n : 1, 1);
+		LLVMFuzzerTestOneInput(data, n);
+		release(data);
+	}
+	fprintf(stderr, "fuzz-map: %d input%s, all parsed or refused\n", argc - 1, argc == 2 ? "" : "s");
+	return 0;
+}
+#endif
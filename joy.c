@@ -1,81 +1,271 @@
 #include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <math.h>
+#include <limits.h>
 
-#define MAX_JOYSTICKS 8
+/* how long to block waiting for the next event, in
+   milliseconds; bounds how late a SIGTERM is noticed. */
+#define WAIT_TIMEOUT 250
 
-int done = 0;
+/* default interval between summary reports, in seconds */
+#define SUMMARY_INTERVAL 5
+
+/* histogram buckets are powers of two: bucket 0 counts
+   samples under 1 unit, bucket i counts [2^(i-1), 2^i). */
+#define BUCKETS 24
+
+struct histogram {
+	unsigned long n;
+	unsigned long bucket[BUCKETS];
+	double mean, m2;  /* running mean / variance (Welford) */
+	double max;
+};
+
+struct device {
+	SDL_Joystick  *joy;
+	SDL_JoystickID id;
+	char name[64];
+	char guid[33];
+
+	Uint64 last;        /* perf counter of the previous event */
+	unsigned long events;
+	unsigned long since;  /* events since the last summary */
+
+	struct histogram gaps;  /* inter-event interval, in usec */
+	struct histogram lag;   /* queue latency, in msec */
+};
+
+static volatile sig_atomic_t done = 0;
+static int verbose = 0;
+
+static struct device *devs = NULL;
+static int ndevs = 0, capdevs = 0;
 
 static void sigterm(int sig) {
 	done = 1;
 }
 
-int main(int argc, char **argv)
+static void
+hist_add(struct histogram *h, double v)
+{
+	int b;
+	double d;
+
+	for (b = 0; b < BUCKETS - 1 && v >= (double)(1ul << b); b++)
+		;
+	h->bucket[b]++;
+	h->n++;
+
+	d = v - h->mean;
+	h->mean += d / h->n;
+	h->m2   += d * (v - h->mean);
+	if (v > h->max) h->max = v;
+}
+
+/* upper bound of the bucket holding the p-th percentile
+   (0 meaning "less than one unit") */
+static double
+hist_pct(struct histogram *h, double p)
+{
+	unsigned long want, seen;
+	int b;
+
+	if (!h->n) return 0;
+	want = (unsigned long)ceil(h->n * p);
+	for (seen = 0, b = 0; b < BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want) break;
+	}
+	return b == 0 ? 0 : (double)(1ul << b);
+}
+
+static double
+hist_stddev(struct histogram *h)
+{
+	return h->n > 1 ? sqrt(h->m2 / (h->n - 1)) : 0;
+}
+
+static struct device *
+device(SDL_JoystickID id)
+{
+	int i;
+	for (i = 0; i < ndevs; i++)
+		if (devs[i].id == id) return &devs[i];
+	return NULL;
+}
+
+static void
+attach(int index)
 {
-	int n, i;
 	SDL_Joystick *joy;
-	SDL_Joystick *all[MAX_JOYSTICKS];
+	struct device *d;
+
+	joy = SDL_JoystickOpen(index);
+	if (!joy) {
+		fprintf(stderr, "failed to open controller %d: %s\n", index, SDL_GetError());
+		return;
+	}
+	if (device(SDL_JoystickInstanceID(joy))) {
+		SDL_JoystickClose(joy); /* already tracked; drop the extra ref */
+		return;
+	}
+
+	if (ndevs == capdevs) {
+		capdevs = capdevs ? capdevs * 2 : 4;
+		devs = realloc(devs, capdevs * sizeof(struct device));
+		if (!devs) {
+			fprintf(stderr, "failed to allocate memory for %d controllers\n", capdevs);
+			exit(1);
+		}
+	}
+
+	d = &devs[ndevs++];
+	memset(d, 0, sizeof(*d));
+	d->joy = joy;
+	d->id  = SDL_JoystickInstanceID(joy);
+	snprintf(d->name, sizeof(d->name), "%s", SDL_JoystickName(joy) ? SDL_JoystickName(joy) : "(unnamed)");
+	SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(joy), d->guid, sizeof(d->guid));
+
+	fprintf(stderr, "controller[%d] attached: %s (%s)\n", d->id, d->name, d->guid);
+}
+
+static void
+report(struct device *d, double elapsed)
+{
+	fprintf(stderr, "controller[%d] %-24.24s %8lu ev %7.1f ev/s"
+	                " | gap p50 %6.0fus p99 %7.0fus max %7.0fus jitter %6.0fus"
+	                " | lag p50 %3.0fms p99 %3.0fms max %3.0fms\n",
+		d->id, d->name, d->events, elapsed > 0 ? d->since / elapsed : 0,
+		hist_pct(&d->gaps, 0.50), hist_pct(&d->gaps, 0.99), d->gaps.max, hist_stddev(&d->gaps),
+		hist_pct(&d->lag, 0.50),  hist_pct(&d->lag, 0.99),  d->lag.max);
+	d->since = 0;
+}
+
+/* elapsed is the time since the last summary, in seconds,
+   over which d->since was counted */
+static void
+detach(SDL_JoystickID id, double elapsed)
+{
+	struct device *d;
+
+	d = device(id);
+	if (!d) return;
+
+	fprintf(stderr, "controller[%d] disconnected\n", id);
+	report(d, elapsed);
+	SDL_JoystickClose(d->joy);
+
+	*d = devs[--ndevs];
+}
+
+static void
+sample(SDL_JoystickID id, Uint32 stamp)
+{
+	struct device *d;
+	Uint64 now;
+	Uint32 ticks;
+
+	d = device(id);
+	if (!d) return;
+
+	now   = SDL_GetPerformanceCounter();
+	ticks = SDL_GetTicks();
+
+	if (d->events)
+		hist_add(&d->gaps, (now - d->last) * 1e6 / SDL_GetPerformanceFrequency());
+	hist_add(&d->lag, ticks >= stamp ? ticks - stamp : 0);
+
+	d->last = now;
+	d->events++;
+	d->since++;
+}
+
+int main(int argc, char **argv)
+{
 	SDL_Event e;
-	char guid[256];
-
-	SDL_Init(SDL_INIT_JOYSTICK);
-
-	n = SDL_NumJoysticks();
-	printf("%d joysticks found\n", n);
-	for (i = 0; i < n; i++) {
-		joy = SDL_JoystickOpen(i);
-		fprintf(stderr, "[%d] %s\n", i, SDL_JoystickName(joy));
-		SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(joy), guid, 256);
-		fprintf(stderr, "[%d] %s (%s)\n", e.jdevice.which, SDL_JoystickName(joy), guid);
-		if (SDL_JoystickGetAttached(joy)) {
-			SDL_JoystickClose(joy);
+	Uint32 interval, next, last, now;
+	int i, secs;
+
+	secs = SUMMARY_INTERVAL;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			verbose = 1;
+		} else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			secs = atoi(argv[++i]);
+			if (secs < 1 || secs > INT_MAX / 1000) {
+				fprintf(stderr, "%s: -i needs a whole number of seconds, at least 1\n", argv[0]);
+				fprintf(stderr, "USAGE: %s [-v] [-i SECONDS]\n", argv[0]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "USAGE: %s [-v] [-i SECONDS]\n", argv[0]);
+			return 1;
 		}
 	}
+	interval = secs * 1000;
+
+	if (SDL_Init(SDL_INIT_JOYSTICK) != 0) {
+		fprintf(stderr, "sdl_init() failed: %s\n", SDL_GetError());
+		return 1;
+	}
+	fprintf(stderr, "%d joysticks found\n", SDL_NumJoysticks());
 
 	signal(SIGTERM, sigterm);
 	signal(SIGINT,  sigterm);
 
-	if (n > MAX_JOYSTICKS) {
-		fprintf(stderr, "WARNING: found %d joysticks;\n"
-		                "only considering the first %d...\n",
-		                n, MAX_JOYSTICKS);
-		n = MAX_JOYSTICKS;
-	}
-	while (n--) {
-		all[n] = SDL_JoystickOpen(n);
-	}
+	/* already-connected controllers show up as
+	   SDL_JOYDEVICEADDED events, just like hotplugs. */
+	last = SDL_GetTicks();
+	next = last + interval;
 	while (!done) {
-		while (SDL_PollEvent(&e)) {
+		if (SDL_WaitEventTimeout(&e, WAIT_TIMEOUT)) {
 			switch (e.type) {
+			case SDL_QUIT:
+				done = 1;
+				break;
 			case SDL_JOYDEVICEADDED:
-				fprintf(stderr, "NEW CONTROLLER FOUND!\n");
-				if (e.jdevice.which > MAX_JOYSTICKS) {
-					fprintf(stderr, "index %d out of range (> %d); IGNORING\n",
-					                e.jdevice.which, MAX_JOYSTICKS);
-				} else {
-					joy = SDL_JoystickOpen(e.jdevice.which);
-					SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(joy), guid, 256);
-					fprintf(stderr, "[%d] %s (%s)\n", e.jdevice.which, SDL_JoystickName(joy), guid);
-					all[e.jdevice.which] = joy;
-				}
+				attach(e.jdevice.which);
 				break;
 			case SDL_JOYDEVICEREMOVED:
-				fprintf(stderr, "controller[%d] disconnected\n", e.jdevice.which);
-				SDL_JoystickClose(all[e.jdevice.which]);
-			case SDL_JOYBUTTONDOWN:
-				fprintf(stderr, "button[%d] pressed %d\n", e.jbutton.button, e.jbutton.state);
+				detach(e.jdevice.which, (SDL_GetTicks() - last) / 1000.0);
 				break;
+			case SDL_JOYBUTTONDOWN:
 			case SDL_JOYBUTTONUP:
-				fprintf(stderr, "button[%d] released %d\n", e.jbutton.button, e.jbutton.state);
+				sample(e.jbutton.which, e.common.timestamp);
+				if (verbose)
+					fprintf(stderr, "controller[%d] button[%d] %s\n", e.jbutton.which, e.jbutton.button,
+					                e.type == SDL_JOYBUTTONDOWN ? "pressed" : "released");
 				break;
 			case SDL_JOYHATMOTION:
-				fprintf(stderr, "hat[%d] %d\n", e.jhat.hat, e.jhat.value);
+				sample(e.jhat.which, e.common.timestamp);
+				if (verbose)
+					fprintf(stderr, "controller[%d] hat[%d] %d\n", e.jhat.which, e.jhat.hat, e.jhat.value);
 				break;
 			case SDL_JOYAXISMOTION:
-				fprintf(stderr, "axis[%d] %d\n", e.jaxis.axis, e.jaxis.value);
+				sample(e.jaxis.which, e.common.timestamp);
+				if (verbose)
+					fprintf(stderr, "controller[%d] axis[%d] %d\n", e.jaxis.which, e.jaxis.axis, e.jaxis.value);
 				break;
 			}
 		}
+
+		now = SDL_GetTicks();
+		if (now >= next) {
+			for (i = 0; i < ndevs; i++)
+				report(&devs[i], (now - last) / 1000.0);
+			last = now;
+			next = now + interval;
+		}
 	}
+
 	fprintf(stderr, "\rterminating...\n");
+	now = SDL_GetTicks();
+	while (ndevs > 0)
+		detach(devs[0].id, (now - last) / 1000.0);
+	free(devs);
+	SDL_Quit();
 	return 0;
 }
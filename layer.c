@@ -0,0 +1,255 @@
+#include "prisma.h"
+
+/* sparse cell layers.
+
+   most of a map's non-floor cells are empty, so rather than
+   a dense width x height grid, a layer keeps a hash of the
+   16x16 chunks that actually hold something.  each chunk is a
+   short list of (cell, value) pairs, sorted by cell, so a
+   rectangle is visited chunk by chunk, in order, without
+   probing the empty cells in between.
+
+   a bitmap with one bit per chunk answers "is there anything
+   here at all?" without touching the hash, which is the
+   common case for map_solid() in the middle of a search;
+   a second, per-chunk bitmap saves searching the list for
+   cells that are empty but have neighbours. */
+
+#define LAYER_SHIFT  4
+#define LAYER_CHUNK  (1 << LAYER_SHIFT)
+#define LAYER_MASK   (LAYER_CHUNK - 1)
+#define LAYER_EMPTY  -1
+
+struct item {
+	unsigned char cell;  /* column-major offset within the chunk */
+	int           value;
+};
+
+struct chunk {
+	int key;             /* cy * cw + cx, or LAYER_EMPTY */
+	int n, cap;
+	struct item *items;
+	uint32_t mask[LAYER_CHUNK * LAYER_CHUNK / 32];  /* cells in items[] */
+};
+
+struct layer {
+	int cw, ch;          /* size, in chunks */
+	int count;           /* non-empty cells */
+
+	int           cap;   /* hash slots; a power of two */
+	int           used;
+	struct chunk *slots;
+
+	unsigned char *occupied;  /* one bit per chunk */
+};
+
+/* fibonacci hashing; the top bits are the well-mixed ones */
+static inline unsigned
+s_hash(int key, int cap)
+{
+	return (unsigned)(((uint32_t)key * 2654435761u) >> 16) & (cap - 1);
+}
+
+static struct chunk *
+s_find(struct layer *l, int key)
+{
+	unsigned i;
+
+	for (i = s_hash(key, l->cap); l->slots[i].key != LAYER_EMPTY; i = (i + 1) & (l->cap - 1))
+		if (l->slots[i].key == key)
+			return &l->slots[i];
+	return NULL;
+}
+
+static void
+s_grow(struct layer *l)
+{
+	struct chunk *old;
+	unsigned i, j;
+	int cap;
+
+	old = l->slots;
+	cap = l->cap;
+
+	l->cap   = cap ? cap * 2 : 16;
+	l->slots = tallocate(MEM_MAP, l->cap, sizeof(struct chunk));
+	for (i = 0; i < (unsigned)l->cap; i++)
+		l->slots[i].key = LAYER_EMPTY;
+
+	for (i = 0; i < (unsigned)cap; i++) {
+		if (old[i].key == LAYER_EMPTY) continue;
+		for (j = s_hash(old[i].key, l->cap); l->slots[j].key != LAYER_EMPTY; j = (j + 1) & (l->cap - 1))
+			;
+		l->slots[j] = old[i];
+	}
+	release(old);
+}
+
+static struct chunk *
+s_claim(struct layer *l, int key)
+{
+	struct chunk *c;
+	unsigned i;
+
+	if ((c = s_find(l, key)) != NULL)
+		return c;
+
+	if ((l->used + 1) * 2 > l->cap)
+		s_grow(l);
+
+	for (i = s_hash(key, l->cap); l->slots[i].key != LAYER_EMPTY; i = (i + 1) & (l->cap - 1))
+		;
+	l->used++;
+	l->slots[i].key = key;
+	return &l->slots[i];
+}
+
+/* position of cell in c's items, or where it would go */
+static int
+s_search(struct chunk *c, int cell)
+{
+	int lo, hi, mid;
+
+	for (lo = 0, hi = c->n; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (c->items[mid].cell < cell) lo = mid + 1;
+		else                           hi = mid;
+	}
+	return lo;
+}
+
+static void
+s_layer_free(void *p)
+{
+	struct layer *l = p;
+	int i;
+
+	for (i = 0; i < l->cap; i++)
+		release(l->slots[i].items);
+	release(l->slots);
+	release(l->occupied);
+}
+
+struct layer *
+layer_new(struct arena *arena, int width, int height)
+{
+	struct layer *l;
+
+	l = arena_alloc(arena, 1, sizeof(struct layer));
+	l->cw = (width  + LAYER_MASK) >> LAYER_SHIFT;
+	l->ch = (height + LAYER_MASK) >> LAYER_SHIFT;
+	l->occupied = tallocate(MEM_MAP, (l->cw * l->ch + 7) / 8, 1);
+	s_grow(l);
+	arena_defer(arena, s_layer_free, l);
+	return l;
+}
+
+int
+layer_get(struct layer *l, int x, int y)
+{
+	struct chunk *c;
+	int key, cell, i;
+
+	key = (y >> LAYER_SHIFT) * l->cw + (x >> LAYER_SHIFT);
+	if (!(l->occupied[key / 8] & (1 << (key % 8))))
+		return 0;
+
+	c = s_find(l, key);
+	if (!c) return 0;
+
+	cell = (x & LAYER_MASK) * LAYER_CHUNK + (y & LAYER_MASK);
+	if (!(c->mask[cell / 32] & (1u << (cell % 32))))
+		return 0;
+
+	i = s_search(c, cell);
+	return i < c->n && c->items[i].cell == cell ? c->items[i].value : 0;
+}
+
+void
+layer_set(struct layer *l, int x, int y, int v)
+{
+	struct chunk *c;
+	int key, cell, i;
+
+	key  = (y >> LAYER_SHIFT) * l->cw + (x >> LAYER_SHIFT);
+	cell = (x & LAYER_MASK) * LAYER_CHUNK + (y & LAYER_MASK);
+
+	if (!v) {
+		c = s_find(l, key);
+		if (!c) return;
+		i = s_search(c, cell);
+		if (i == c->n || c->items[i].cell != cell) return;
+
+		memmove(&c->items[i], &c->items[i+1], (c->n - i - 1) * sizeof(struct item));
+		c->n--;
+		c->mask[cell / 32] &= ~(1u << (cell % 32));
+		l->count--;
+		/* the chunk keeps its slot (and its items buffer),
+		   since whatever left is likely to come back. */
+		if (c->n == 0)
+			l->occupied[key / 8] &= ~(1 << (key % 8));
+		return;
+	}
+
+	c = s_claim(l, key);
+	i = s_search(c, cell);
+	if (i < c->n && c->items[i].cell == cell) {
+		c->items[i].value = v;
+		return;
+	}
+
+	if (c->n == c->cap) {
+		c->cap   = c->cap ? c->cap * 2 : 4;
+		c->items = reallocate(MEM_MAP, c->items, c->cap, sizeof(struct item));
+	}
+	memmove(&c->items[i+1], &c->items[i], (c->n - i) * sizeof(struct item));
+	c->items[i].cell  = cell;
+	c->items[i].value = v;
+	c->n++;
+	c->mask[cell / 32] |= 1u << (cell % 32);
+	l->count++;
+	l->occupied[key / 8] |= 1 << (key % 8);
+}
+
+int
+layer_count(struct layer *l)
+{
+	return l->count;
+}
+
+/* layer_scan() visits cells in increasing order of this key:
+   chunk by chunk, column-major, then column-major within each */
+unsigned
+layer_order(struct layer *l, int x, int y)
+{
+	return (unsigned)((x >> LAYER_SHIFT) * l->ch + (y >> LAYER_SHIFT)) << (2 * LAYER_SHIFT)
+	     | (x & LAYER_MASK) << LAYER_SHIFT
+	     | (y & LAYER_MASK);
+}
+
+void
+layer_scan(struct layer *l, int x0, int y0, int x1, int y1,
+           void (*fn)(int x, int y, int v, void *data), void *data)
+{
+	struct chunk *c;
+	int cx, cy, key, i, x, y;
+
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	for (cx = x0 >> LAYER_SHIFT; cx < l->cw && cx << LAYER_SHIFT < x1; cx++) {
+		for (cy = y0 >> LAYER_SHIFT; cy < l->ch && cy << LAYER_SHIFT < y1; cy++) {
+			key = cy * l->cw + cx;
+			if (!(l->occupied[key / 8] & (1 << (key % 8))))
+				continue;
+			if (!(c = s_find(l, key)))
+				continue;
+
+			for (i = 0; i < c->n; i++) {
+				x = (cx << LAYER_SHIFT) + c->items[i].cell / LAYER_CHUNK;
+				y = (cy << LAYER_SHIFT) + c->items[i].cell % LAYER_CHUNK;
+				if (x >= x0 && x < x1 && y >= y0 && y < y1)
+					fn(x, y, c->items[i].value, data);
+			}
+		}
+	}
+}
@@ -19,12 +19,20 @@
 #define T_KW_PLACE   8
 #define T_KW_FROM    9
 #define T_KW_ENTRY  10
+#define T_KW_ANIM   11
+#define T_KW_NPC    12
 #define T_STRING   128
 #define T_NUMBER   129
 #define T_SYMBOL   130
 #define T_ERROR    131
 
 #define T_ERROR_UNTERMINATED_STRING 1
+#define T_ERROR_NUMBER_TOO_BIG      2
+#define T_ERROR_STRAY_CHARACTER     3
+
+#define MAX_TILE_INDEX 254   /* so that (1 + index) << 24 fits a cell */
+
+#define MAP_SCRIPTS 32
 
 struct mapobj {
 	char symbol;
@@ -43,12 +51,26 @@ struct mapkey {
 	char  void_tile;
 	int   tiles[256];
 
-	int next_object;
-	struct mapobj objects[256];
+	int next_object, capobjects;
+	struct mapobj *objects;
+
+	int nanims;
+	struct anim anims[MAP_ANIMS];
+
+	int nnpcs, capnpcs;
+	struct npcdef *npcs;
+
+	/* npcs running the same script share one compiled copy */
+	int nscripts;
+	struct {
+		const char     *source;
+		struct program *program;
+	} scripts[MAP_SCRIPTS];
 };
 
 struct parser {
-	int     fd;
+	struct arena *arena;
+
 	size_t  len;
 
 	const char *file;
@@ -57,7 +79,9 @@ struct parser {
 
 	size_t  there;
 	size_t  here;
-	char   *source;
+	const char *source;
+
+	int     pushed;  /* a token read one too far, or T_EOF */
 
 	union {
 		char *string;
@@ -67,8 +91,8 @@ struct parser {
 	} data;
 };
 
-static struct map *    s_parse_map(const char *, struct mapkey *);
-static struct mapkey * s_parse_mapkey(const char *);
+static struct map *    s_parse_map(struct arena *, const char *, const char *, struct mapkey *);
+static struct mapkey * s_parse_mapkey(struct arena *, const char *, const char *, size_t);
 static int             s_lexer(struct parser *);
 
 static char * s_readmap(const char *path);
@@ -108,10 +132,10 @@ s_readmap(const char *path)
 		exit(EXIT_ENV_FAILURE);
 	}
 
-	raw = allocate(size + 1, sizeof(char));
+	raw = tallocate(MEM_PARSER, size + 1, sizeof(char));
 	n = 0;
 	for (;;) {
-		nread = read(fd, raw + n, READ_BLOCK_SIZE > size ? size : READ_BLOCK_SIZE);
+		nread = read(fd, raw + n, READ_BLOCK_SIZE > size - n ? size - n : READ_BLOCK_SIZE);
 		if (nread == 0) break;
 		if (nread < 0) {
 			fprintf(stderr, "failed to read map from %s: %s (error %d)\n",
@@ -119,7 +143,7 @@ s_readmap(const char *path)
 			exit(EXIT_ENV_FAILURE);
 		}
 		n += nread;
-		if (n == size) break;
+		if (n == (size_t)size) break;
 	}
 
 	close(fd);
@@ -149,35 +173,231 @@ s_mapsize(const char *raw, int *w, int *h)
 	}
 }
 
+static void
+s_free_journal(void *map)
+{
+	release(((struct map *)map)->journal.changes);
+}
+
+static struct map *
+s_map(struct arena *arena, int width, int height)
+{
+	struct map *map;
+
+	map = arena_alloc(arena, 1, sizeof(struct map));
+	map->arena  = arena;
+	map->width  = width;
+	map->height = height;
+	map->cells[0] = arena_alloc(arena, width * height, sizeof(int));
+	map->objects  = layer_new(arena, width, height);
+	map->solid    = arena_alloc(arena, (width * height + 31) / 32, sizeof(uint32_t));
+	arena_defer(arena, s_free_journal, map);
+	return map;
+}
+
+struct map *
+map_new(int width, int height)
+{
+	return s_map(arena_new(MEM_MAP), width, height);
+}
+
+static void
+s_clone_object(int x, int y, int v, void *map)
+{
+	layer_set(((struct map *)map)->objects, x, y, v);
+}
+
+/* a copy of map, for another thread to keep up to date: the
+   same cells, objects and animation frames, with a journal
+   and timers of its own.  the tileset and the npcs' compiled
+   scripts are shared. */
+struct map *
+map_clone(struct map *src)
+{
+	struct map *map;
+	int i;
+
+	map = map_new(src->width, src->height);
+	memcpy(map->cells[0], src->cells[0], src->width * src->height * sizeof(int));
+	memcpy(map->solid, src->solid, (src->width * src->height + 31) / 32 * sizeof(uint32_t));
+	layer_scan(src->objects, 0, 0, src->width, src->height, s_clone_object, map);
+
+	map->nanims = src->nanims;
+	map->anims  = arena_alloc(map->arena, src->nanims, sizeof(struct anim));
+	memcpy(map->anims, src->anims, src->nanims * sizeof(struct anim));
+	for (i = 0; i < map->nanims; i++)
+		memset(&map->anims[i].timer, 0, sizeof(struct timer));
+
+	map->ticks = src->ticks;
+	map->entry = src->entry;
+	map->nnpcs = src->nnpcs;
+	map->npcs  = src->npcs;
+	map->tileset = src->tileset;
+	map->tiles   = src->tiles;
+	return map;
+}
+
+int
+map_solid(struct map *map, int x, int y)
+{
+	int i;
+
+	if (x < 0 || x >= map->width || y < 0 || y >= map->height)
+		return 1;
+	i = map->height * x + y;
+	return (map->solid[i / 32] >> (i % 32)) & 1;
+}
+
 void
-map_free(struct map *m)
+map_animate(struct map *map, int id)
 {
-	if (m) {
-		free(m->cells[0]);
-		free(m->cells[1]);
+	struct anim *a = &map->anims[id];
+
+	a->frame   = (a->frame + 1) % a->nframes;
+	a->changed = ++map->ticks;
+}
+
+int
+map_get(struct map *map, int layer, int x, int y)
+{
+	if (x < 0 || x >= map->width || y < 0 || y >= map->height)
+		return TILE_NONE;
+	return layer == MAP_FLOOR ? mapat(map, 0, x, y)
+	                          : layer_get(map->objects, x, y);
+}
+
+/* append a change, first dropping whatever every watcher
+   has already seen, so the journal only ever holds the
+   backlog of the slowest one. */
+static void
+s_journal(struct map *map, struct mapchange *c)
+{
+	struct journal *j = &map->journal;
+	uint64_t low;
+	int i, drop;
+
+	if (j->n == j->cap) {
+		low = j->base + j->n;
+		for (i = 0; i < MAP_WATCHERS; i++)
+			if (j->watchers & (1 << i) && j->cursor[i] < low)
+				low = j->cursor[i];
+
+		drop = (int)(low - j->base);
+		memmove(j->changes, j->changes + drop, (j->n - drop) * sizeof(struct mapchange));
+		j->n    -= drop;
+		j->base += drop;
+
+		if (j->n == j->cap) {
+			j->cap = j->cap ? j->cap * 2 : 256;
+			j->changes = reallocate(MEM_MAP, j->changes, j->cap, sizeof(struct mapchange));
+		}
 	}
-	free(m);
+	j->changes[j->n++] = *c;
+}
+
+void
+map_set(struct map *map, int layer, int x, int y, int v)
+{
+	struct mapchange c;
+	int i, solid;
+
+	assert(layer == MAP_FLOOR || layer == MAP_OBJECTS);
+	if (x < 0 || x >= map->width || y < 0 || y >= map->height)
+		return;
+
+	c.layer = layer;
+	c.x = x;
+	c.y = y;
+	c.was = map_get(map, layer, x, y);
+	c.now = v;
+	if (c.was == c.now)
+		return;
+
+	if (layer == MAP_FLOOR) mapat(map, 0, x, y) = v;
+	else                    layer_set(map->objects, x, y, v);
+
+	i = map->height * x + y;
+	solid = mapat(map, 0, x, y) & TILE_SOLID
+	     || layer_get(map->objects, x, y);
+	c.solid = solid != (int)((map->solid[i / 32] >> (i % 32)) & 1);
+	if (solid) map->solid[i / 32] |=   1u << (i % 32);
+	else       map->solid[i / 32] &= ~(1u << (i % 32));
+
+	if (map->journal.watchers)
+		s_journal(map, &c);
+}
+
+int
+map_watch(struct map *map)
+{
+	struct journal *j = &map->journal;
+	int i;
+
+	for (i = 0; i < MAP_WATCHERS; i++) {
+		if (j->watchers & (1 << i)) continue;
+		j->watchers |= 1 << i;
+		j->cursor[i] = j->base + j->n;
+		return i;
+	}
+	fprintf(stderr, "too many watchers on map (max %d)\n", MAP_WATCHERS);
+	exit(EXIT_INT_FAILURE);
+}
+
+void
+map_unwatch(struct map *map, int w)
+{
+	map->journal.watchers &= ~(1 << w);
+}
+
+int
+map_changes(struct map *map, int w, const struct mapchange **changes)
+{
+	struct journal *j = &map->journal;
+	int n;
+
+	n = (int)(j->base + j->n - j->cursor[w]);
+	*changes = j->changes + (j->cursor[w] - j->base);
+	j->cursor[w] = j->base + j->n;
+	return n;
+}
+
+void
+map_free(struct map *m)
+{
+	if (m) arena_free(m->arena);
 }
 
+/* the grid, from raw (NUL-terminated); path is just for errors */
 static struct map *
-s_parse_map(const char *path, struct mapkey *key)
+s_parse_map(struct arena *arena, const char *path, const char *raw, struct mapkey *key)
 {
-	char *raw, *p;
+	const char *p;
 	struct map *map;
-	int i, x, y;
+	int i, x, y, w, h;
 
-	raw = s_readmap(path);
-	map = allocate(1, sizeof(struct map));
-	map->tiles = tileset_read(key->tileset);
-	if (!map->tiles) {
-		fprintf(stderr, "TILE READ FAILED\n");
+	s_mapsize(raw, &w, &h);
+	if (w == 0) {
+		fprintf(stderr, "map %s is empty\n", path);
+		return NULL;
 	}
-	s_mapsize(raw, &map->width, &map->height);
-	map->cells[0] = calloc(map->width * map->height, sizeof(int));
-	map->cells[1] = calloc(map->width * map->height, sizeof(int));
+	/* ragged lines are padded out to the longest one */
+	if ((size_t)w * h > MAX_MAP_SIZE) {
+		fprintf(stderr, "map %s is too large (%dx%d)\n", path, w, h);
+		return NULL;
+	}
+	map = s_map(arena, w, h);
 	map->entry.x = key->entry.x;
 	map->entry.y = key->entry.y;
 
+	map->nnpcs = key->nnpcs;
+	map->npcs  = key->npcs;
+	for (i = 0; i < key->nnpcs; i++)
+		map->npcs[i].tile = key->tiles[key->npcs[i].symbol];
+
+	map->nanims = key->nanims;
+	map->anims  = arena_alloc(arena, key->nanims, sizeof(struct anim));
+	memcpy(map->anims, key->anims, key->nanims * sizeof(struct anim));
+
 	/* decode the newline-terminated map into a cell-list */
 	for (x = y = 0, p = raw; *p; p++) {
 		if (*p == '\n') {
@@ -186,50 +406,64 @@ s_parse_map(const char *path, struct mapkey *key)
 		}
 
 		if (*p == key->void_tile) {
-			mapat(map, 0, x++, y) = 0x00; /* NONE */
+			map_set(map, MAP_FLOOR, x++, y, TILE_NONE);
 		} else {
-			mapat(map, 0, x++, y) = key->tiles[(int)*p]
-			                   ? key->tiles[(int)*p]
-			                   : key->default_tile;
+			map_set(map, MAP_FLOOR, x++, y, key->tiles[(unsigned char)*p]
+			                                ? key->tiles[(unsigned char)*p]
+			                                : key->default_tile);
 		}
 	}
 
 	for (i = 0; i < key->next_object; i++) {
-		mapat(map, 1, key->objects[i].at.x,
-		              key->objects[i].at.y) = key->tiles[(int)key->objects[i].symbol]
-		                                    ? key->tiles[(int)key->objects[i].symbol]
-		                                    : 0x00; /* NONE */
+		map_set(map, MAP_OBJECTS, key->objects[i].at.x,
+		                          key->objects[i].at.y, key->tiles[(unsigned char)key->objects[i].symbol]);
 	}
-
-	free(raw);
 	return map;
 }
 
+/* the compiled script for an npc on line; the same source
+   as one seen before gets the same program */
+static struct program *
+s_program(struct arena *arena, struct mapkey *m, const char *source, const char *file, int line)
+{
+	struct program *prog;
+	int i;
+
+	for (i = 0; i < m->nscripts; i++)
+		if (strcmp(m->scripts[i].source, source) == 0)
+			return m->scripts[i].program;
+
+	prog = script_compile(arena, source, file, line);
+	if (prog && m->nscripts < MAP_SCRIPTS) {
+		m->scripts[m->nscripts].source  = source;
+		m->scripts[m->nscripts].program = prog;
+		m->nscripts++;
+	}
+	return prog;
+}
+
+/* the key: len bytes of source, read from path */
 static struct mapkey *
-s_parse_mapkey(const char *path)
+s_parse_mapkey(struct arena *arena, const char *path, const char *source, size_t len)
 {
 	struct parser p;
 	struct mapkey *m;
-	off_t len;
-	int token, solid, idx;
+	struct mapobj *o;
+	struct anim *a;
+	struct npcdef *n;
+	int token, solid, idx, line;
 	int x, y;
 
-	p.file = path;
-	p.fd = open(p.file, O_RDONLY);
-	if (p.fd < 0) goto fail;
-
-	len = lseek(p.fd, 0, SEEK_END);
-	if (len < 0) goto fail;
-	lseek(p.fd, 0, SEEK_SET);
-
-	p.len = len;
-	p.source = mmap(NULL, len, PROT_READ, MAP_PRIVATE, p.fd, 0);
-	if (p.source == MAP_FAILED) goto fail;
-
+	p.arena  = arena;
+	p.file   = path;
+	p.source = source;
+	p.len    = len;
 	p.line = 1;
 	p.column = 1;
 	p.here = p.there = 0;
-	m = allocate(1, sizeof(*m));
+	p.pushed = T_EOF;
+	m = arena_alloc(arena, 1, sizeof(*m));
+	x = y = 0;
 
 	for (;;) {
 		token = s_lexer(&p);
@@ -243,7 +477,6 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `map' keyword MUST be followed by the name of the map (as a string)\n");
 				goto fail;
 			}
-			free(m->name);
 			m->name = p.data.string;
 			break;
 
@@ -254,7 +487,6 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `tileset' keyword MUST be followed by the path to the tileset (as a string)\n");
 				goto fail;
 			}
-			free(m->tileset);
 			m->tileset = p.data.string;
 			break;
 
@@ -265,6 +497,11 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `default' keyword MUST be followed by a tile index number\n");
 				goto fail;
 			}
+			if (p.data.number > MAX_TILE_INDEX) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Tile index %d is out of range (max %d)\n", p.data.number, MAX_TILE_INDEX);
+				goto fail;
+			}
 			m->default_tile = ((1 + p.data.number) << 24);
 			break;
 
@@ -295,7 +532,7 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "Tiles must be defined `tile (solid|empty) SYMBOL INDEX', where SYMBOL is the tile symbol (a single character)\n");
 				goto fail;
 			}
-			idx = (int)(p.data.symbol);
+			idx = (unsigned char)p.data.symbol;
 
 			token = s_lexer(&p);
 			if (token != T_NUMBER) {
@@ -303,10 +540,66 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "Tiles must be defined `tile (solid|empty) SYMBOL INDEX', where INDEX is the tile index (a number)\n");
 				goto fail;
 			}
+			if (p.data.number > MAX_TILE_INDEX) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Tile index %d is out of range (max %d)\n", p.data.number, MAX_TILE_INDEX);
+				goto fail;
+			}
 			m->tiles[idx] = solid ? ((1 + p.data.number) << 24) | 0x01
 			                      : ((1 + p.data.number) << 24);
 			break;
 
+		case T_KW_ANIM:
+			token = s_lexer(&p);
+			switch (token) {
+			case T_KW_SOLID: solid = 1; break;
+			case T_KW_EMPTY: solid = 0; break;
+			default:
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "The `anim` keyword MUST be followed by either the `solid' keyword or the `empty' keyword\n");
+				goto fail;
+			}
+
+			token = s_lexer(&p);
+			if (token != T_SYMBOL) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Animated tiles must be defined `anim (solid|empty) SYMBOL MS INDEX...', where SYMBOL is the tile symbol (a single character)\n");
+				goto fail;
+			}
+			idx = (unsigned char)p.data.symbol;
+
+			token = s_lexer(&p);
+			if (token != T_NUMBER || p.data.number == 0) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Animated tiles must be defined `anim (solid|empty) SYMBOL MS INDEX...', where MS is how long each frame shows, in milliseconds\n");
+				goto fail;
+			}
+			if (m->nanims == MAP_ANIMS) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Too many animated tiles (max %d)\n", MAP_ANIMS);
+				goto fail;
+			}
+			a = &m->anims[m->nanims];
+			a->period = p.data.number * NSEC_PER_MSEC;
+
+			/* frames run until the next thing that isn't a number */
+			while ((token = s_lexer(&p)) == T_NUMBER) {
+				if (a->nframes == MAP_ANIM_FRAMES) {
+					fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+					fprintf(stderr, "Too many frames in animated tile '%c' (max %d)\n", idx, MAP_ANIM_FRAMES);
+					goto fail;
+				}
+				a->tiles[a->nframes++] = p.data.number;
+			}
+			p.pushed = token;
+			if (a->nframes == 0) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "Animated tiles must be defined `anim (solid|empty) SYMBOL MS INDEX...', where each INDEX is a tile index (a number)\n");
+				goto fail;
+			}
+			m->tiles[idx] = ((1 + m->nanims++) << 24) | TILE_ANIMATED | (solid ? TILE_SOLID : 0);
+			break;
+
 		case T_KW_FROM:
 			token = s_lexer(&p);
 			if (token != T_NUMBER) {
@@ -332,7 +625,16 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `place' keyword requires a symbol, and X + Y coordinates\n");
 				goto fail;
 			}
-			m->objects[m->next_object].symbol = p.data.symbol;
+			if (m->next_object == m->capobjects) {
+				/* as for npcs, below */
+				m->capobjects = m->capobjects ? m->capobjects * 2 : 256;
+				o = arena_alloc(arena, m->capobjects, sizeof(struct mapobj));
+				if (m->next_object)
+					memcpy(o, m->objects, m->next_object * sizeof(struct mapobj));
+				m->objects = o;
+			}
+			o = &m->objects[m->next_object];
+			o->symbol = p.data.symbol;
 
 			token = s_lexer(&p);
 			if (token != T_NUMBER) {
@@ -340,7 +642,7 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `place' keyword requires a symbol, and X + Y coordinates\n");
 				goto fail;
 			}
-			m->objects[m->next_object].at.x = p.data.number + x;
+			o->at.x = p.data.number + x;
 
 			token = s_lexer(&p);
 			if (token != T_NUMBER) {
@@ -348,15 +650,64 @@ s_parse_mapkey(const char *path)
 				fprintf(stderr, "The `place' keyword requires a symbol, and X + Y coordinates\n");
 				goto fail;
 			}
-			m->objects[m->next_object].at.y = p.data.number + y;
+			o->at.y = p.data.number + y;
 			m->next_object++;
 			break;
 
+		case T_KW_NPC:
+			line = p.line;
+			token = s_lexer(&p);
+			if (token != T_SYMBOL) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "NPCs must be defined `npc SYMBOL X Y SCRIPT', where SYMBOL is the tile symbol (a single character)\n");
+				goto fail;
+			}
+			if (m->nnpcs == m->capnpcs) {
+				/* the old array is left to the arena; it's scratch */
+				m->capnpcs = m->capnpcs ? m->capnpcs * 2 : 16;
+				n = arena_alloc(arena, m->capnpcs, sizeof(struct npcdef));
+				if (m->nnpcs)
+					memcpy(n, m->npcs, m->nnpcs * sizeof(struct npcdef));
+				m->npcs = n;
+			}
+			n = &m->npcs[m->nnpcs];
+			n->symbol = p.data.symbol;
+
+			token = s_lexer(&p);
+			if (token != T_NUMBER) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "NPCs must be defined `npc SYMBOL X Y SCRIPT', where X and Y are coordinates (numbers)\n");
+				goto fail;
+			}
+			n->at.x = p.data.number + x;
+
+			token = s_lexer(&p);
+			if (token != T_NUMBER) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "NPCs must be defined `npc SYMBOL X Y SCRIPT', where X and Y are coordinates (numbers)\n");
+				goto fail;
+			}
+			n->at.y = p.data.number + y;
+
+			token = s_lexer(&p);
+			if (token != T_STRING) {
+				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
+				fprintf(stderr, "NPCs must be defined `npc SYMBOL X Y SCRIPT', where SCRIPT is what it does (as a string)\n");
+				goto fail;
+			}
+			n->source  = p.data.string;
+			n->program = s_program(arena, m, n->source, p.file, line);
+			if (!n->program)
+				goto fail;
+			m->nnpcs++;
+			break;
+
 		case T_KW_ENTRY:
 			token = s_lexer(&p);
 			if (token != T_NUMBER) {
 				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
 				fprintf(stderr, "The `entry' keyword requires both an X and Y coordinate, as numbers\n");
+				goto fail;
 			}
 			m->entry.x = p.data.number + x;
 
@@ -364,6 +715,7 @@ s_parse_mapkey(const char *path)
 			if (token != T_NUMBER) {
 				fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
 				fprintf(stderr, "The `entry' keyword requires both an X and Y coordinate, as numbers\n");
+				goto fail;
 			}
 			m->entry.y = p.data.number + y;
 
@@ -382,7 +734,6 @@ s_parse_mapkey(const char *path)
 		case T_STRING:
 			fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
 			fprintf(stderr, "Unexpected string \"%s\" found.\n", p.data.string);
-			free(p.data.string);
 			goto fail;
 
 		case T_NUMBER:
@@ -397,7 +748,17 @@ s_parse_mapkey(const char *path)
 
 		case T_ERROR:
 			fprintf(stderr, "%s:%d:%d: ", p.file, p.line, p.column);
-			fprintf(stderr, "ERROR: %d\n", p.data.error);
+			switch (p.data.error) {
+			case T_ERROR_UNTERMINATED_STRING:
+				fprintf(stderr, "Unterminated string (missing a closing `\"')\n");
+				break;
+			case T_ERROR_NUMBER_TOO_BIG:
+				fprintf(stderr, "Number too big (max %d)\n", MAX_MAP_SIZE);
+				break;
+			case T_ERROR_STRAY_CHARACTER:
+				fprintf(stderr, "Stray character (byte %d) found\n", (unsigned char)p.source[p.here]);
+				break;
+			}
 			goto fail;
 
 		default:
@@ -407,25 +768,25 @@ s_parse_mapkey(const char *path)
 		}
 	}
 
+	if (!m->tileset) {
+		fprintf(stderr, "%s: no `tileset' given\n", p.file);
+		goto fail;
+	}
 	return m;
 
 fail:
-	fprintf(stderr, "failed: %s (error %d)\ncleaning up...\n",
-		strerror(errno), errno);
-	if (p.source && p.source != MAP_FAILED)
-		munmap(p.source, p.len);
-	if (p.fd >= 0)
-		close(p.fd);
+	fprintf(stderr, "%s: failed to parse map key\n", p.file);
 	return NULL;
 }
 
-#define s_char(p)   ((p)->source[(p)->here])
+#define s_char(p)   ((unsigned char)(p)->source[(p)->here])
 #define s_space(p)  (isspace(s_char(p)))
 #define s_number(p) (isdigit(s_char(p)))
 #define s_graph(p)  (isgraph(s_char(p)))
 
-#define s_done(p) ((p)->here == (p)->len)
-#define s_keyword(p,w) (memcmp((p)->source + (p)->there, w, strlen(w)) == 0)
+#define s_done(p) ((p)->here >= (p)->len)
+#define s_keyword(p,w) ((p)->here - (p)->there + 1 == strlen(w) \
+                     && memcmp((p)->source + (p)->there, w, strlen(w)) == 0)
 
 static inline void
 s_next(struct parser *p) {
@@ -445,17 +806,18 @@ s_skip(struct parser *p) {
 	p->there++;
 }
 
-static inline char
+/* the next character but one; the end reads as a newline */
+static inline unsigned char
 s_peek(struct parser *p)
 {
-	if (s_done(p)) return '\n';
+	if (p->here + 1 >= p->len) return '\n';
 	return p->source[p->here+1];
 }
 
 static inline void
 s_stringat(struct parser *p, int a, int b)
 {
-	p->data.string = allocate(b - a + 2, sizeof(char));
+	p->data.string = arena_alloc(p->arena, b - a + 2, sizeof(char));
 	memcpy(p->data.string, p->source + a, b - a + 1);
 }
 
@@ -484,6 +846,14 @@ s_qstring(struct parser *p)
 static int
 s_lexer(struct parser *p)
 {
+	int token;
+
+	if (p->pushed) {
+		token = p->pushed;
+		p->pushed = T_EOF;
+		return token;
+	}
+
 	if (s_done(p)) return T_EOF;
 	p->there = p->here;
 
@@ -491,7 +861,8 @@ s_lexer(struct parser *p)
 again:
 		/* skip comments to end of line */
 		if (s_char(p) == ';' && s_peek(p) == ';') {
-			while (s_char(p) != '\n') s_skip(p);
+			while (!s_done(p) && s_char(p) != '\n') s_skip(p);
+			if (s_done(p)) return T_EOF;
 			s_skip(p);
 			if (s_done(p)) return T_EOF;
 			goto again;
@@ -509,6 +880,10 @@ again:
 			while (!s_done(p) && s_number(p)) {
 				p->data.number = (p->data.number * 10)
 				               + (s_char(p) - '0');
+				if (p->data.number > MAX_MAP_SIZE) {
+					p->data.error = T_ERROR_NUMBER_TOO_BIG;
+					return T_ERROR;
+				}
 				s_next(p);
 			}
 			return T_NUMBER;
@@ -517,8 +892,9 @@ again:
 		if (s_char(p) == '"') {
 			p->data.error = T_ERROR_UNTERMINATED_STRING;
 			s_next(p);
-			if (s_done(p)) return T_ERROR;
-			while (s_char(p) != '"') {
+			for (;;) {
+				if (s_done(p)) return T_ERROR;
+				if (s_char(p) == '"') break;
 				if (s_char(p) == '\\') {
 					s_next(p);
 					if (s_done(p)) return T_ERROR;
@@ -545,6 +921,8 @@ again:
 			if (s_keyword(p, "solid"))   { s_next(p); return T_KW_SOLID;   }
 			if (s_keyword(p, "place"))   { s_next(p); return T_KW_PLACE;   }
 			if (s_keyword(p, "entry"))   { s_next(p); return T_KW_ENTRY;   }
+			if (s_keyword(p, "anim"))    { s_next(p); return T_KW_ANIM;    }
+			if (s_keyword(p, "npc"))     { s_next(p); return T_KW_NPC;     }
 			if (s_keyword(p, "from"))    { s_next(p); return T_KW_FROM;    }
 			if (s_keyword(p, "tile"))    { s_next(p); return T_KW_TILE;    }
 			if (s_keyword(p, "void"))    { s_next(p); return T_KW_VOID;    }
@@ -554,20 +932,81 @@ again:
 			s_next(p);
 			return T_STRING;
 		}
+
+		/* control characters, and anything not ASCII */
+		p->data.error = T_ERROR_STRAY_CHARACTER;
+		return T_ERROR;
 	}
-	return T_EOF;
 }
 
+/* a map from memory: the text of its key, and its grid (up
+   to a NUL).  file names it, in errors.  nothing is read from
+   disk, so the tileset isn't loaded; map->tiles is NULL. */
 struct map *
-map_read(const char *path)
+map_parse(const char *mf, size_t len, const char *grid, const char *file)
 {
-	char *p;
+	struct arena *arena;
 	struct mapkey *key;
+	struct map *map;
+
+	/* everything but the map itself (the key, its strings)
+	   is scratch, but it is small and lives and dies with
+	   the map, so it all goes in the one arena. */
+	arena = arena_new(MEM_MAP);
+	key = s_parse_mapkey(arena, file, mf, len);
+	map = key ? s_parse_map(arena, file, grid, key) : NULL;
+	if (!map) {
+		arena_free(arena);
+		return NULL;
+	}
+	map->tileset = key->tileset;
+	return map;
+}
+
+struct map *
+map_read(const char *path)
+{
+	struct map *map;
+	char *mf, *raw;
+	void *source;
+	off_t len;
+	int fd;
 
-	p = astring("%s.mf", path);
-	key = s_parse_mapkey(p);
-	free(p);
-	if (!key) return NULL;
+	mf = astring("%s.mf", path);
+	fd = open(mf, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to read map key from %s: %s (error %d)\n",
+			mf, strerror(errno), errno);
+		release(mf);
+		return NULL;
+	}
+	len = lseek(fd, 0, SEEK_END);
+	source = len > 0 ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	if (len < 0 || source == MAP_FAILED) {
+		fprintf(stderr, "failed to read map key from %s: %s (error %d)\n",
+			mf, strerror(errno), errno);
+		close(fd);
+		release(mf);
+		return NULL;
+	}
 
-	return s_parse_map(path, key);
+	/* the raw grid is only needed while decoding it,
+	   so it stays out of the arena. */
+	raw = s_readmap(path);
+	map = map_parse(source ? source : "", len, raw, mf);
+	release(raw);
+	if (source)
+		munmap(source, len);
+	close(fd);
+	release(mf);
+	if (!map)
+		return NULL;
+
+	map->tiles = tileset_read(map->arena, map->tileset);
+	if (!map->tiles) {
+		fprintf(stderr, "failed to read tileset %s for map %s\n", map->tileset, path);
+		map_free(map);
+		return NULL;
+	}
+	return map;
 }
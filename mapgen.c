@@ -0,0 +1,154 @@
+#include "prisma.h"
+
+/* synthetic maps, for stressing the map parser.
+
+   writes a key (.mf) and a grid in the same shape as
+   maps/base: a castle of MAPGEN_ROOM x MAPGEN_ROOM rooms,
+   walled in +, - and |, with a door or two knocked through
+   each wall.  density percent of the floor gets a symbol of
+   its own (carpet, or an animated one) rather than falling
+   back to the default tile; ragged percent of the rows lose
+   their trailing cells, as if an editor had trimmed them.
+
+   objects are placed from a `from' origin per room, so that
+   both absolute and relative coordinates get parsed, and
+   npcs share a handful of scripts, so that some compile and
+   most are looked up.  it all follows from the seed. */
+
+#define MAPGEN_ROOM    12
+#define MAPGEN_SCRIPTS 4
+
+static const char OBJECTS[] = "cnu$oJ";
+static const char FLOORS[]  = ".x~";
+
+static const char *SCRIPTS[MAPGEN_SCRIPTS] = {
+	"d = 1\nwalk: a = solid d 0\nif a goto turn\nmove d 0\nwait 8\nmove 0 0\ngoto walk\nturn: d = 0 - d\ngoto walk",
+	"d = 1\nwalk: a = solid 0 d\nif a goto turn\nmove 0 d\nwait 8\nmove 0 0\ngoto walk\nturn: d = 0 - d\ngoto walk",
+	"look: a = rand 4\na = a + 1\nwait a\nyield\ngoto look",
+	"c = x; d = y\nlook: a = hx; b = hy\nif a != c goto idle\nif b == d goto open\nidle: wait 4\ngoto look\nopen: put 0 1 44\nend",
+};
+
+/* somewhere inside a room, relative to its corner */
+static void
+s_spot(int *x, int *y)
+{
+	*x = 1 + rand() % (MAPGEN_ROOM - 1);
+	*y = 1 + rand() % (MAPGEN_ROOM - 1);
+}
+
+static void
+s_key(struct mapgen *g, FILE *key)
+{
+	int rw, rh, i, n, x, y, r;
+
+	fprintf(key, "map \"generated %dx%d, seed %u\"\n", g->width, g->height, g->seed);
+	fprintf(key, "tileset \"assets/tileset\"\n");
+	fprintf(key, "default 8\n");
+	fprintf(key, "void #\n");
+	fprintf(key, "tile solid + 3\n");
+	fprintf(key, "tile solid - 0\n");
+	fprintf(key, "tile solid | 1\n");
+	fprintf(key, "tile solid c 55 ;; cabinet\n");
+	fprintf(key, "tile solid n 54 ;; table\n");
+	fprintf(key, "tile solid u 27 ;; jar\n");
+	fprintf(key, "tile empty x 17 ;; carpet\n");
+	fprintf(key, "tile empty . 9  ;; carpet\n");
+	fprintf(key, "tile solid $ 44 ;; chest\n");
+	fprintf(key, "tile empty o 68 ;; coins\n");
+	fprintf(key, "tile empty J 69 ;; jewels\n");
+	fprintf(key, "anim empty ~ 250 68 69\n\n");
+	fprintf(key, "entry 1 1\n\n");
+
+	rw = (g->width  - 1) / MAPGEN_ROOM;
+	rh = (g->height - 1) / MAPGEN_ROOM;
+	if (rw < 1 || rh < 1)
+		return;
+
+	/* objects, a room at a time */
+	for (i = 0; i < g->objects; i += n) {
+		r = rand() % (rw * rh);
+		fprintf(key, "from %d %d\n", (r % rw) * MAPGEN_ROOM, (r / rw) * MAPGEN_ROOM);
+		for (n = 0; n < 16 && i + n < g->objects; n++) {
+			s_spot(&x, &y);
+			fprintf(key, "place %c %d %d\n", OBJECTS[rand() % (sizeof(OBJECTS) - 1)], x, y);
+		}
+	}
+
+	fprintf(key, "\nfrom 0 0\n");
+	for (i = 0; i < g->npcs; i++) {
+		r = rand() % (rw * rh);
+		s_spot(&x, &y);
+		fprintf(key, ";; npc %d\nnpc u %d %d \"%s\"\n", i,
+			(r % rw) * MAPGEN_ROOM + x, (r / rw) * MAPGEN_ROOM + y, SCRIPTS[rand() % MAPGEN_SCRIPTS]);
+	}
+}
+
+static void
+s_grid(struct mapgen *g, FILE *grid)
+{
+	char *row;
+	int x, y, w;
+
+	row = allocate(g->width + 1, 1);
+	for (y = 0; y < g->height; y++) {
+		for (x = 0; x < g->width; x++) {
+			if (x % MAPGEN_ROOM == 0 && y % MAPGEN_ROOM == 0)
+				row[x] = '+';
+			else if (y % MAPGEN_ROOM == 0)
+				row[x] = x % MAPGEN_ROOM == MAPGEN_ROOM / 2 && y > 0 && y < g->height - 1 ? ' ' : '-';
+			else if (x % MAPGEN_ROOM == 0)
+				row[x] = y % MAPGEN_ROOM == MAPGEN_ROOM / 2 && x > 0 && x < g->width - 1 ? ' ' : '|';
+			else if (rand() % 100 < g->density)
+				row[x] = FLOORS[rand() % (sizeof(FLOORS) - 1)];
+			else
+				row[x] = ' ';
+		}
+
+		w = g->width;
+		if (rand() % 100 < g->ragged)
+			w -= rand() % (MAPGEN_ROOM / 2 + 1);
+		fwrite(row, 1, w, grid);
+		fputc('\n', grid);
+	}
+	release(row);
+}
+
+/* write g's map, as key and grid */
+void
+mapgen(struct mapgen *g, FILE *key, FILE *grid)
+{
+	srand(g->seed);
+	s_key(g, key);
+	s_grid(g, grid);
+}
+
+/* write g's map, to path and path.mf */
+int
+mapgen_write(struct mapgen *g, const char *path)
+{
+	FILE *key, *grid;
+	char *mf;
+	int rc;
+
+	mf   = astring("%s.mf", path);
+	key  = fopen(mf, "w");
+	grid = fopen(path, "w");
+	if (!key || !grid) {
+		fprintf(stderr, "failed to write map %s: %s (error %d)\n",
+			path, strerror(errno), errno);
+		if (key)  fclose(key);
+		if (grid) fclose(grid);
+		release(mf);
+		return -1;
+	}
+
+	mapgen(g, key, grid);
+	rc = ferror(key) || ferror(grid) ? -1 : 0;
+	if (fclose(key) != 0)  rc = -1;
+	if (fclose(grid) != 0) rc = -1;
+	if (rc != 0)
+		fprintf(stderr, "failed to write map %s: %s (error %d)\n",
+			path, strerror(errno), errno);
+	release(mf);
+	return rc;
+}
@@ -0,0 +1,172 @@
+#include "prisma.h"
+
+#include <stddef.h>
+
+/* memory accounting.
+
+   every block handed out by tallocate() carries a small
+   header recording its size and subsystem tag, so release()
+   can charge the free back to the right place.  surfaces are
+   accounted for by pitch x height, with the tag stashed in
+   the surface's userdata.
+
+   counters are shared by all threads (the path and flow
+   workers allocate too), behind one spinlock; none of this
+   is on a path hot enough for that to matter, and if it is,
+   the per-frame count will say so. */
+
+union header {
+	struct {
+		size_t size;
+		int    tag;
+	} h;
+	max_align_t align;
+};
+
+static const char *TAGS[MEM_TAGS] = {
+	"misc", "map", "tileset", "render", "parser", "nav", "entity", "audio",
+};
+
+static struct memstats STATS[MEM_TAGS];
+static unsigned long   ALLOCS;
+static SDL_SpinLock    LOCK;
+
+static void
+s_charge(int tag, size_t size)
+{
+	SDL_AtomicLock(&LOCK);
+	STATS[tag].current += size;
+	STATS[tag].churn   += size;
+	STATS[tag].allocs++;
+	if (STATS[tag].current > STATS[tag].peak)
+		STATS[tag].peak = STATS[tag].current;
+	ALLOCS++;
+	SDL_AtomicUnlock(&LOCK);
+}
+
+static void
+s_credit(int tag, size_t size)
+{
+	SDL_AtomicLock(&LOCK);
+	STATS[tag].current -= size;
+	STATS[tag].frees++;
+	SDL_AtomicUnlock(&LOCK);
+}
+
+static void
+s_oom(size_t n, size_t size)
+{
+	fprintf(stderr, "failed to allocate memory: %lu x %lu bytes: %s (error %d)\n",
+			(unsigned long)n, (unsigned long)size, strerror(errno), errno);
+	exit(EXIT_INT_FAILURE);
+}
+
+void *
+tallocate(int tag, size_t n, size_t size)
+{
+	union header *b;
+
+	assert(tag >= 0 && tag < MEM_TAGS);
+	if (size && n > (SIZE_MAX - sizeof(union header)) / size)
+		s_oom(n, size);
+
+	b = calloc(1, sizeof(union header) + n * size);
+	if (!b) s_oom(n, size);
+
+	b->h.size = n * size;
+	b->h.tag  = tag;
+	s_charge(tag, b->h.size);
+	return b + 1;
+}
+
+void *
+reallocate(int tag, void *p, size_t n, size_t size)
+{
+	union header *b;
+	size_t was;
+
+	if (!p) return tallocate(tag, n, size);
+	if (size && n > (SIZE_MAX - sizeof(union header)) / size)
+		s_oom(n, size);
+
+	b   = (union header *)p - 1;
+	was = b->h.size;
+	b   = realloc(b, sizeof(union header) + n * size);
+	if (!b) s_oom(n, size);
+
+	/* a resize is a free and an allocation, as far as
+	   the churn numbers are concerned */
+	s_credit(b->h.tag, was);
+	b->h.size = n * size;
+	s_charge(b->h.tag, b->h.size);
+	return b + 1;
+}
+
+void
+release(void *p)
+{
+	union header *b;
+
+	if (!p) return;
+	b = (union header *)p - 1;
+	s_credit(b->h.tag, b->h.size);
+	free(b);
+}
+
+SDL_Surface *
+mem_surface(int tag, SDL_Surface *s)
+{
+	assert(tag >= 0 && tag < MEM_TAGS);
+	if (!s) return NULL;
+
+	s->userdata = (void *)(intptr_t)tag;
+	s_charge(tag, (size_t)s->pitch * s->h);
+	return s;
+}
+
+void
+release_surface(SDL_Surface *s)
+{
+	if (!s) return;
+	s_credit((int)(intptr_t)s->userdata, (size_t)s->pitch * s->h);
+	SDL_FreeSurface(s);
+}
+
+void
+mem_stats(int tag, struct memstats *st)
+{
+	assert(tag >= 0 && tag < MEM_TAGS);
+	SDL_AtomicLock(&LOCK);
+	*st = STATS[tag];
+	SDL_AtomicUnlock(&LOCK);
+	st->name = TAGS[tag];
+}
+
+unsigned long
+mem_allocs()
+{
+	unsigned long n;
+
+	SDL_AtomicLock(&LOCK);
+	n = ALLOCS;
+	SDL_AtomicUnlock(&LOCK);
+	return n;
+}
+
+void
+mem_report(FILE *io)
+{
+	struct memstats st;
+	int i;
+
+	fprintf(io, "%-8s %10s %10s %12s %9s %9s\n",
+		"memory", "current", "peak", "churn", "allocs", "frees");
+	for (i = 0; i < MEM_TAGS; i++) {
+		mem_stats(i, &st);
+		fprintf(io, "%-8s %9luK %9luK %11luK %9lu %9lu\n", st.name,
+			(unsigned long)(st.current + 1023) / 1024,
+			(unsigned long)(st.peak + 1023) / 1024,
+			(unsigned long)(st.churn + 1023) / 1024,
+			st.allocs, st.frees);
+	}
+}
@@ -0,0 +1,269 @@
+#include "prisma.h"
+
+/* zoomed-out pictures of the map.
+
+   drawn tile by tile, a map seen from far enough away is
+   millions of blits a frame, most of them smaller than a
+   pixel.  instead, each cell is boiled down to one colour
+   (its floor, with whatever is on it laid over that, the
+   way the render cache would draw it), and those colours
+   are averaged 2x2 at a time into a pyramid of levels, each
+   half the size of the one below.  drawing at any zoom is
+   then a single scaled blit, from the first level whose
+   texels are still no smaller than a screen pixel; the
+   cost goes with the size of the screen, not of the map.
+
+   changes come through the map's journal, as for the render
+   cache: a changed cell is re-coloured, and so is the one
+   texel above it on each level, all the way to the top.
+   animated tiles are coloured by their first frame. */
+
+#define OVERVIEW_LEVELS 24
+
+struct olevel {
+	int w, h;
+	uint32_t    *pixels;    /* 0x00RRGGBB, w * h of them */
+	SDL_Surface *surface;   /* over the same pixels */
+};
+
+struct overview {
+	struct map *map;
+	int watch;
+
+	int       ntiles;
+	uint32_t *tiles;        /* each tile's average colour, and its coverage as alpha */
+
+	int nlevels;
+	struct olevel levels[OVERVIEW_LEVELS];
+};
+
+#define s_r(c) (((c) >> 16) & 0xff)
+#define s_g(c) (((c) >>  8) & 0xff)
+#define s_b(c) ( (c)        & 0xff)
+#define s_a(c) ( (c) >> 24)
+
+/* the average of a tile's pixels, weighted by their alpha;
+   the alpha is how much of the tile they cover */
+static uint32_t
+s_average(struct tileset *tiles, int t)
+{
+	SDL_Surface *s = tiles->surface;
+	Uint8 r, g, b, a;
+	uint64_t sr, sg, sb, sa;
+	int x, y, x0, y0, n;
+
+	if (s->format->BytesPerPixel != 4)
+		return 0xff808080;
+
+	x0 = tiles->tile.width  * (t % tiles->width);
+	y0 = tiles->tile.height * (t / tiles->width);
+	n  = tiles->tile.width * tiles->tile.height;
+	sr = sg = sb = sa = 0;
+	for (y = y0; y < y0 + tiles->tile.height; y++) {
+		for (x = x0; x < x0 + tiles->tile.width; x++) {
+			SDL_GetRGBA(((Uint32 *)((Uint8 *)s->pixels + y * s->pitch))[x], s->format, &r, &g, &b, &a);
+			if (!s->format->Amask) a = 255;
+			sr += r * a;
+			sg += g * a;
+			sb += b * a;
+			sa += a;
+		}
+	}
+	if (sa == 0)
+		return 0;
+	return (uint32_t)(sa / n) << 24
+	     | (uint32_t)(sr / sa) << 16
+	     | (uint32_t)(sg / sa) << 8
+	     | (uint32_t)(sb / sa);
+}
+
+static uint32_t
+s_tile(struct overview *ov, int t)
+{
+	int n;
+
+	n = t & TILE_ANIMATED ? ov->map->anims[tileno(t)].tiles[0] : tileno(t);
+	return n >= 0 && n < ov->ntiles ? ov->tiles[n] : 0;
+}
+
+/* c, with (colour, coverage) o laid over it */
+static uint32_t
+s_over(uint32_t c, uint32_t o)
+{
+	unsigned a = s_a(o);
+
+	return ((s_r(c) * (255 - a) + s_r(o) * a) / 255) << 16
+	     | ((s_g(c) * (255 - a) + s_g(o) * a) / 255) << 8
+	     | ((s_b(c) * (255 - a) + s_b(o) * a) / 255);
+}
+
+/* a cell: black, the floor, then whatever is on it;
+   objects only show up on a floor */
+static uint32_t
+s_cell(struct overview *ov, int x, int y)
+{
+	uint32_t c;
+	int t, o;
+
+	t = mapat(ov->map, MAP_FLOOR, x, y);
+	if (!istile(t)) return 0;
+	c = s_over(0, s_tile(ov, t));
+	o = layer_get(ov->map->objects, x, y);
+	if (istile(o))
+		c = s_over(c, s_tile(ov, o));
+	return c;
+}
+
+/* a texel of level l > 0, from the (up to) four under it;
+   any that fall off the edge count as black */
+static uint32_t
+s_texel(struct overview *ov, int l, int x, int y)
+{
+	struct olevel *below = &ov->levels[l - 1];
+	unsigned r, g, b;
+	uint32_t c;
+	int i, j;
+
+	r = g = b = 0;
+	for (i = 2 * x; i < 2 * x + 2 && i < below->w; i++) {
+		for (j = 2 * y; j < 2 * y + 2 && j < below->h; j++) {
+			c  = below->pixels[j * below->w + i];
+			r += s_r(c);
+			g += s_g(c);
+			b += s_b(c);
+		}
+	}
+	return (r / 4) << 16 | (g / 4) << 8 | (b / 4);
+}
+
+/* re-colour a cell, and everything above it */
+static void
+s_touch(struct overview *ov, int x, int y)
+{
+	int l;
+
+	ov->levels[0].pixels[y * ov->levels[0].w + x] = s_cell(ov, x, y);
+	for (l = 1; l < ov->nlevels; l++) {
+		x /= 2;
+		y /= 2;
+		ov->levels[l].pixels[y * ov->levels[l].w + x] = s_texel(ov, l, x, y);
+	}
+}
+
+struct overview *
+overview_new(struct map *map)
+{
+	struct overview *ov;
+	struct olevel *lv;
+	int t, l, x, y, w, h;
+
+	assert(map != NULL);
+	assert(map->tiles != NULL);
+
+	ov = tallocate(MEM_RENDER, 1, sizeof(struct overview));
+	ov->map   = map;
+	ov->watch = map_watch(map);
+
+	ov->ntiles = map->tiles->count;
+	ov->tiles  = tallocate(MEM_RENDER, ov->ntiles, sizeof(uint32_t));
+	/* the tileset is RLE-encoded; its pixels are only there while it's locked */
+	if (SDL_MUSTLOCK(map->tiles->surface)) SDL_LockSurface(map->tiles->surface);
+	for (t = 0; t < ov->ntiles; t++)
+		ov->tiles[t] = s_average(map->tiles, t);
+	if (SDL_MUSTLOCK(map->tiles->surface)) SDL_UnlockSurface(map->tiles->surface);
+
+	w = map->width;
+	h = map->height;
+	for (l = 0; l < OVERVIEW_LEVELS; l++) {
+		lv = &ov->levels[l];
+		lv->w = w;
+		lv->h = h;
+		lv->pixels  = tallocate(MEM_RENDER, (size_t)w * h, sizeof(uint32_t));
+		lv->surface = mem_surface(MEM_RENDER,
+			SDL_CreateRGBSurfaceFrom(lv->pixels, w, h, 32, w * 4, 0xff0000, 0xff00, 0xff, 0));
+		if (!lv->surface) {
+			fprintf(stderr, "failed to create overview surface: %s\n", SDL_GetError());
+			exit(EXIT_INT_FAILURE);
+		}
+		ov->nlevels++;
+
+		for (y = 0; y < h; y++)
+			for (x = 0; x < w; x++)
+				lv->pixels[y * w + x] = l == 0 ? s_cell(ov, x, y) : s_texel(ov, l, x, y);
+
+		if (w == 1 && h == 1)
+			break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	return ov;
+}
+
+void
+overview_free(struct overview *ov)
+{
+	int l;
+
+	if (!ov) return;
+	map_unwatch(ov->map, ov->watch);
+	for (l = 0; l < ov->nlevels; l++) {
+		release_surface(ov->levels[l].surface);
+		release(ov->levels[l].pixels);
+	}
+	release(ov->tiles);
+	release(ov);
+}
+
+/* catch up on map changes */
+void
+overview_update(struct overview *ov)
+{
+	const struct mapchange *ch;
+	int i, n;
+
+	n = map_changes(ov->map, ov->watch, &ch);
+	for (i = 0; i < n; i++)
+		s_touch(ov, ch[i].x, ch[i].y);
+}
+
+/* draw the part of the map under view (in world pixels, of
+   which a cell is dx by dy) stretched over to, on dst */
+void
+overview_draw(struct overview *ov, SDL_Surface *dst, SDL_Rect *view, int dx, int dy, SDL_Rect *to)
+{
+	struct olevel *lv;
+	SDL_Rect src, at, clip;
+	int l, tw, th, x0, y0, x1, y1;
+
+	overview_update(ov);
+
+	/* the coarsest level with a texel to every pixel, or more */
+	for (l = 0; l + 1 < ov->nlevels && ((int64_t)dx << (l + 1)) * to->w <= view->w; l++)
+		;
+	lv = &ov->levels[l];
+	tw = dx << l;
+	th = dy << l;
+
+	/* the whole texels covering the view, and where they land */
+	x0 = bounded(0, view->x / tw - (view->x % tw < 0), lv->w);
+	y0 = bounded(0, view->y / th - (view->y % th < 0), lv->h);
+	x1 = bounded(0, (view->x + view->w + tw - 1) / tw, lv->w);
+	y1 = bounded(0, (view->y + view->h + th - 1) / th, lv->h);
+	if (x1 <= x0 || y1 <= y0)
+		return;
+
+	src.x = x0;
+	src.y = y0;
+	src.w = x1 - x0;
+	src.h = y1 - y0;
+	at.x  = to->x + (int64_t)(x0 * tw - view->x) * to->w / view->w;
+	at.y  = to->y + (int64_t)(y0 * th - view->y) * to->h / view->h;
+	at.w  = to->x + (int64_t)(x1 * tw - view->x) * to->w / view->w - at.x;
+	at.h  = to->y + (int64_t)(y1 * th - view->y) * to->h / view->h - at.y;
+
+	/* the edge texels hang over to, a little */
+	SDL_GetClipRect(dst, &clip);
+	SDL_SetClipRect(dst, to);
+	SDL_BlitScaled(lv->surface, &src, dst, &at);
+	SDL_SetClipRect(dst, &clip);
+}
@@ -0,0 +1,180 @@
+#include "prisma.h"
+#include <float.h>
+
+/* particles: sparks, dust, coin glints; short-lived sprites,
+   by the ten thousand.
+
+   each particle is a position, a velocity, a lifetime and a
+   tile (from a tileset of its own), kept structure-of-arrays
+   fashion: one array per field, each aligned to a cache line
+   and padded out to a whole number of vectors.  updating them
+   is then a straight run over five arrays of floats, PARTICLE_LANES
+   at a time, with GCC's vector extensions.
+
+   dead particles are squeezed out afterwards, without a branch
+   per particle: every particle is copied down to the next free
+   slot, and the slot only advances past it if it's still alive.
+   the lanes past the last live particle are kept alive forever
+   (life is FLT_MAX) so that they never look dead.
+
+   there is room for a fixed number of particles, set when the
+   system is made; emitting past that is dropped on the floor,
+   so the per-frame cost has a ceiling, and nothing allocates. */
+
+#define PARTICLE_ALIGN 64  /* bytes; a cache line */
+
+typedef float   v4sf __attribute__((vector_size(PARTICLE_LANES * sizeof(float))));
+typedef int32_t v4si __attribute__((vector_size(PARTICLE_LANES * sizeof(int32_t))));
+
+/* an array of n floats (or ints) out of the block at *at */
+static void *
+s_carve(char **at, int n)
+{
+	void *p = *at;
+	*at += n * sizeof(float);
+	return p;
+}
+
+struct particles *
+particles_new(const char *path, int cap)
+{
+	struct particles *p;
+	uintptr_t at;
+	char *next;
+	int i;
+
+	assert(cap > 0);
+
+	p = tallocate(MEM_ENTITY, 1, sizeof(struct particles));
+	p->arena = arena_new(MEM_ENTITY);
+	p->tiles = tileset_read(p->arena, path);
+	if (!p->tiles) {
+		arena_free(p->arena);
+		release(p);
+		return NULL;
+	}
+
+	/* whole cache lines' worth of each field */
+	p->cap   = (cap + 15) / 16 * 16;
+	p->block = tallocate(MEM_ENTITY, 7 * p->cap * sizeof(float) + PARTICLE_ALIGN, 1);
+	at       = ((uintptr_t)p->block + PARTICLE_ALIGN - 1) & ~(uintptr_t)(PARTICLE_ALIGN - 1);
+	next     = (char *)at;
+
+	p->x       = s_carve(&next, p->cap);
+	p->y       = s_carve(&next, p->cap);
+	p->dx      = s_carve(&next, p->cap);
+	p->dy      = s_carve(&next, p->cap);
+	p->life    = s_carve(&next, p->cap);
+	p->tile    = s_carve(&next, p->cap);
+	p->visible = s_carve(&next, p->cap);
+
+	for (i = 0; i < p->cap; i++)
+		p->life[i] = FLT_MAX;
+	return p;
+}
+
+void
+particles_free(struct particles *p)
+{
+	if (!p) return;
+	release(p->block);
+	arena_free(p->arena);
+	release(p);
+}
+
+/* start a particle at (x,y), in world pixels, moving at
+   (dx,dy) pixels a second, for life seconds */
+int
+particles_emit(struct particles *p, float x, float y, float dx, float dy, float life, int tile)
+{
+	int i;
+
+	if (p->n == p->cap)
+		return -1;
+
+	i = p->n++;
+	p->x[i]    = x;
+	p->y[i]    = y;
+	p->dx[i]   = dx;
+	p->dy[i]   = dy;
+	p->life[i] = life;
+	p->tile[i] = tile;
+	return 0;
+}
+
+/* move everything on by dt seconds, and drop the dead */
+void
+particles_update(struct particles *p, float dt)
+{
+	v4sf *x, *y, *dx, *dy, *life;
+	v4sf t, g;
+	v4si dead;
+	int i, k, n, any;
+
+	x    = (v4sf *)p->x;
+	y    = (v4sf *)p->y;
+	dx   = (v4sf *)p->dx;
+	dy   = (v4sf *)p->dy;
+	life = (v4sf *)p->life;
+
+	t = (v4sf){ dt, dt, dt, dt };
+	g = t * p->gravity;
+	dead = (v4si){ 0, 0, 0, 0 };
+
+	n = (p->n + PARTICLE_LANES - 1) / PARTICLE_LANES;
+	for (i = 0; i < n; i++) {
+		x[i]    += dx[i] * t;
+		y[i]    += dy[i] * t;
+		dy[i]   += g;
+		life[i] -= t;
+		dead    |= life[i] <= 0;
+	}
+
+	any = 0;
+	for (i = 0; i < PARTICLE_LANES; i++)
+		any |= dead[i];
+	if (!any)
+		return;
+
+	for (i = k = 0; i < p->n; i++) {
+		p->x[k]    = p->x[i];
+		p->y[k]    = p->y[i];
+		p->dx[k]   = p->dx[i];
+		p->dy[k]   = p->dy[i];
+		p->life[k] = p->life[i];
+		p->tile[k] = p->tile[i];
+		k += p->life[i] > 0;
+	}
+	for (i = k; i < p->n; i++)
+		p->life[i] = FLT_MAX;
+	p->n = k;
+}
+
+/* draw the particles in view, through the world's own tile
+   drawing; returns how many that was */
+int
+particles_draw(struct particles *p, struct world *world)
+{
+	float x0, y0, x1, y1;
+	int i, n, v;
+
+	/* anything overlapping the viewport at all */
+	x0 = world->viewport.at.x - p->tiles->tile.width  * world->scale;
+	y0 = world->viewport.at.y - p->tiles->tile.height * world->scale;
+	x1 = world->viewport.at.x + world->viewport.width;
+	y1 = world->viewport.at.y + world->viewport.height;
+
+	for (i = n = 0; i < p->n; i++) {
+		p->visible[n] = i;
+		n += (p->x[i] > x0) & (p->x[i] < x1)
+		   & (p->y[i] > y0) & (p->y[i] < y1);
+	}
+
+	for (i = 0; i < n; i++) {
+		v = p->visible[i];
+		world_draw(world, p->tiles, p->tile[v],
+		           (int)p->x[v] - world->viewport.at.x,
+		           (int)p->y[v] - world->viewport.at.y);
+	}
+	return n;
+}
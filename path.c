@@ -0,0 +1,701 @@
+#include "prisma.h"
+
+/* hierarchical pathfinding (HPA*, Botea et al.)
+
+   the map is carved into PATH_CLUSTER x PATH_CLUSTER clusters.
+   wherever two neighbouring clusters share a run of walkable
+   border cells, we place one or two "portals" on each side.
+   each cluster caches the walking distance between every pair
+   of its portals, so a long query becomes a search over a few
+   hundred portals, refined into cells one cluster at a time.
+
+   short queries skip all that and run plain A* on the grid.
+   movement is 4-connected, matching how sprites collide.
+
+   batches run on a worker thread while the game carries on
+   changing the map, so the worker never reads it: it gets
+   its own copy of the solidity bitmap with each batch.  the
+   cluster caches are only rebuilt by the caller, between
+   batches (s_refresh() always follows path_wait()), so the
+   worker has them to itself while it runs. */
+
+#define PATH_CLUSTER     16
+#define PATH_PORTALS     32   /* max portals per cluster */
+#define PATH_SHORT       24   /* below this manhattan distance, use plain A* */
+#define PATH_LONG_RUN     6   /* runs this long get a portal at each end */
+#define PATH_UNREACHABLE 0xffff
+
+struct cluster {
+	int x, y, w, h;  /* bounds, in cells */
+	int dirty;
+
+	int n;
+	struct coords portal[PATH_PORTALS];
+	unsigned short dist[PATH_PORTALS][PATH_PORTALS];
+};
+
+struct hnode {
+	int f, g, id;
+};
+
+/* per-thread scratch space for one search; stamp[] lets us
+   skip clearing g[] and parent[] between searches. */
+struct search {
+	const uint32_t *solid;  /* the walls, as this search sees them */
+
+	int  n;
+	int  gen;
+	int *stamp;
+	int *g;
+	int *parent;
+
+	int           len, cap;
+	struct hnode *heap;
+};
+
+struct pathfinder {
+	struct map *map;
+	int watch;   /* our cursor into the map's journal */
+
+	int cw, ch;  /* clusters across, clusters down */
+	struct cluster *clusters;
+
+	int  ndirty;
+	int *dirty;
+
+	struct search lo[2], hi[2];  /* [0] for the caller, [1] for the worker */
+	uint32_t     *solid;         /* the worker's copy of map->solid */
+
+	SDL_Thread *worker;
+	SDL_mutex  *lock;
+	SDL_cond   *wake;
+	SDL_cond   *idle;
+	int         quit;
+	int         busy;
+
+	struct pathquery *batch;
+	int               nbatch;
+};
+
+#define s_index(pf,x,y)  ((pf)->map->height * (x) + (y))
+#define s_words(map)     (((map)->width * (map)->height + 31) / 32)
+#define s_cluster(pf,x,y) \
+	(&(pf)->clusters[((y) / PATH_CLUSTER) * (pf)->cw + ((x) / PATH_CLUSTER)])
+
+static const int DX[4] = { 0, 1, 0, -1 };
+static const int DY[4] = { -1, 0, 1, 0 };
+
+
+static inline int
+s_open(struct pathfinder *pf, const uint32_t *solid, int x, int y)
+{
+	int i;
+
+	if (x < 0 || x >= pf->map->width || y < 0 || y >= pf->map->height)
+		return 0;
+	i = s_index(pf, x, y);
+	return !((solid[i / 32] >> (i % 32)) & 1);
+}
+
+static void
+s_search_init(struct search *s, const uint32_t *solid, int n)
+{
+	s->solid  = solid;
+	s->n      = n;
+	s->gen    = 0;
+	s->stamp  = tallocate(MEM_NAV, n, sizeof(int));
+	s->g      = tallocate(MEM_NAV, n, sizeof(int));
+	s->parent = tallocate(MEM_NAV, n, sizeof(int));
+	s->len    = 0;
+	s->cap    = 256;
+	s->heap   = tallocate(MEM_NAV, s->cap, sizeof(struct hnode));
+}
+
+static void
+s_search_free(struct search *s)
+{
+	release(s->stamp);
+	release(s->g);
+	release(s->parent);
+	release(s->heap);
+}
+
+static void
+s_search_reset(struct search *s)
+{
+	s->len = 0;
+	if (++s->gen == 0) { /* wrapped; stamps are stale */
+		memset(s->stamp, 0, s->n * sizeof(int));
+		s->gen = 1;
+	}
+}
+
+static void
+s_push(struct search *s, int id, int g, int f)
+{
+	struct hnode n;
+	int i, up;
+
+	if (s->len == s->cap) {
+		s->cap *= 2;
+		s->heap = reallocate(MEM_NAV, s->heap, s->cap, sizeof(struct hnode));
+	}
+
+	n.f = f; n.g = g; n.id = id;
+	for (i = s->len++; i > 0; i = up) {
+		up = (i - 1) / 2;
+		if (s->heap[up].f < f || (s->heap[up].f == f && s->heap[up].g >= g))
+			break;
+		s->heap[i] = s->heap[up];
+	}
+	s->heap[i] = n;
+}
+
+static struct hnode
+s_pop(struct search *s)
+{
+	struct hnode top, last;
+	int i, c;
+
+	top  = s->heap[0];
+	last = s->heap[--s->len];
+	for (i = 0; (c = 2 * i + 1) < s->len; i = c) {
+		if (c + 1 < s->len && (s->heap[c+1].f < s->heap[c].f
+		                   || (s->heap[c+1].f == s->heap[c].f && s->heap[c+1].g > s->heap[c].g)))
+			c++;
+		if (last.f < s->heap[c].f || (last.f == s->heap[c].f && last.g >= s->heap[c].g))
+			break;
+		s->heap[i] = s->heap[c];
+	}
+	s->heap[i] = last;
+	return top;
+}
+
+/* visit (id) with cost (g) from (parent), if that improves on
+   anything seen so far this search. */
+static inline int
+s_relax(struct search *s, int id, int g, int parent)
+{
+	if (s->stamp[id] == s->gen && s->g[id] <= g)
+		return 0;
+	s->stamp[id]  = s->gen;
+	s->g[id]      = g;
+	s->parent[id] = parent;
+	return 1;
+}
+
+static void
+s_append(struct path *p, int x, int y)
+{
+	if (p->len > 0 && p->steps[p->len-1].x == x && p->steps[p->len-1].y == y)
+		return;
+
+	if (p->len == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 64;
+		p->steps = reallocate(MEM_NAV, p->steps, p->cap, sizeof(struct coords));
+	}
+	p->steps[p->len].x = x;
+	p->steps[p->len].y = y;
+	p->len++;
+}
+
+/* grid A* from (sx,sy) to (gx,gy), staying inside the bounds
+   [x0,x1) x [y0,y1); appends the cells walked to (out). */
+static int
+s_astar(struct pathfinder *pf, struct search *s,
+        int sx, int sy, int gx, int gy,
+        int x0, int y0, int x1, int y1,
+        struct path *out)
+{
+	struct hnode n;
+	int i, x, y, nx, ny, id, goal, from, len;
+
+	s_search_reset(s);
+	goal = s_index(pf, gx, gy);
+	id   = s_index(pf, sx, sy);
+	s_relax(s, id, 0, -1);
+	s_push(s, id, 0, abs(gx - sx) + abs(gy - sy));
+
+	while (s->len > 0) {
+		n = s_pop(s);
+		if (n.g > s->g[n.id]) continue; /* stale */
+		if (n.id == goal) break;
+
+		x = n.id / pf->map->height;
+		y = n.id % pf->map->height;
+		for (i = 0; i < 4; i++) {
+			nx = x + DX[i];
+			ny = y + DY[i];
+			if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1 || !s_open(pf, s->solid, nx, ny))
+				continue;
+			id = s_index(pf, nx, ny);
+			if (s_relax(s, id, n.g + 1, n.id))
+				s_push(s, id, n.g + 1, n.g + 1 + abs(gx - nx) + abs(gy - ny));
+		}
+	}
+
+	if (s->stamp[goal] != s->gen)
+		return 0;
+
+	/* walk the parents back, then emit them forwards */
+	len = s->g[goal] + 1;
+	if (out->cap < out->len + len) {
+		out->cap = out->len + len;
+		out->steps = reallocate(MEM_NAV, out->steps, out->cap, sizeof(struct coords));
+	}
+	if (out->len > 0 && out->steps[out->len-1].x == sx && out->steps[out->len-1].y == sy)
+		out->len--; /* the junction cell is emitted again below */
+	for (i = len - 1, from = goal; from >= 0; from = s->parent[from], i--) {
+		out->steps[out->len + i].x = from / pf->map->height;
+		out->steps[out->len + i].y = from % pf->map->height;
+	}
+	out->len += len;
+	return 1;
+}
+
+/* breadth-first walk of a cluster from (sx,sy), leaving the
+   distance to every cell of the cluster in (dist). */
+static void
+s_flood(struct pathfinder *pf, const uint32_t *solid, struct cluster *c, int sx, int sy,
+        unsigned short dist[PATH_CLUSTER * PATH_CLUSTER])
+{
+	short queue[PATH_CLUSTER * PATH_CLUSTER];
+	int head, tail, i, x, y, nx, ny, cell;
+
+	for (i = 0; i < c->w * c->h; i++)
+		dist[i] = PATH_UNREACHABLE;
+
+	head = tail = 0;
+	cell = (sy - c->y) * c->w + (sx - c->x);
+	dist[cell] = 0;
+	queue[tail++] = cell;
+
+	while (head < tail) {
+		cell = queue[head++];
+		x = c->x + cell % c->w;
+		y = c->y + cell / c->w;
+		for (i = 0; i < 4; i++) {
+			nx = x + DX[i];
+			ny = y + DY[i];
+			if (nx < c->x || nx >= c->x + c->w || ny < c->y || ny >= c->y + c->h)
+				continue;
+			if (!s_open(pf, solid, nx, ny))
+				continue;
+			if (dist[(ny - c->y) * c->w + (nx - c->x)] != PATH_UNREACHABLE)
+				continue;
+			dist[(ny - c->y) * c->w + (nx - c->x)] = dist[cell] + 1;
+			queue[tail++] = (ny - c->y) * c->w + (nx - c->x);
+		}
+	}
+}
+
+static void
+s_portal(struct cluster *c, int x, int y)
+{
+	int i;
+
+	for (i = 0; i < c->n; i++)
+		if (c->portal[i].x == x && c->portal[i].y == y)
+			return; /* corner cell shared by two borders */
+
+	assert(c->n < PATH_PORTALS);
+	c->portal[c->n].x = x;
+	c->portal[c->n].y = y;
+	c->n++;
+}
+
+/* find the walkable runs along one border of a cluster,
+   where (x,y) walks the inside edge by (sx,sy) for (len)
+   cells, and (ox,oy) is the offset to the cell outside. */
+static void
+s_border(struct pathfinder *pf, struct cluster *c,
+         int x, int y, int sx, int sy, int len, int ox, int oy)
+{
+	int i, run;
+
+	if (x + ox < 0 || x + ox >= pf->map->width
+	 || y + oy < 0 || y + oy >= pf->map->height)
+		return;
+
+	for (run = 0, i = 0; i <= len; i++, x += sx, y += sy) {
+		if (i < len && s_open(pf, pf->map->solid, x, y) && s_open(pf, pf->map->solid, x + ox, y + oy)) {
+			run++;
+			continue;
+		}
+		if (run >= PATH_LONG_RUN) {
+			s_portal(c, x - sx * run,   y - sy * run);
+			s_portal(c, x - sx,         y - sy);
+		} else if (run > 0) {
+			s_portal(c, x - sx * (run / 2 + 1), y - sy * (run / 2 + 1));
+		}
+		run = 0;
+	}
+}
+
+static void
+s_rebuild(struct pathfinder *pf, struct cluster *c)
+{
+	unsigned short dist[PATH_CLUSTER * PATH_CLUSTER];
+	int i, j;
+
+	c->n = 0;
+	s_border(pf, c, c->x,            c->y,            1, 0, c->w,  0, -1); /* top */
+	s_border(pf, c, c->x,            c->y + c->h - 1, 1, 0, c->w,  0,  1); /* bottom */
+	s_border(pf, c, c->x,            c->y,            0, 1, c->h, -1,  0); /* left */
+	s_border(pf, c, c->x + c->w - 1, c->y,            0, 1, c->h,  1,  0); /* right */
+
+	for (i = 0; i < c->n; i++) {
+		s_flood(pf, pf->map->solid, c, c->portal[i].x, c->portal[i].y, dist);
+		for (j = 0; j < c->n; j++)
+			c->dist[i][j] = dist[(c->portal[j].y - c->y) * c->w + (c->portal[j].x - c->x)];
+	}
+	c->dirty = 0;
+}
+
+static void
+s_dirty(struct pathfinder *pf, int x, int y)
+{
+	struct cluster *c;
+
+	if (x < 0 || x >= pf->map->width || y < 0 || y >= pf->map->height)
+		return;
+
+	c = s_cluster(pf, x, y);
+	if (c->dirty) return;
+	c->dirty = 1;
+	pf->dirty[pf->ndirty++] = c - pf->clusters;
+}
+
+static void
+s_refresh(struct pathfinder *pf)
+{
+	const struct mapchange *c;
+	int i, n;
+
+	n = map_changes(pf->map, pf->watch, &c);
+	for (i = 0; i < n; i++)
+		if (c[i].solid)
+			path_invalidate(pf, c[i].x, c[i].y);
+
+	while (pf->ndirty > 0)
+		s_rebuild(pf, &pf->clusters[pf->dirty[--pf->ndirty]]);
+}
+
+/* the portal across the border from portal (i) of cluster
+   (c), in direction (d), as an abstract node id; or -1. */
+static int
+s_across(struct pathfinder *pf, struct cluster *c, int i, int d)
+{
+	struct cluster *o;
+	int x, y, j;
+
+	x = c->portal[i].x + DX[d];
+	y = c->portal[i].y + DY[d];
+	if (x < 0 || x >= pf->map->width || y < 0 || y >= pf->map->height)
+		return -1;
+
+	o = s_cluster(pf, x, y);
+	if (o == c) return -1;
+
+	for (j = 0; j < o->n; j++)
+		if (o->portal[j].x == x && o->portal[j].y == y)
+			return (o - pf->clusters) * PATH_PORTALS + j;
+	return -1;
+}
+
+static int
+s_hpa(struct pathfinder *pf, struct search *lo, struct search *hi,
+      int sx, int sy, int gx, int gy, struct path *out)
+{
+	unsigned short sdist[PATH_CLUSTER * PATH_CLUSTER];
+	unsigned short gdist[PATH_CLUSTER * PATH_CLUSTER];
+	struct cluster *sc, *gc, *c;
+	struct hnode n;
+	int S, G, i, j, d, g, id, nodes, ci, pi, *chain, len;
+	struct coords a, b;
+
+	nodes = pf->cw * pf->ch * PATH_PORTALS;
+	S = nodes;
+	G = nodes + 1;
+
+	sc = s_cluster(pf, sx, sy);
+	gc = s_cluster(pf, gx, gy);
+	s_flood(pf, lo->solid, sc, sx, sy, sdist);
+	s_flood(pf, lo->solid, gc, gx, gy, gdist);
+
+#define H(x,y) (abs(gx - (x)) + abs(gy - (y)))
+	s_search_reset(hi);
+	s_relax(hi, S, 0, -1);
+	s_push(hi, S, 0, H(sx, sy));
+
+	while (hi->len > 0) {
+		n = s_pop(hi);
+		if (n.g > hi->g[n.id]) continue;
+		if (n.id == G) break;
+
+		if (n.id == S) {
+			for (j = 0; j < sc->n; j++) {
+				d = sdist[(sc->portal[j].y - sc->y) * sc->w + (sc->portal[j].x - sc->x)];
+				if (d == PATH_UNREACHABLE) continue;
+				id = (sc - pf->clusters) * PATH_PORTALS + j;
+				if (s_relax(hi, id, d, S))
+					s_push(hi, id, d, d + H(sc->portal[j].x, sc->portal[j].y));
+			}
+			continue;
+		}
+
+		ci = n.id / PATH_PORTALS;
+		pi = n.id % PATH_PORTALS;
+		c  = &pf->clusters[ci];
+
+		if (c == gc) {
+			d = gdist[(c->portal[pi].y - c->y) * c->w + (c->portal[pi].x - c->x)];
+			if (d != PATH_UNREACHABLE && s_relax(hi, G, n.g + d, n.id))
+				s_push(hi, G, n.g + d, n.g + d);
+		}
+
+		for (j = 0; j < c->n; j++) {
+			if (j == pi || c->dist[pi][j] == PATH_UNREACHABLE) continue;
+			g  = n.g + c->dist[pi][j];
+			id = ci * PATH_PORTALS + j;
+			if (s_relax(hi, id, g, n.id))
+				s_push(hi, id, g, g + H(c->portal[j].x, c->portal[j].y));
+		}
+
+		for (d = 0; d < 4; d++) {
+			id = s_across(pf, c, pi, d);
+			if (id < 0) continue;
+			if (s_relax(hi, id, n.g + 1, n.id))
+				s_push(hi, id, n.g + 1, n.g + 1 + H(c->portal[pi].x + DX[d], c->portal[pi].y + DY[d]));
+		}
+	}
+#undef H
+
+	if (hi->stamp[G] != hi->gen)
+		return 0;
+
+	/* unwind the abstract path, then refine each leg */
+	for (len = 0, id = G; id >= 0; id = hi->parent[id])
+		len++;
+	chain = tallocate(MEM_NAV, len, sizeof(int));
+	for (i = len - 1, id = G; id >= 0; id = hi->parent[id], i--)
+		chain[i] = id;
+
+	a.x = sx; a.y = sy;
+	s_append(out, sx, sy);
+	for (i = 1; i < len; i++) {
+		if (chain[i] == G) {
+			b.x = gx; b.y = gy;
+		} else {
+			b = pf->clusters[chain[i] / PATH_PORTALS].portal[chain[i] % PATH_PORTALS];
+		}
+
+		c = s_cluster(pf, a.x, a.y);
+		if (c == s_cluster(pf, b.x, b.y)) {
+			if (!s_astar(pf, lo, a.x, a.y, b.x, b.y, c->x, c->y, c->x + c->w, c->y + c->h, out)) {
+				release(chain);
+				return 0; /* cluster changed under us */
+			}
+		} else {
+			s_append(out, b.x, b.y); /* stepping across a border */
+		}
+		a = b;
+	}
+
+	release(chain);
+	return 1;
+}
+
+static int
+s_find(struct pathfinder *pf, struct search *lo, struct search *hi,
+       struct coords from, struct coords to, struct path *out)
+{
+	int x0, y0, x1, y1;
+
+	out->len = 0;
+	if (!s_open(pf, lo->solid, from.x, from.y) || !s_open(pf, lo->solid, to.x, to.y))
+		return 0;
+
+	if (abs(to.x - from.x) + abs(to.y - from.y) < PATH_SHORT
+	 || s_cluster(pf, from.x, from.y) == s_cluster(pf, to.x, to.y)) {
+		/* try a bounded search first; short hops
+		   rarely need to wander far afield. */
+		x0 = bounded(0, (from.x < to.x ? from.x : to.x) - PATH_CLUSTER, pf->map->width);
+		y0 = bounded(0, (from.y < to.y ? from.y : to.y) - PATH_CLUSTER, pf->map->height);
+		x1 = bounded(0, (from.x > to.x ? from.x : to.x) + PATH_CLUSTER + 1, pf->map->width);
+		y1 = bounded(0, (from.y > to.y ? from.y : to.y) + PATH_CLUSTER + 1, pf->map->height);
+		if (s_astar(pf, lo, from.x, from.y, to.x, to.y, x0, y0, x1, y1, out))
+			return 1;
+		out->len = 0;
+	}
+
+	return s_hpa(pf, lo, hi, from.x, from.y, to.x, to.y, out);
+}
+
+static int
+s_worker(void *data)
+{
+	struct pathfinder *pf = data;
+	struct pathquery *q;
+	int i, n;
+
+	SDL_LockMutex(pf->lock);
+	for (;;) {
+		while (!pf->quit && !pf->batch)
+			SDL_CondWait(pf->wake, pf->lock);
+		if (pf->quit) break;
+
+		q = pf->batch;
+		n = pf->nbatch;
+		SDL_UnlockMutex(pf->lock);
+
+		for (i = 0; i < n; i++)
+			q[i].status = s_find(pf, &pf->lo[1], &pf->hi[1], q[i].from, q[i].to, &q[i].path)
+			            ? PATH_FOUND : PATH_NONE;
+
+		SDL_LockMutex(pf->lock);
+		pf->batch = NULL;
+		pf->busy  = 0;
+		SDL_CondBroadcast(pf->idle);
+	}
+	SDL_UnlockMutex(pf->lock);
+	return 0;
+}
+
+struct pathfinder *
+path_new(struct map *map)
+{
+	struct pathfinder *pf;
+	struct cluster *c;
+	int x, y;
+
+	assert(map != NULL);
+
+	pf = tallocate(MEM_NAV, 1, sizeof(struct pathfinder));
+	pf->map = map;
+	pf->watch = map_watch(map);
+	pf->cw  = (map->width  + PATH_CLUSTER - 1) / PATH_CLUSTER;
+	pf->ch  = (map->height + PATH_CLUSTER - 1) / PATH_CLUSTER;
+	pf->clusters = tallocate(MEM_NAV, pf->cw * pf->ch, sizeof(struct cluster));
+	pf->dirty    = tallocate(MEM_NAV, pf->cw * pf->ch, sizeof(int));
+
+	for (y = 0; y < pf->ch; y++) {
+		for (x = 0; x < pf->cw; x++) {
+			c = &pf->clusters[y * pf->cw + x];
+			c->x = x * PATH_CLUSTER;
+			c->y = y * PATH_CLUSTER;
+			c->w = map->width  - c->x < PATH_CLUSTER ? map->width  - c->x : PATH_CLUSTER;
+			c->h = map->height - c->y < PATH_CLUSTER ? map->height - c->y : PATH_CLUSTER;
+			s_rebuild(pf, c);
+		}
+	}
+
+	pf->solid = tallocate(MEM_NAV, s_words(map), sizeof(uint32_t));
+	s_search_init(&pf->lo[0], map->solid, map->width * map->height);
+	s_search_init(&pf->lo[1], pf->solid,  map->width * map->height);
+	s_search_init(&pf->hi[0], map->solid, pf->cw * pf->ch * PATH_PORTALS + 2);
+	s_search_init(&pf->hi[1], pf->solid,  pf->cw * pf->ch * PATH_PORTALS + 2);
+
+	pf->lock = SDL_CreateMutex();
+	pf->wake = SDL_CreateCond();
+	pf->idle = SDL_CreateCond();
+	pf->worker = SDL_CreateThread(s_worker, "pathfinder", pf);
+	if (!pf->lock || !pf->wake || !pf->idle || !pf->worker) {
+		fprintf(stderr, "failed to start pathfinding worker: %s\n", SDL_GetError());
+		exit(EXIT_INIT_FAILED);
+	}
+	return pf;
+}
+
+void
+path_free(struct pathfinder *pf)
+{
+	int i;
+
+	if (!pf) return;
+
+	SDL_LockMutex(pf->lock);
+	pf->quit = 1;
+	SDL_CondBroadcast(pf->wake);
+	SDL_UnlockMutex(pf->lock);
+	SDL_WaitThread(pf->worker, NULL);
+
+	SDL_DestroyCond(pf->wake);
+	SDL_DestroyCond(pf->idle);
+	SDL_DestroyMutex(pf->lock);
+
+	for (i = 0; i < 2; i++) {
+		s_search_free(&pf->lo[i]);
+		s_search_free(&pf->hi[i]);
+	}
+	map_unwatch(pf->map, pf->watch);
+	release(pf->clusters);
+	release(pf->dirty);
+	release(pf->solid);
+	release(pf);
+}
+
+void
+path_invalidate(struct pathfinder *pf, int x, int y)
+{
+	int cx, cy;
+
+	/* a cell on a cluster's edge also decides the portals
+	   of the cluster across that edge. */
+	s_dirty(pf, x, y);
+	cx = x % PATH_CLUSTER;
+	cy = y % PATH_CLUSTER;
+	if (cx == 0)                s_dirty(pf, x - 1, y);
+	if (cx == PATH_CLUSTER - 1) s_dirty(pf, x + 1, y);
+	if (cy == 0)                s_dirty(pf, x, y - 1);
+	if (cy == PATH_CLUSTER - 1) s_dirty(pf, x, y + 1);
+}
+
+int
+path_find(struct pathfinder *pf, struct coords from, struct coords to, struct path *out)
+{
+	path_wait(pf);
+	s_refresh(pf);
+	return s_find(pf, &pf->lo[0], &pf->hi[0], from, to, out);
+}
+
+void
+path_batch(struct pathfinder *pf, struct pathquery *q, int n)
+{
+	int i;
+
+	/* the worker only wakes for a batch; with nothing in
+	   it, busy would never be cleared */
+	if (n <= 0)
+		return;
+
+	path_wait(pf);
+	s_refresh(pf);
+	memcpy(pf->solid, pf->map->solid, s_words(pf->map) * sizeof(uint32_t));
+	for (i = 0; i < n; i++)
+		q[i].status = PATH_PENDING;
+
+	SDL_LockMutex(pf->lock);
+	pf->batch  = q;
+	pf->nbatch = n;
+	pf->busy   = 1;
+	SDL_CondSignal(pf->wake);
+	SDL_UnlockMutex(pf->lock);
+}
+
+void
+path_wait(struct pathfinder *pf)
+{
+	SDL_LockMutex(pf->lock);
+	while (pf->busy)
+		SDL_CondWait(pf->idle, pf->lock);
+	SDL_UnlockMutex(pf->lock);
+}
+
+void
+path_release(struct path *p)
+{
+	release(p->steps);
+	p->steps = NULL;
+	p->len = p->cap = 0;
+}
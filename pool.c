@@ -0,0 +1,251 @@
+#include "prisma.h"
+
+/* a work-stealing thread pool.
+
+   every worker (and the thread calling pool_wait(), which
+   pitches in as worker 0) has its own deque of tasks.  a
+   worker takes from the back of its own deque, where the
+   tasks are hottest; once that is empty, it steals from the
+   front of someone else's, so a worker that drew the short
+   straw of cheap tasks helps out with the expensive ones,
+   rather than sitting idle.
+
+   the deques are each behind their own spinlock; only the
+   owner and the odd thief ever contend for one.  tasks are
+   meant to be coarse (a batch of worlds for a whole run,
+   say), so sleeping and waking go through a plain mutex
+   and condition variables. */
+
+struct task {
+	void (*fn)(void *);
+	void  *data;
+};
+
+struct deque {
+	SDL_SpinLock lock;
+	int head, tail;    /* steal from head, pop from tail */
+	int cap;
+	struct task *tasks;
+};
+
+struct pool {
+	int n;             /* deques, including the caller's */
+	struct deque *q;
+	SDL_Thread  **threads;
+	int next;          /* where pool_submit() puts the next task */
+
+	SDL_mutex *lock;
+	SDL_cond  *work;   /* tasks were queued, or it's time to quit */
+	SDL_cond  *idle;   /* the last task finished */
+	int queued;        /* in a deque */
+	int pending;       /* queued or running */
+	int quit;
+
+	SDL_atomic_t steals;
+};
+
+struct worker {
+	struct pool *pool;
+	int id;
+};
+
+static int
+s_pop(struct deque *d, struct task *t)
+{
+	int ok;
+
+	SDL_AtomicLock(&d->lock);
+	ok = d->tail > d->head;
+	if (ok) *t = d->tasks[--d->tail];
+	SDL_AtomicUnlock(&d->lock);
+	return ok;
+}
+
+static int
+s_steal(struct deque *d, struct task *t)
+{
+	int ok;
+
+	SDL_AtomicLock(&d->lock);
+	ok = d->tail > d->head;
+	if (ok) *t = d->tasks[d->head++];
+	SDL_AtomicUnlock(&d->lock);
+	return ok;
+}
+
+static int
+s_take(struct pool *p, int me, struct task *t)
+{
+	int i;
+
+	if (s_pop(&p->q[me], t))
+		goto took;
+	for (i = 1; i < p->n; i++) {
+		if (s_steal(&p->q[(me + i) % p->n], t)) {
+			SDL_AtomicAdd(&p->steals, 1);
+			goto took;
+		}
+	}
+	return 0;
+
+took:
+	SDL_LockMutex(p->lock);
+	p->queued--;
+	SDL_UnlockMutex(p->lock);
+	return 1;
+}
+
+static void
+s_done(struct pool *p)
+{
+	SDL_LockMutex(p->lock);
+	if (--p->pending == 0)
+		SDL_CondBroadcast(p->idle);
+	SDL_UnlockMutex(p->lock);
+}
+
+static int
+s_worker(void *data)
+{
+	struct worker *w = data;
+	struct pool *p = w->pool;
+	struct task t;
+	int id = w->id;
+
+	release(w);
+	for (;;) {
+		if (s_take(p, id, &t)) {
+			t.fn(t.data);
+			s_done(p);
+			continue;
+		}
+
+		SDL_LockMutex(p->lock);
+		while (!p->quit && p->queued == 0)
+			SDL_CondWait(p->work, p->lock);
+		if (p->quit) {
+			SDL_UnlockMutex(p->lock);
+			return 0;
+		}
+		SDL_UnlockMutex(p->lock);
+	}
+}
+
+struct pool *
+pool_new(int threads)
+{
+	struct worker *w;
+	struct pool *p;
+	int i;
+
+	assert(threads >= 0);
+
+	p = tallocate(MEM_MISC, 1, sizeof(struct pool));
+	p->n       = threads + 1;
+	p->q       = tallocate(MEM_MISC, p->n, sizeof(struct deque));
+	p->threads = tallocate(MEM_MISC, p->n, sizeof(SDL_Thread *));
+	p->lock    = SDL_CreateMutex();
+	p->work    = SDL_CreateCond();
+	p->idle    = SDL_CreateCond();
+	if (!p->lock || !p->work || !p->idle) {
+		fprintf(stderr, "failed to set up thread pool: %s\n", SDL_GetError());
+		exit(EXIT_INT_FAILURE);
+	}
+
+	for (i = 1; i < p->n; i++) {
+		w = tallocate(MEM_MISC, 1, sizeof(struct worker));
+		w->pool = p;
+		w->id   = i;
+		p->threads[i] = SDL_CreateThread(s_worker, "pool", w);
+		if (!p->threads[i]) {
+			fprintf(stderr, "failed to start pool worker: %s\n", SDL_GetError());
+			exit(EXIT_INT_FAILURE);
+		}
+	}
+	return p;
+}
+
+void
+pool_free(struct pool *p)
+{
+	int i;
+
+	if (!p) return;
+
+	SDL_LockMutex(p->lock);
+	p->quit = 1;
+	SDL_CondBroadcast(p->work);
+	SDL_UnlockMutex(p->lock);
+	for (i = 1; i < p->n; i++)
+		SDL_WaitThread(p->threads[i], NULL);
+
+	for (i = 0; i < p->n; i++)
+		release(p->q[i].tasks);
+	SDL_DestroyCond(p->idle);
+	SDL_DestroyCond(p->work);
+	SDL_DestroyMutex(p->lock);
+	release(p->threads);
+	release(p->q);
+	release(p);
+}
+
+/* queue fn(data), dealing tasks out to the deques in turn */
+void
+pool_submit(struct pool *p, void (*fn)(void *), void *data)
+{
+	struct deque *d;
+
+	d = &p->q[p->next];
+	p->next = (p->next + 1) % p->n;
+
+	SDL_AtomicLock(&d->lock);
+	if (d->head > 0 && d->tail == d->cap) {
+		memmove(d->tasks, d->tasks + d->head, (d->tail - d->head) * sizeof(struct task));
+		d->tail -= d->head;
+		d->head  = 0;
+	}
+	if (d->tail == d->cap) {
+		d->cap   = d->cap ? d->cap * 2 : 64;
+		d->tasks = reallocate(MEM_MISC, d->tasks, d->cap, sizeof(struct task));
+	}
+	d->tasks[d->tail].fn   = fn;
+	d->tasks[d->tail].data = data;
+	d->tail++;
+	SDL_AtomicUnlock(&d->lock);
+
+	SDL_LockMutex(p->lock);
+	p->queued++;
+	p->pending++;
+	SDL_CondSignal(p->work);
+	SDL_UnlockMutex(p->lock);
+}
+
+/* run tasks alongside the workers until all are done */
+void
+pool_wait(struct pool *p)
+{
+	struct task t;
+
+	for (;;) {
+		if (s_take(p, 0, &t)) {
+			t.fn(t.data);
+			s_done(p);
+			continue;
+		}
+
+		SDL_LockMutex(p->lock);
+		while (p->pending > 0 && p->queued == 0)
+			SDL_CondWait(p->idle, p->lock);
+		if (p->pending == 0) {
+			SDL_UnlockMutex(p->lock);
+			return;
+		}
+		SDL_UnlockMutex(p->lock);
+	}
+}
+
+int
+pool_steals(struct pool *p)
+{
+	return SDL_AtomicGet(&p->steals);
+}
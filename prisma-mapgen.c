@@ -0,0 +1,59 @@
+#include "prisma.h"
+
+/* synthetic map generator.
+
+   USAGE: prisma-mapgen [-w WIDTH] [-h HEIGHT] [-d DENSITY] [-r RAGGED]
+                        [-o OBJECTS] [-n NPCS] [-s SEED] PATH
+
+   writes PATH and PATH.mf, a map of WIDTH x HEIGHT cells (see
+   mapgen.c for what goes in it), for loading like any other:
+   `bench parse', prisma-sim -m PATH, or as a starting point
+   for the parser's fuzzing corpus. */
+
+int main(int argc, char **argv)
+{
+	struct mapgen g;
+	const char *path = NULL;
+	int i;
+
+	g.width   = 256;
+	g.height  = 256;
+	g.density = 20;
+	g.ragged  = 0;
+	g.objects = 1000;
+	g.npcs    = 16;
+	g.seed    = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			g.width = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+			g.height = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			g.density = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			g.ragged = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			g.objects = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			g.npcs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			g.seed = strtoul(argv[++i], NULL, 10);
+		} else if (!path && argv[i][0] != '-') {
+			path = argv[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	if (!path) {
+		fprintf(stderr, "USAGE: %s [-w WIDTH] [-h HEIGHT] [-d DENSITY] [-r RAGGED] [-o OBJECTS] [-n NPCS] [-s SEED] PATH\n", argv[0]);
+		return 1;
+	}
+	if (g.width < 1 || g.height < 1 || g.objects < 0 || g.npcs < 0) {
+		fprintf(stderr, "%s: need a map of at least one cell, and no fewer than no objects or npcs\n", argv[0]);
+		return 1;
+	}
+
+	return mapgen_write(&g, path) == 0 ? 0 : 1;
+}
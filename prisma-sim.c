@@ -0,0 +1,240 @@
+#include "prisma.h"
+#include <unistd.h>
+
+/* headless batch simulation.
+
+   USAGE: prisma-sim [-j THREADS] [-n WORLDS] [-t TICKS] [-b BATCH]
+                     [-m MAP] [-s SCRIPT]
+
+   runs WORLDS independent worlds for TICKS ticks each, with no
+   window, sharing one copy of the map and the hero's tileset.
+   worlds are handed out in batches of BATCH to a work-stealing
+   pool of THREADS workers (plus the main thread).
+
+   each hero is steered by SCRIPT, a file of lines like
+
+       30 r      walk right for 30 ticks
+       12 ul     up and to the left, for 12
+       5 -       stand still for 5
+
+   played in a loop, starting a little further along for each
+   world.  with no script, each hero wanders at random, seeded
+   by its world number.  either way a run is deterministic, and
+   the checksum of where every hero ended up is the same for
+   any number of threads, or size of batch. */
+
+#define SIM_TICK   (16 * NSEC_PER_MSEC)  /* as prisma's main loop */
+#define SIM_STEPS  256                   /* in a script */
+
+struct step {
+	int ticks;
+	int left, right, up, down;
+};
+
+struct script {
+	int         n, length;   /* steps, and total ticks */
+	struct step steps[SIM_STEPS];
+};
+
+struct batch {
+	struct world  **worlds;
+	int             first, n;
+	int             ticks;
+	struct script  *script;
+	uint64_t        sum;
+};
+
+static int
+s_script(struct script *s, const char *path)
+{
+	char line[256], moves[16];
+	FILE *f;
+	int ticks;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "failed to open script %s: %s (error %d)\n",
+				path, strerror(errno), errno);
+		return -1;
+	}
+
+	memset(s, 0, sizeof(*s));
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%d %15s", &ticks, moves) != 2)
+			continue;
+		if (ticks <= 0 || s->n == SIM_STEPS) {
+			fprintf(stderr, "%s: bad step '%s' (or too many)\n", path, line);
+			fclose(f);
+			return -1;
+		}
+		s->steps[s->n].ticks = ticks;
+		s->steps[s->n].left  = strchr(moves, 'l') != NULL;
+		s->steps[s->n].right = strchr(moves, 'r') != NULL;
+		s->steps[s->n].up    = strchr(moves, 'u') != NULL;
+		s->steps[s->n].down  = strchr(moves, 'd') != NULL;
+		s->length += ticks;
+		s->n++;
+	}
+	fclose(f);
+
+	if (!s->n) {
+		fprintf(stderr, "%s: no steps\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* xorshift32; rand() would be shared between threads */
+static uint32_t
+s_random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* where is the i'th world's script at, on tick t?  (and is
+   that the first tick of the step?) */
+static const struct step *
+s_at(struct script *s, int i, int t, int *fresh)
+{
+	int k;
+
+	t = (t + i * 7) % s->length;
+	for (k = 0; t >= s->steps[k].ticks; k++)
+		t -= s->steps[k].ticks;
+	*fresh = t == 0;
+	return &s->steps[k];
+}
+
+static void
+s_run(void *data)
+{
+	struct batch *b = data;
+	const struct step *st;
+	struct world *w;
+	uint32_t seed, r;
+	int i, t, left, fresh;
+
+	for (i = b->first; i < b->first + b->n; i++) {
+		w = b->worlds[i];
+		seed = 2463534242u + i;
+		left = 0;
+
+		for (t = 0; t < b->ticks; t++) {
+			if (b->script) {
+				st = s_at(b->script, i, t, &fresh);
+				if (fresh || t == 0)
+					sprite_move_all(w->hero, st->left, st->right, st->up, st->down);
+			} else if (left-- == 0) {
+				r = s_random(&seed);
+				sprite_move_all(w->hero, r & 1, r & 2, r & 4, r & 8);
+				left = 8 + (r >> 8) % 32;
+			}
+			world_step(w, SIM_TICK);
+		}
+		b->sum += ((uint64_t)i * 1000003u + 1) * (uint32_t)(w->hero->at.x * 65599 + w->hero->at.y);
+	}
+}
+
+static double
+s_seconds()
+{
+	return clock_monotonic() / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct script script, *sp = NULL;
+	struct tileset *hero;
+	struct world **worlds;
+	struct batch *batches;
+	struct arena *arena;
+	struct map *map;
+	struct pool *pool;
+	const char *mapfile = "maps/base";
+	int threads, n, ticks, size, nbatches, i;
+	double t0, t1;
+	uint64_t sum;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	n       = 1000;
+	ticks   = 1000;
+	size    = 16;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]) - 1;
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			ticks = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			mapfile = argv[++i];
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			if (s_script(&script, argv[++i]) != 0)
+				return 1;
+			sp = &script;
+		} else {
+			fprintf(stderr, "USAGE: %s [-j THREADS] [-n WORLDS] [-t TICKS] [-b BATCH] [-m MAP] [-s SCRIPT]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 0) threads = 0;
+	if (n < 1 || ticks < 0 || size < 1) {
+		fprintf(stderr, "%s: need at least one world, and batches of at least one\n", argv[0]);
+		return 1;
+	}
+
+	/* one copy of everything read-only, for every world */
+	map = map_read(mapfile);
+	if (!map) return 1;
+	arena = arena_new(MEM_TILESET);
+	hero  = tileset_read(arena, "assets/purple-hair-sprite");
+	if (!hero) return 1;
+
+	worlds = allocate(n, sizeof(struct world *));
+	for (i = 0; i < n; i++)
+		worlds[i] = world_headless(map, hero, 1);
+
+	nbatches = (n + size - 1) / size;
+	batches  = allocate(nbatches, sizeof(struct batch));
+	pool     = pool_new(threads);
+
+	t0 = s_seconds();
+	for (i = 0; i < nbatches; i++) {
+		batches[i].worlds = worlds;
+		batches[i].first  = i * size;
+		batches[i].n      = i * size + size > n ? n - i * size : size;
+		batches[i].ticks  = ticks;
+		batches[i].script = sp;
+		pool_submit(pool, s_run, &batches[i]);
+	}
+	pool_wait(pool);
+	t1 = s_seconds();
+
+	sum = 0;
+	for (i = 0; i < nbatches; i++)
+		sum += batches[i].sum;
+
+	fprintf(stderr, "sim: %d worlds x %d ticks, %d threads, batches of %d (%d steals)\n",
+		n, ticks, threads + 1, size, pool_steals(pool));
+	fprintf(stderr, "sim: %.3fs, %.0f ticks/s (%.0f per thread)\n",
+		t1 - t0, (double)n * ticks / (t1 - t0), (double)n * ticks / (t1 - t0) / (threads + 1));
+	printf("%016llx\n", (unsigned long long)sum);
+
+	pool_free(pool);
+	for (i = 0; i < n; i++)
+		world_free(worlds[i]);
+	release(worlds);
+	release(batches);
+	arena_free(arena);
+	map_free(map);
+
+	if (getenv("PRISMA_MEMREPORT"))
+		mem_report(stderr);
+	return 0;
+}
@@ -6,14 +6,19 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <math.h>
 
 #include <SDL.h>
 #include <SDL_image.h>
 
-void init()
+/* startup stages; see startup.c.  video and input stay on
+   the main thread, for SDL's sake, while the map and the
+   hero's tileset load alongside them. */
+static void
+s_init_video(void *unused)
 {
 	int rc;
-	rc = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK);
+	rc = SDL_Init(SDL_INIT_VIDEO);
 	if (rc != 0) {
 		fprintf(stderr, "sdl_init() failed: %s (rc=%d)\n", SDL_GetError(), rc);
 		exit(EXIT_INIT_FAILED);
@@ -24,12 +29,225 @@ void init()
 		fprintf(stderr, "img_init() failed: %s (rc=%d)\n", SDL_GetError(), rc);
 		exit(EXIT_INIT_FAILED);
 	}
+}
+
+static void
+s_init_joystick(void *unused)
+{
+	int rc;
+	rc = SDL_InitSubSystem(SDL_INIT_JOYSTICK);
+	if (rc != 0) {
+		fprintf(stderr, "sdl_init() failed: %s (rc=%d)\n", SDL_GetError(), rc);
+		exit(EXIT_INIT_FAILED);
+	}
 
 	if (SDL_NumJoysticks() > 0) {
 		SDL_JoystickOpen(0);
 	}
 }
 
+/* who's playing, by joystick instance id (or -1, for a free
+   seat); the first joystick steers the same hero as the
+   keyboard, and each after that gets a hero, and a share of
+   the screen, of their own */
+static SDL_JoystickID players[WORLD_VIEWS] = { -1, -1, -1, -1 };
+
+static void
+s_seat(struct world *world)
+{
+	int i, n;
+
+	for (i = n = 0; i < WORLD_VIEWS; i++)
+		if (players[i] != -1) n = i + 1;
+	world_split(world, n ? n : 1);
+}
+
+static void
+s_join(struct world *world, int device)
+{
+	SDL_Joystick *joy;
+	int i;
+
+	joy = SDL_JoystickOpen(device);
+	if (!joy) return;
+	for (i = 0; i < WORLD_VIEWS; i++)
+		if (players[i] == SDL_JoystickInstanceID(joy))
+			return;
+	for (i = 0; i < WORLD_VIEWS; i++) {
+		if (players[i] == -1) {
+			players[i] = SDL_JoystickInstanceID(joy);
+			s_seat(world);
+			return;
+		}
+	}
+}
+
+static void
+s_leave(struct world *world, SDL_JoystickID id)
+{
+	int i;
+
+	for (i = 0; i < WORLD_VIEWS; i++)
+		if (players[i] == id)
+			players[i] = -1;
+	SDL_JoystickClose(SDL_JoystickFromInstanceID(id));
+	s_seat(world);
+}
+
+/* the hero steered by joystick id, if any */
+static struct sprite *
+s_player(struct world *world, SDL_JoystickID id)
+{
+	int i;
+
+	for (i = 0; i < world->nviews; i++)
+		if (players[i] == id)
+			return world->views[i].hero;
+	return NULL;
+}
+
+static struct audio *audio;
+
+/* no sound is no reason not to play */
+static void
+s_init_audio(void *unused)
+{
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		fprintf(stderr, "sdl_init() failed for audio: %s; carrying on without sound\n", SDL_GetError());
+		return;
+	}
+	audio = audio_open(44100, 512);
+}
+
+static void
+s_unveil(void *world)
+{
+	world_unveil(world, "prismatic", 640, 480);
+}
+
+static void
+s_load_map(void *world)
+{
+	world_load_map(world, "maps/base");
+}
+
+static void
+s_load_hero(void *world)
+{
+	world_load_hero(world, "assets/purple-hair-sprite");
+}
+
+static void
+s_load_font(void *world)
+{
+	((struct world *)world)->text = text_new("assets/font");
+}
+
+/* particle effects: the tiles in assets/particles, and how
+   many can be in flight at once */
+#define PARTICLES      16384
+#define PARTICLE_DUST  0
+#define PARTICLE_SPARK 2
+#define PARTICLE_SPELL 6
+
+static void
+s_load_particles(void *world)
+{
+	((struct world *)world)->particles = particles_new("assets/particles", PARTICLES);
+}
+
+static void
+s_finish(void *world)
+{
+	world_finish(world);
+}
+
+/* frames to let caches and lazily-built surfaces settle,
+   before PRISMA_FRAME_ALLOCS starts holding the loop to
+   its allocation budget. */
+#define WARMUP_FRAMES 60
+
+static void
+s_budget(unsigned long frame, int budget)
+{
+	static unsigned long last;
+	unsigned long n;
+
+	n = mem_allocs() - last;
+	last += n;
+	if (frame > WARMUP_FRAMES && n > (unsigned long)budget)
+		fprintf(stderr, "frame %lu: %lu allocations (budget is %d)\n", frame, n, budget);
+}
+
+#define HUD_FRAMES 30
+
+static float
+s_spread(float by)
+{
+	return by * (rand() / (float)RAND_MAX * 2 - 1);
+}
+
+/* a puff of dust at the hero's heels, as it walks */
+static void
+s_dust(struct world *world, struct sprite *hero)
+{
+	float x, y;
+
+	x = hero->at.x + hero->tileset->tile.width  * world->scale / 2;
+	y = hero->at.y + hero->tileset->tile.height * world->scale - 2 * world->scale;
+	particles_emit(world->particles, x + s_spread(4 * world->scale), y,
+		-hero->delta.x * 8 + s_spread(6), -6 + s_spread(4),
+		0.4 + s_spread(0.15), PARTICLE_DUST + rand() % 2);
+}
+
+/* a ring of sparks (and some spell-stuff) from the hero */
+static void
+s_burst(struct world *world, int n)
+{
+	struct sprite *hero = world->hero;
+	float x, y, a, v;
+	int i;
+
+	x = hero->at.x + hero->tileset->tile.width  * world->scale / 2;
+	y = hero->at.y + hero->tileset->tile.height * world->scale / 2;
+	for (i = 0; i < n; i++) {
+		a = s_spread(M_PI);
+		v = 60 * world->scale + s_spread(30 * world->scale);
+		particles_emit(world->particles, x, y, cosf(a) * v, sinf(a) * v,
+			0.8 + s_spread(0.3), (i % 3 ? PARTICLE_SPARK : PARTICLE_SPELL) + rand() % 2);
+	}
+}
+
+/* what the HUD says: frame rate, where the hero is, and how
+   much memory is in use; rewritten every HUD_FRAMES frames */
+static void
+s_hud(struct world *world, unsigned long frame)
+{
+	static uint64_t last;
+	static unsigned long since;
+	struct memstats st;
+	uint64_t now;
+	size_t bytes;
+	int tag;
+
+	if (frame - since < HUD_FRAMES && world->hud[0])
+		return;
+
+	now   = clock_monotonic();
+	bytes = 0;
+	for (tag = 0; tag < MEM_TAGS; tag++) {
+		mem_stats(tag, &st);
+		bytes += st.current;
+	}
+	snprintf(world->hud, WORLD_HUD, "%3.0f FPS  %d,%d  %zuK",
+		last && frame > since ? (frame - since) * 1e9 / (now - last) : 0.0,
+		world->hero->at.x / (world->map->tiles->tile.width  * world->scale),
+		world->hero->at.y / (world->map->tiles->tile.height * world->scale),
+		bytes / 1024);
+	last  = now;
+	since = frame;
+}
+
 void quit()
 {
 	IMG_Quit();
@@ -38,18 +256,52 @@ void quit()
 
 int main(int argc, char **argv)
 {
+	struct startup startup;
+	struct snapshot quick;
+	const char *save;
 	struct world *world;
+	struct sprite *player;
+	struct capture *shots, *recording;
+	struct renderer *renderer;
 	SDL_Event     e;
-	int done;
-
-	init();
+	unsigned long frame;
+	int done, budget, video, window, map, hero, hud, shoot, i;
 
+	startup_begin(&startup);
+	memset(&quick, 0, sizeof(quick));
 	world = world_new(4);
-	world_load(world, "maps/base", "assets/purple-hair-sprite");
-	world_unveil(world, "prismatic", 640, 480);
+	world_begin(world);
+
+	video  = startup_stage(&startup, "video",    s_init_video,    NULL,  STAGE_MAIN, 0);
+	window = startup_stage(&startup, "window",   s_unveil,        world, STAGE_MAIN, 1u << video);
+	         startup_stage(&startup, "joystick", s_init_joystick, NULL,  STAGE_MAIN, 1u << video);
+	         startup_stage(&startup, "audio",    s_init_audio,    NULL,  STAGE_MAIN, 1u << video);
+	map    = startup_stage(&startup, "map",      s_load_map,      world, 0, 0);
+	hero   = startup_stage(&startup, "hero",     s_load_hero,     world, 0, 0);
+	         startup_stage(&startup, "font",     s_load_font,     world, 0, 0);
+	         startup_stage(&startup, "particles", s_load_particles, world, 0, 0);
+	         startup_stage(&startup, "world",    s_finish,        world, STAGE_MAIN,
+	                       1u << window | 1u << map | 1u << hero);
+	startup_run(&startup);
 
-	done = 0;
-	while (!done) {
+	/* PRISMA_FRAME_ALLOCS=0 holds the steady-state loop to
+	   zero allocations per frame; PRISMA_MEMREPORT prints
+	   per-subsystem memory use on the way out (and
+	   PRISMA_AUDIOREPORT, how the mixer kept up), and
+	   PRISMA_TIMELINE how long startup took, by stage. */
+	budget = getenv("PRISMA_FRAME_ALLOCS") ? atoi(getenv("PRISMA_FRAME_ALLOCS")) : -1;
+
+	/* PRISMA_RENDER_THREAD draws on a thread of its own
+	   (and PRISMA_RENDERREPORT says how that went); not
+	   every platform lets a window be drawn to off the main
+	   thread, so it's not the default */
+	renderer = getenv("PRISMA_RENDER_THREAD") ? renderer_new(world) : NULL;
+	save     = getenv("PRISMA_SAVE") ? getenv("PRISMA_SAVE") : "quick.save";
+
+	shots = recording = NULL;
+	hud   = shoot = 0;
+	done  = 0;
+	for (frame = 0; !done; frame++) {
 		while (SDL_PollEvent(&e) != 0) {
 			switch (e.type) {
 			case SDL_QUIT:
@@ -57,11 +309,17 @@ int main(int argc, char **argv)
 				break;
 
 			case SDL_JOYDEVICEADDED:
-				SDL_JoystickOpen(e.jdevice.which);
+				s_join(world, e.jdevice.which);
+				break;
+
+			case SDL_JOYDEVICEREMOVED:
+				s_leave(world, e.jdevice.which);
 				break;
 
 			case SDL_JOYHATMOTION:
-				sprite_move_all(world->hero,
+				if (!(player = s_player(world, e.jhat.which)))
+					break;
+				sprite_move_all(player,
 					e.jhat.value & SDL_HAT_LEFT,
 					e.jhat.value & SDL_HAT_RIGHT,
 					e.jhat.value & SDL_HAT_UP,
@@ -69,9 +327,11 @@ int main(int argc, char **argv)
 				break;
 
 			case SDL_JOYAXISMOTION:
+				if (!(player = s_player(world, e.jaxis.which)))
+					break;
 				switch (e.jaxis.axis % 2) {
-				case 0: sprite_move_x(world->hero, analog(e.jaxis.value)); break;
-				case 1: sprite_move_y(world->hero, analog(e.jaxis.value)); break;
+				case 0: sprite_move_x(player, analog(e.jaxis.value)); break;
+				case 1: sprite_move_y(player, analog(e.jaxis.value)); break;
 				}
 				break;
 
@@ -90,6 +350,73 @@ int main(int argc, char **argv)
 					done = 1;
 					break;
 
+				/* quicksave, and quickload; the save also
+				   goes to PRISMA_SAVE (or quick.save), to
+				   be picked up by F9 in a later run */
+				case SDLK_F5:
+					if (snapshot_save(world, NULL, &quick) == 0)
+						snapshot_write(&quick, save);
+					break;
+				case SDLK_F9:
+					if (!quick.size && snapshot_read(&quick, save) != 0)
+						break;
+					if (snapshot_restore(world, &quick, NULL) != 0) {
+						fprintf(stderr, "%s: not a save of this map\n", save);
+						snapshot_release(&quick);
+					}
+					break;
+
+				/* a screenshot, or recording on and off;
+				   PRISMA_CAPTURE names the frames (a
+				   pattern, with a %d) or the raw stream */
+				case SDLK_F2:
+					shoot = 1;
+					break;
+				case SDLK_F12:
+					if (recording) {
+						if (renderer)
+							renderer_record(renderer, world, NULL);
+						capture_report(recording, stderr);
+						capture_close(recording);
+						recording = NULL;
+					} else {
+						recording = capture_open(getenv("PRISMA_CAPTURE") ? getenv("PRISMA_CAPTURE") : "capture%05d.png",
+						                         world->surface, CAPTURE_BUFFERS);
+						if (renderer)
+							renderer_record(renderer, world, recording);
+					}
+					break;
+
+				/* the HUD, on and off */
+				case SDLK_F3:
+					hud = !hud;
+					world->hud[0] = '\0';
+					break;
+
+				/* zooming out (and back), and the minimap:
+				   on and off, and in and out */
+				case SDLK_MINUS:
+					if (world->zoom < WORLD_ZOOM) world->zoom++;
+					break;
+				case SDLK_EQUALS:
+					if (world->zoom > 0) world->zoom--;
+					break;
+				case SDLK_m:
+					world->minimap = !world->minimap;
+					break;
+				case SDLK_RIGHTBRACKET:
+					if (world->minimap && world->minimap < WORLD_ZOOM) world->minimap++;
+					break;
+				case SDLK_LEFTBRACKET:
+					if (world->minimap > 1) world->minimap--;
+					break;
+
+				/* a little magic */
+				case SDLK_SPACE:
+					if (world->particles)
+						s_burst(world, 256);
+					break;
+
 				case SDLK_UP:    sprite_move_y(world->hero, -1); break;
 				case SDLK_DOWN:  sprite_move_y(world->hero,  1); break;
 				case SDLK_LEFT:  sprite_move_x(world->hero, -1); break;
@@ -99,12 +426,54 @@ int main(int argc, char **argv)
 			}
 		}
 
+		for (i = 0; world->particles && i < world->nviews; i++)
+			if (sprite_moving(world->views[i].hero) && frame % 3 == 0)
+				s_dust(world, world->views[i].hero);
 		world_update(world);
-		world_render(world);
+		if (hud)
+			s_hud(world, frame);
+		if (shoot && !shots)
+			shots = capture_open("shot%03d.png", world->surface, 1);
+
+		if (renderer) {
+			if (shoot)
+				renderer_shoot(renderer, shots);
+			renderer_publish(renderer, world);
+		} else {
+			world_render(world);
+			if (shoot && shots)
+				capture_frame(shots, world->surface);
+			if (recording)
+				capture_frame(recording, world->surface);
+		}
+		shoot = 0;
+		if (frame == 0) {
+			startup_mark(&startup, "first frame");
+			if (getenv("PRISMA_TIMELINE"))
+				startup_report(&startup, stderr);
+		}
+		if (budget >= 0)
+			s_budget(frame, budget);
 		SDL_Delay(16);
 	}
 
+	if (getenv("PRISMA_AUDIOREPORT"))
+		audio_report(audio, stderr);
+	audio_close(audio);
+	if (renderer) {
+		renderer_sync(renderer);
+		if (getenv("PRISMA_RENDERREPORT"))
+			renderer_report(renderer, stderr);
+		renderer_free(renderer, world);
+	}
+	if (recording)
+		capture_report(recording, stderr);
+	capture_close(recording);
+	capture_close(shots);
+	snapshot_release(&quick);
 	world_free(world);
+	if (getenv("PRISMA_MEMREPORT"))
+		mem_report(stderr);
 	quit();
 
 	return 0;
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
@@ -25,22 +26,118 @@
    like failure to allocate memory when asked. */
 #define EXIT_INT_FAILURE 2
 
+/* allocate() and astring() hand out untagged (MEM_MISC)
+   memory; everything they return goes back via release(). */
 void * allocate(size_t n, size_t size);
 void * astring(const char *fmt, ...);
 
+/* memory accounting, by subsystem; see mem.c */
+#define MEM_MISC     0
+#define MEM_MAP      1
+#define MEM_TILESET  2
+#define MEM_RENDER   3
+#define MEM_PARSER   4
+#define MEM_NAV      5
+#define MEM_ENTITY   6
+#define MEM_AUDIO    7
+#define MEM_TAGS     8
+
+struct memstats {
+	const char *name;
+	size_t current;        /* bytes in use right now */
+	size_t peak;           /* most bytes ever in use at once */
+	size_t churn;          /* bytes ever allocated */
+	unsigned long allocs;
+	unsigned long frees;
+};
+
+void *        tallocate(int tag, size_t n, size_t size);
+void *        reallocate(int tag, void *p, size_t n, size_t size);
+void          release(void *p);
+SDL_Surface * mem_surface(int tag, SDL_Surface *s);
+void          release_surface(SDL_Surface *s);
+void          mem_stats(int tag, struct memstats *st);
+unsigned long mem_allocs(void);
+void          mem_report(FILE *io);
+
 int bounded(int min, int v, int max);
 
+/* region allocator; see arena.c */
+struct arena;
+
+struct arena * arena_new(int tag);
+void           arena_free(struct arena *a);
+void *         arena_alloc(struct arena *a, size_t n, size_t size);
+char *         arena_string(struct arena *a, const char *fmt, ...);
+void           arena_defer(struct arena *a, void (*fn)(void *), void *p);
+
 #define ANALOG_TOLERANCE 4096
 int analog(int v);
 
+#define NSEC_PER_SEC  1000000000ull
+#define NSEC_PER_MSEC 1000000ull
+
+/* a 64-bit nanosecond game clock.  real clocks follow
+   CLOCK_MONOTONIC (times scale, unless paused); virtual
+   clocks only move when told to, via clock_advance(). */
+struct clock {
+	uint64_t now;   /* game time, in nanoseconds */
+	uint64_t real;  /* last CLOCK_MONOTONIC sample */
+	double   scale;
+	int      paused;
+	int      virtual;
+};
+
+void     clock_init(struct clock *c, int virtual);
+uint64_t clock_tick(struct clock *c);
+void     clock_advance(struct clock *c, uint64_t ns);
+void     clock_pause(struct clock *c, int paused);
+void     clock_scale(struct clock *c, double scale);
+uint64_t clock_monotonic(void);
+
+/* hierarchical timer wheel; 4 levels of 256 slots at 1ms
+   per tick covers ~49 days before timers get parked. */
+#define TIMER_RESOLUTION NSEC_PER_MSEC
+#define TIMER_LEVELS     4
+#define TIMER_SLOTS    256
+
+struct timer {
+	struct timer *next, *prev;
+
+	uint64_t due;     /* in ticks */
+	uint64_t period;  /* in ticks; 0 = one-shot */
+
+	void (*fn)(struct timer *, void *);
+	void  *data;
+};
+
+struct timers {
+	uint64_t now;  /* in ticks */
+	int      pending;
+	struct timer slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+void timers_init(struct timers *w, uint64_t now);
+void timers_advance(struct timers *w, uint64_t now);
+void timer_schedule(struct timers *w, struct timer *t, uint64_t delay, uint64_t period,
+                    void (*fn)(struct timer *, void *), void *data);
+void timer_cancel(struct timers *w, struct timer *t);
+
 struct coords {
 	int x;
 	int y;
 };
 
+#define OPACITY_CLEAR  0  /* nothing to draw */
+#define OPACITY_MIXED  1
+#define OPACITY_OPAQUE 2  /* covers whatever is under it */
+
 struct tileset {
 	SDL_Surface *surface;
-	int width;
+	int width;   /* in tiles */
+	int count;
+
+	unsigned char *opacity;  /* per tile */
 
 	struct {
 		int width;
@@ -48,14 +145,79 @@ struct tileset {
 	} tile;
 };
 
+/* sparse cell layers; see layer.c */
+struct layer;
+
+struct layer * layer_new(struct arena *arena, int width, int height);
+int            layer_get(struct layer *l, int x, int y);
+void           layer_set(struct layer *l, int x, int y, int v);
+int            layer_count(struct layer *l);
+unsigned       layer_order(struct layer *l, int x, int y);
+void           layer_scan(struct layer *l, int x0, int y0, int x1, int y1,
+                          void (*fn)(int x, int y, int v, void *data), void *data);
+
+/* every map_set() that actually changes a cell is logged
+   to the map's journal, for whatever keeps state derived
+   from the map (path clusters, lighting, flow fields...)
+   to catch up on incrementally.  each watcher has its own
+   cursor; the journal holds only what the slowest one has
+   yet to see, and nothing at all while nobody watches. */
+#define MAP_FLOOR     0
+#define MAP_OBJECTS   1
+#define MAP_WATCHERS  8
+
+struct mapchange {
+	int layer, x, y;
+	int was, now;
+	int solid;  /* map_solid() flipped */
+};
+
+struct journal {
+	int n, cap;
+	uint64_t base;  /* sequence number of changes[0] */
+	struct mapchange *changes;
+
+	unsigned watchers;  /* bitmask of cursors in use */
+	uint64_t cursor[MAP_WATCHERS];
+};
+
+/* an animated tile type.  cells drawn with one hold its
+   index (in place of a tile number) and TILE_ANIMATED; the
+   type, not the cell, keeps track of which frame is up. */
+#define MAP_ANIMS        64
+#define MAP_ANIM_FRAMES  16
+
+struct anim {
+	uint64_t period;    /* how long each frame shows, in ns */
+	int nframes;
+	int frame;
+	int tiles[MAP_ANIM_FRAMES];
+
+	unsigned long changed;  /* map->ticks as of the last frame change */
+	struct timer  timer;
+};
+
 struct map {
-	int *cells[2];
+	struct arena *arena;  /* owns the map, its cells and tiles */
+
+	int *cells[1];            /* the floor; dense, since it's mostly full */
+	struct layer *objects;    /* what's been placed on it */
+	uint32_t     *solid;      /* one bit per cell, for map_solid() */
+	struct journal journal;
+
+	int            nanims;
+	struct anim   *anims;
+	unsigned long  ticks;     /* animation frames shown, all told */
 
 	int  width;
 	int  height;
 
 	struct coords entry;
 
+	int            nnpcs;
+	struct npcdef *npcs;      /* who starts where, running what */
+
+	const char     *tileset;  /* its path, as the key gave it */
 	struct tileset *tiles;
 };
 
@@ -68,21 +230,186 @@ struct sprite {
 	struct coords delta;
 };
 
+/* sound: a mixer on SDL's audio thread, fed through a
+   lock-free command queue; see audio.c */
+#define AUDIO_VOICES  16   /* mixed at once */
+#define AUDIO_SAMPLES 32   /* loaded at once */
+#define AUDIO_QUEUE   64   /* commands in flight; a power of two */
+#define AUDIO_VOLUME  128  /* full volume */
+
+struct audiostats {
+	int freq, frames;         /* as the device was opened */
+	unsigned long callbacks;
+	unsigned long overruns;   /* took longer than the audio they made */
+	double mean, max;         /* time in the callback, in usec */
+	double period, jitter;    /* between callbacks: mean, worst deviation (usec) */
+	int active;               /* voices playing */
+	unsigned long stolen;     /* voices cut short for new ones */
+	unsigned long dropped;    /* commands the queue had no room for */
+};
+
+struct audio;
+struct audio * audio_open(int freq, int frames);
+void           audio_close(struct audio *a);
+int            audio_sample(struct audio *a, const int16_t *pcm, int frames, int channels, int freq);
+int            audio_load(struct audio *a, const char *path);
+int            audio_play(struct audio *a, int sample, int volume, int loop);
+void           audio_stop(struct audio *a, int voice);
+void           audio_stats(struct audio *a, struct audiostats *st);
+void           audio_report(struct audio *a, FILE *out);
+
+/* frame capture: screen copies into recycled buffers, written
+   out as PNGs or a raw stream on a thread of its own; see
+   capture.c */
+#define CAPTURE_BUFFERS 8
+
+struct capturestats {
+	unsigned long frames;     /* offered */
+	unsigned long taken;
+	unsigned long dropped;    /* every buffer was still queued */
+	unsigned long written, failed;
+	double mean, max;         /* time in capture_frame(), in usec */
+};
+
+struct capture;
+struct capture * capture_open(const char *path, SDL_Surface *like, int buffers);
+void             capture_close(struct capture *c);
+void             capture_frame(struct capture *c, SDL_Surface *s);
+void             capture_stats(struct capture *c, struct capturestats *st);
+void             capture_report(struct capture *c, FILE *out);
+
+/* drawing on a thread of its own, from frames the game thread
+   publishes through a triple buffer; see renderer.c */
+struct renderstats {
+	unsigned long published, drawn;
+	unsigned long skipped;    /* published over before they were drawn */
+	double mean, max;         /* publish to present, in usec */
+	double busy;              /* drawing a frame, in usec */
+};
+
+struct world;
+struct renderer;
+struct renderer * renderer_new(struct world *world);
+void              renderer_free(struct renderer *r, struct world *world);
+void              renderer_publish(struct renderer *r, struct world *world);
+void              renderer_sync(struct renderer *r);
+void              renderer_record(struct renderer *r, struct world *world, struct capture *c);
+void              renderer_shoot(struct renderer *r, struct capture *c);
+void              renderer_stats(struct renderer *r, struct renderstats *st);
+void              renderer_report(struct renderer *r, FILE *out);
+
+/* a work-stealing thread pool; see pool.c */
+struct pool;
+struct pool * pool_new(int threads);
+void          pool_free(struct pool *p);
+void          pool_submit(struct pool *p, void (*fn)(void *), void *data);
+void          pool_wait(struct pool *p);
+int           pool_steals(struct pool *p);
+
+/* startup stages, run as a dependency graph; see startup.c */
+#define STARTUP_STAGES 16
+#define STAGE_MAIN     0x01  /* must run on the main thread */
+
+struct startup;
+struct stage {
+	const char *name;
+	void      (*fn)(void *data);  /* NULL for a startup_mark() */
+	void       *data;
+	int         flags;
+	unsigned    after;            /* stages to wait for, by bit */
+
+	uint64_t    start, end;       /* ns since startup_begin() */
+	int         thread;           /* 0 for the main thread */
+	struct startup *owner;
+};
+
+struct startup {
+	uint64_t     epoch;
+	int          n;
+	struct stage stages[STARTUP_STAGES];
+
+	unsigned     done;            /* finished stages, by bit */
+	SDL_mutex   *lock;
+	SDL_cond    *cond;
+};
+
+void startup_begin(struct startup *s);
+int  startup_stage(struct startup *s, const char *name, void (*fn)(void *), void *data,
+                   int flags, unsigned after);
+void startup_run(struct startup *s);
+void startup_mark(struct startup *s, const char *name);
+void startup_report(struct startup *s, FILE *out);
+
+/* on-screen text, in a tileset font; see text.c */
+struct text;
+struct text *    text_new(const char *path);
+void             text_free(struct text *t);
+struct tileset * text_layout(struct text *t, const char *s);
+
+#define WORLD_HUD   128
+#define WORLD_VIEWS 4
+#define WORLD_ZOOM  10   /* zoomed out as far as 1 << WORLD_ZOOM */
+
+struct viewport {
+	struct coords at;
+	int width;
+	int height;
+};
+
+/* one player's share of the screen: their hero, what they
+   can see, and where on the window it goes.  the surface
+   is the window's own pixels, within screen, so that the
+   usual drawing lands in the right place, clipped. */
+struct view {
+	struct sprite  *hero;
+	struct fov     *fov;
+	struct viewport viewport;
+	struct timer    animate;
+
+	SDL_Rect     screen;
+	SDL_Surface *surface;
+};
+
 struct world {
 	SDL_Window  *window;
 	SDL_Surface *surface;
 
 	int scale;
-	int tocks;
 
-	struct {
-		struct coords at;
-		int width;
-		int height;
-	} viewport;
+	struct clock  clock;
+	struct timers timers;
+	struct timer  animate;
+
+	struct viewport viewport;
 
+	struct arena  *arena;  /* owns the hero and its tileset (MEM_ENTITY) */
 	struct map    *map;
 	struct sprite *hero;
+	struct fov    *fov;
+	struct rcache *cache;
+	struct overview *overview;
+
+	/* zoom: 0 draws cells at their own size, and each step out
+	   halves it, drawing from the overview instead.  minimap:
+	   0 is off, 1 fits the whole map, and each step in halves
+	   the span of it shown, around the hero */
+	int zoom;
+	int minimap;
+
+	/* split screen; view 0 is always the hero, fov and
+	   viewport above, and the cache is shared by them all */
+	struct view views[WORLD_VIEWS];
+	int nviews;
+
+	SDL_Surface *shade;  /* black, alpha-modded to darken cells */
+
+	struct text *text;   /* laid-out strings, and their font */
+	struct particles *particles;
+	struct npcs *npcs;   /* the map's, running its scripts */
+	char hud[WORLD_HUD]; /* shown in the top left, if not empty */
+
+	int shared;          /* map and hero tileset aren't ours to free */
+	int remote;          /* drawn by a renderer, which does its own looking */
 };
 
 struct world * world_new(int scale);
@@ -93,7 +420,107 @@ void           world_load(struct world * world, const char *map, const char *her
 void           world_update(struct world * world);
 void           world_render(struct world * world);
 
+/* world_load(), in steps: the map and hero loads don't
+   touch each other, and may run on different threads. */
+void           world_begin(struct world * world);
+void           world_load_map(struct world * world, const char *map);
+void           world_load_hero(struct world * world, const char *hero);
+void           world_finish(struct world * world);
+
+struct world * world_headless(struct map *map, struct tileset *hero, int scale);
+void           world_step(struct world * world, uint64_t ns);
+void           world_look(struct world * world);
+struct world * world_shadow(struct world * world);
+
+/* split the window between n players (up to WORLD_VIEWS),
+   each with a hero of their own; 1 goes back to one view */
+void           world_split(struct world * world, int n);
+
+/* flat, versioned snapshots of a world's mutable state;
+   see snapshot.c.  a snapshot owns its buffer, and can be
+   saved into over and over without reallocating. */
+struct snapshot {
+	uint64_t       id;
+	size_t         size, cap;
+	unsigned char *data;
+};
+
+int  snapshot_save(struct world *w, const struct snapshot *base, struct snapshot *s);
+int  snapshot_restore(struct world *w, const struct snapshot *s, const struct snapshot *base);
+int  snapshot_write(const struct snapshot *s, const char *path);
+int  snapshot_read(struct snapshot *s, const char *path);
+void snapshot_release(struct snapshot *s);
+
 void           world_draw(struct world * world, struct tileset* tiles, int t, int x, int y);
+void           world_text(struct world * world, int x, int y, const char *s);
+
+/* sparks, dust and the like, as structure-of-arrays, updated
+   PARTICLE_LANES at a time; see particles.c */
+#define PARTICLE_LANES 4
+
+struct particles {
+	int n, cap;              /* live, and room for */
+	float *x, *y;            /* in world pixels */
+	float *dx, *dy;          /* in pixels a second */
+	float *life;             /* seconds left */
+	int32_t *tile;
+	int32_t *visible;        /* scratch, for particles_draw() */
+	float gravity;           /* added to dy, a second */
+
+	struct tileset *tiles;
+	struct arena   *arena;   /* owns the tileset */
+	void           *block;   /* all the arrays, in one */
+};
+
+struct particles * particles_new(const char *path, int cap);
+void               particles_free(struct particles *p);
+int                particles_emit(struct particles *p, float x, float y, float dx, float dy, float life, int tile);
+void               particles_update(struct particles *p, float dt);
+int                particles_draw(struct particles *p, struct world *world);
+
+/* the map's non-player characters, each running a script
+   (from the map key) compiled to bytecode; see script.c */
+#define SCRIPT_REGS   16
+#define SCRIPT_SLICE  256      /* instructions an npc gets a tick */
+#define SCRIPT_BUDGET 262144   /* and all of them, together */
+
+struct program;
+struct program * script_compile(struct arena *arena, const char *src, const char *file, int line);
+int              script_length(const struct program *p);
+
+/* an npc, as the map key places it */
+struct npcdef {
+	unsigned char   symbol;   /* its tile, in the key */
+	int             tile;     /* as a cell; TILE_NONE (a trigger) isn't drawn */
+	struct coords   at;
+	const char     *source;
+	struct program *program;
+};
+
+struct npc {
+	const struct program *program;
+	int      pc;
+	int      wait;            /* ticks to sleep; -1 once it has ended */
+	uint32_t seed;            /* for rand */
+	int32_t  r[SCRIPT_REGS];
+};
+
+struct npcs {
+	int n;
+	struct sprite *sprites;   /* apart from the rest, to copy out whole */
+	struct npc    *state;
+	int dx, dy;               /* a cell, in world pixels */
+	int next;                 /* the first to run, next tick */
+
+	unsigned long ticks, executed;
+	unsigned long preempted;  /* used up a whole slice */
+	unsigned long starved;    /* turns missed when the budget ran out */
+};
+
+struct npcs * npcs_new(struct map *map, int dx, int dy);
+void          npcs_free(struct npcs *ns);
+int           npcs_run(struct npcs *ns, struct world *world, int budget);
+void          npcs_report(struct npcs *ns, FILE *out);
 
 int  sprite_moving(struct sprite *sprite);
 int  sprite_tile(struct sprite *sprite);
@@ -101,12 +528,147 @@ void sprite_move_x(struct sprite *sprite, int x);
 void sprite_move_y(struct sprite *sprite, int y);
 void sprite_move_all(struct sprite *sprite, int left, int right, int up, int down);
 
-struct tileset * tileset_read(const char * path);
-void             tileset_free(struct tileset * tiles);
+struct tileset * tileset_read(struct arena * arena, const char * path);
+int              tileset_opacity(struct tileset * tiles, int t);
+char *           tileset_cachefile(const char * path);
+
+/* cells hold ((1 + tile index) << 24) | flags;
+   a zero cell (TILE_NONE) draws nothing. */
+#define TILE_NONE        0
+#define TILE_SOLID    0x01
+#define TILE_ANIMATED 0x02
 
+#define istile(t) (((t) >> 24) != 0)
+#define tileno(t) (((t) >> 24) - 1)
+
+/* the tile to draw for a cell, right now */
+#define tileof(map,t) ((t) & TILE_ANIMATED \
+          ? (map)->anims[tileno(t)].tiles[(map)->anims[tileno(t)].frame] \
+          : tileno(t))
+
+/* raw floor access, for reading; changes go through map_set() */
 #define mapat(map,i,x,y) \
           ((map)->cells[i][(map)->height * (x) + (y)])
+struct map * map_new(int width, int height);
 struct map * map_read(const char * path);
+struct map * map_parse(const char * mf, size_t len, const char * grid, const char * file);
+struct map * map_clone(struct map * map);
 void         map_free(struct map * map);
+int          map_solid(struct map * map, int x, int y);
+int          map_get(struct map * map, int layer, int x, int y);
+void         map_set(struct map * map, int layer, int x, int y, int v);
+void         map_animate(struct map * map, int id);
+int          map_watch(struct map * map);
+void         map_unwatch(struct map * map, int w);
+int          map_changes(struct map * map, int w, const struct mapchange **changes);
+
+/* synthetic maps, for stressing the parser; see mapgen.c */
+struct mapgen {
+	int width, height;
+	int density;         /* percent of the floor with a symbol of its own */
+	int ragged;          /* percent of rows cut short */
+	int objects, npcs;
+	unsigned seed;
+};
+
+void mapgen(struct mapgen *g, FILE *key, FILE *grid);
+int  mapgen_write(struct mapgen *g, const char *path);
+
+/* pre-drawn map chunks; see render.c */
+struct rcache;
+
+struct rcache * rcache_new(struct map *map);
+void            rcache_free(struct rcache *rc);
+void            rcache_draw(struct rcache *rc, SDL_Surface *dst, int scale, SDL_Rect *view);
+int             rcache_span(struct rcache *rc, int w, int h, int scale);
+void            rcache_fit(struct rcache *rc, int n);
+unsigned long   rcache_loads(struct rcache *rc);
+
+/* the map, averaged down for zooming out; see overview.c */
+struct overview;
+
+struct overview * overview_new(struct map *map);
+void              overview_free(struct overview *ov);
+void              overview_update(struct overview *ov);
+void              overview_draw(struct overview *ov, SDL_Surface *dst, SDL_Rect *view, int dx, int dy, SDL_Rect *to);
+
+/* field of view and lighting; see fov.c */
+struct fov;
+
+struct fov * fov_new(struct map *map, int radius);
+void         fov_free(struct fov *f);
+void         fov_update(struct fov *f, int x, int y);
+void         fov_invalidate(struct fov *f, int x, int y);
+void         fov_forget(struct fov *f);
+int          fov_light(struct fov *f, int x, int y);
+
+/* grid raycasting over map_solid(); see ray.c.
+   positions are in cells, and a miss reports the end
+   of the ray as its hit point, with t == maxt. */
+struct rayhit {
+	int   hit;
+	struct coords cell;  /* the solid cell hit */
+	float x, y;          /* where the ray stopped */
+	float t;             /* how far it got */
+	int   nx, ny;        /* normal of the face hit */
+};
+
+/* structure-of-arrays batch; fill in n rays' worth of
+   inputs (after rays_reserve()), then call rays_cast().
+   the same as ray_cast() on each in turn, no faster. */
+struct raybatch {
+	int n, cap;
+
+	float *ox, *oy, *dx, *dy, *maxt;  /* in */
+
+	float         *t, *hx, *hy;       /* out */
+	int           *cx, *cy;
+	signed char   *nx, *ny;
+	unsigned char *hit;
+};
+
+int  ray_cast(struct map *map, float ox, float oy, float dx, float dy, float maxt, struct rayhit *hit);
+int  ray_clear(struct map *map, float ax, float ay, float bx, float by);
+void rays_reserve(struct raybatch *b, int n);
+void rays_cast(struct map *map, struct raybatch *b);
+void rays_free(struct raybatch *b);
+
+/* pathfinding over map_solid(); see path.c */
+#define PATH_PENDING 0
+#define PATH_FOUND   1
+#define PATH_NONE    2
+
+struct path {
+	int len, cap;
+	struct coords *steps;  /* cells, from start to goal inclusive */
+};
+
+struct pathquery {
+	struct coords from;
+	struct coords to;
+	struct path   path;
+	int           status;
+};
+
+struct pathfinder;
+
+struct pathfinder * path_new(struct map *map);
+void                path_free(struct pathfinder *pf);
+void                path_invalidate(struct pathfinder *pf, int x, int y);
+int                 path_find(struct pathfinder *pf, struct coords from, struct coords to, struct path *out);
+void                path_batch(struct pathfinder *pf, struct pathquery *q, int n);
+void                path_wait(struct pathfinder *pf);
+void                path_release(struct path *p);
+
+/* shared-goal flow fields; see flow.c */
+struct flowfield;
+
+struct flowfield * flow_new(struct map *map, int x, int y);
+void               flow_free(struct flowfield *ff);
+void               flow_goal(struct flowfield *ff, int x, int y);
+void               flow_invalidate(struct flowfield *ff, int x, int y);
+void               flow_update(struct flowfield *ff);
+void               flow_wait(struct flowfield *ff);
+int                flow_sample(struct flowfield *ff, int x, int y, struct coords *step);
 
 #endif
@@ -0,0 +1,127 @@
+#include "prisma.h"
+#include <math.h>
+
+/* grid raycasting, after Amanatides & Woo.
+
+   rather than sampling points along a line (and hoping the
+   step is small enough not to skip a corner), walk the exact
+   sequence of cells the ray passes through, stepping across
+   whichever cell boundary is nearest.  every cell is visited
+   once, and no further than the first solid one.
+
+   all coordinates are in cells; 2.5 is halfway across the
+   third column.  directions need not be normalized. */
+
+#define RAY_FAR 1e30f
+
+/* one ray, already set up: (tx,ty) is the distance to the
+   next vertical / horizontal boundary, (ddx,ddy) the distance
+   between boundaries, (sx,sy) the step direction. */
+static int
+s_walk(struct map *map, int x, int y, int sx, int sy,
+       float tx, float ty, float ddx, float ddy, float maxt,
+       float *t, int *cx, int *cy, int *nx, int *ny)
+{
+	*t = 0; *nx = *ny = 0;
+	for (;;) {
+		if (map_solid(map, x, y)) {
+			*cx = x; *cy = y;
+			return 1;
+		}
+		if (tx < ty) {
+			if (tx > maxt) break;
+			*t = tx; tx += ddx;
+			x += sx; *nx = -sx; *ny = 0;
+		} else {
+			if (ty > maxt) break;
+			*t = ty; ty += ddy;
+			y += sy; *nx = 0; *ny = -sy;
+		}
+	}
+
+	*t = maxt;
+	*nx = *ny = 0;
+	return 0;
+}
+
+int
+ray_cast(struct map *map, float ox, float oy, float dx, float dy, float maxt,
+         struct rayhit *hit)
+{
+	float len, ddx, ddy, tx, ty;
+	int x, y, sx, sy;
+
+	memset(hit, 0, sizeof(*hit));
+	len = sqrtf(dx * dx + dy * dy);
+	if (len == 0) return 0;
+	dx /= len;
+	dy /= len;
+
+	x = (int)floorf(ox);
+	y = (int)floorf(oy);
+	sx = dx > 0 ? 1 : -1;
+	sy = dy > 0 ? 1 : -1;
+	ddx = dx != 0 ? fabsf(1 / dx) : RAY_FAR;
+	ddy = dy != 0 ? fabsf(1 / dy) : RAY_FAR;
+	tx  = dx != 0 ? (dx > 0 ? x + 1 - ox : ox - x) * ddx : RAY_FAR;
+	ty  = dy != 0 ? (dy > 0 ? y + 1 - oy : oy - y) * ddy : RAY_FAR;
+
+	hit->hit = s_walk(map, x, y, sx, sy, tx, ty, ddx, ddy, maxt,
+	                  &hit->t, &hit->cell.x, &hit->cell.y, &hit->nx, &hit->ny);
+	hit->x = ox + dx * hit->t;
+	hit->y = oy + dy * hit->t;
+	return hit->hit;
+}
+
+int
+ray_clear(struct map *map, float ax, float ay, float bx, float by)
+{
+	struct rayhit hit;
+	float d;
+
+	d = sqrtf((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+	if (d == 0) return !map_solid(map, (int)floorf(ax), (int)floorf(ay));
+	return !ray_cast(map, ax, ay, bx - ax, by - ay, d, &hit);
+}
+
+void
+rays_reserve(struct raybatch *b, int n)
+{
+	if (n <= b->cap) return;
+
+	b->cap = n;
+#define grow(a) (b->a = reallocate(MEM_MISC, b->a, n, sizeof(*b->a)))
+	grow(ox);  grow(oy);  grow(dx);  grow(dy);  grow(maxt);
+	grow(t);   grow(hx);  grow(hy);
+	grow(cx);  grow(cy);  grow(nx);  grow(ny);  grow(hit);
+#undef grow
+}
+
+void
+rays_free(struct raybatch *b)
+{
+	release(b->ox); release(b->oy); release(b->dx); release(b->dy); release(b->maxt);
+	release(b->t);  release(b->hx); release(b->hy);
+	release(b->cx); release(b->cy); release(b->nx); release(b->ny); release(b->hit);
+	memset(b, 0, sizeof(*b));
+}
+
+/* one ray after another: walking several in lockstep, or
+   splitting set-up from traversal, only measured slower */
+void
+rays_cast(struct map *map, struct raybatch *b)
+{
+	struct rayhit hit;
+	int i;
+
+	for (i = 0; i < b->n; i++) {
+		b->hit[i] = ray_cast(map, b->ox[i], b->oy[i], b->dx[i], b->dy[i], b->maxt[i], &hit);
+		b->t[i]   = hit.t;
+		b->hx[i]  = hit.x;
+		b->hy[i]  = hit.y;
+		b->cx[i]  = hit.cell.x;
+		b->cy[i]  = hit.cell.y;
+		b->nx[i]  = hit.nx;
+		b->ny[i]  = hit.ny;
+	}
+}
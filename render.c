@@ -0,0 +1,315 @@
+#include "prisma.h"
+
+/* a cache of pre-drawn map chunks.
+
+   the floor and the objects on it hardly ever change, so
+   rather than blitting every tile of the viewport, every
+   frame, each RENDER_CHUNK x RENDER_CHUNK block of cells is
+   drawn once, at tileset resolution, and then scaled onto
+   the screen in a single blit.
+
+   two things can make a chunk go stale.  map_set() changes
+   come through the map's journal and redraw just the cells
+   they touch.  animated tiles are listed per chunk when the
+   chunk is drawn, so bringing it up to date is a walk over
+   that list (comparing against each type's last frame
+   change) rather than a scan of every cell in it.
+
+   there are never fewer slots than chunks on screen (the
+   world asks for enough for all its views, via
+   rcache_fit()), or a frame would evict its own chunks. */
+
+#define RENDER_CHUNK  16
+#define RENDER_SLOTS  16        /* to begin with */
+#define RENDER_EMPTY  -1
+
+struct rchunk {
+	int key;                /* cy * cw + cx, or RENDER_EMPTY */
+	unsigned long used;     /* frame last drawn to screen */
+	unsigned long drawn;    /* map->ticks as of the last refresh */
+	SDL_Surface *surface;
+
+	int           nanim;
+	unsigned char anim[RENDER_CHUNK * RENDER_CHUNK];  /* cells with animated tiles */
+};
+
+struct rcache {
+	struct map *map;
+	int watch;              /* our cursor into the map's journal */
+	int cw, ch;             /* map size, in chunks */
+	unsigned long frame;
+	unsigned long loads;    /* chunks drawn from scratch, ever */
+
+	int nslots;
+	struct rchunk *slots;
+};
+
+#define s_tw(rc) ((rc)->map->tiles->tile.width)
+#define s_th(rc) ((rc)->map->tiles->tile.height)
+
+static void
+s_tile(struct rcache *rc, struct rchunk *c, int x, int y, int t)
+{
+	struct tileset *tiles = rc->map->tiles;
+	SDL_Rect src, dst;
+
+	if (tileset_opacity(tiles, tileof(rc->map, t)) == OPACITY_CLEAR)
+		return;
+
+	src.x = s_tw(rc) * (tileof(rc->map, t) % tiles->width);
+	src.y = s_th(rc) * (tileof(rc->map, t) / tiles->width);
+	src.w = s_tw(rc);
+	src.h = s_th(rc);
+	dst.x = (x % RENDER_CHUNK) * s_tw(rc);
+	dst.y = (y % RENDER_CHUNK) * s_th(rc);
+	SDL_BlitSurface(tiles->surface, &src, c->surface, &dst);
+}
+
+/* would an object hide the floor under it, entirely? */
+static int
+s_covered(struct rcache *rc, int o)
+{
+	return istile(o) && tileset_opacity(rc->map->tiles, tileof(rc->map, o)) == OPACITY_OPAQUE;
+}
+
+/* (re)draw one cell of a chunk: black, the floor, then
+   whatever is on it; objects only show up on a floor. */
+static void
+s_cell(struct rcache *rc, struct rchunk *c, int x, int y)
+{
+	SDL_Rect r;
+	int t, o;
+
+	r.x = (x % RENDER_CHUNK) * s_tw(rc);
+	r.y = (y % RENDER_CHUNK) * s_th(rc);
+	r.w = s_tw(rc);
+	r.h = s_th(rc);
+	SDL_FillRect(c->surface, &r, SDL_MapRGB(c->surface->format, 0, 0, 0));
+
+	t = map_get(rc->map, MAP_FLOOR, x, y);
+	if (!istile(t)) return;
+	o = map_get(rc->map, MAP_OBJECTS, x, y);
+	if (!s_covered(rc, o))
+		s_tile(rc, c, x, y, t);
+	if (istile(o))
+		s_tile(rc, c, x, y, o);
+}
+
+struct loading {
+	struct rcache *rc;
+	struct rchunk *c;
+};
+
+static void
+s_object(int x, int y, int t, void *data)
+{
+	struct loading *l = data;
+
+	if (istile(t) && istile(mapat(l->rc->map, 0, x, y)))
+		s_tile(l->rc, l->c, x, y, t);
+}
+
+static int
+s_animated(struct rcache *rc, int x, int y)
+{
+	return (map_get(rc->map, MAP_FLOOR, x, y) & TILE_ANIMATED)
+	    || (map_get(rc->map, MAP_OBJECTS, x, y) & TILE_ANIMATED);
+}
+
+/* the chunk's index of animated cells, from scratch */
+static void
+s_index(struct rcache *rc, struct rchunk *c)
+{
+	int x, y, x0, y0;
+
+	x0 = (c->key % rc->cw) * RENDER_CHUNK;
+	y0 = (c->key / rc->cw) * RENDER_CHUNK;
+
+	c->nanim = 0;
+	for (x = 0; x < RENDER_CHUNK && x0 + x < rc->map->width; x++)
+		for (y = 0; y < RENDER_CHUNK && y0 + y < rc->map->height; y++)
+			if (s_animated(rc, x0 + x, y0 + y))
+				c->anim[c->nanim++] = x * RENDER_CHUNK + y;
+}
+
+static struct rchunk *
+s_lookup(struct rcache *rc, int key)
+{
+	int i;
+
+	for (i = 0; i < rc->nslots; i++)
+		if (rc->slots[i].key == key)
+			return &rc->slots[i];
+	return NULL;
+}
+
+/* draw a chunk into the least recently used slot */
+static struct rchunk *
+s_load(struct rcache *rc, int key)
+{
+	struct loading l;
+	struct rchunk *c;
+	int i, t, x, y, x0, y0;
+
+	c = &rc->slots[0];
+	for (i = 1; i < rc->nslots; i++)
+		if (rc->slots[i].used < c->used)
+			c = &rc->slots[i];
+
+	rc->loads++;
+	c->key   = key;
+	c->drawn = rc->map->ticks;
+	SDL_FillRect(c->surface, NULL, SDL_MapRGB(c->surface->format, 0, 0, 0));
+
+	x0 = (key % rc->cw) * RENDER_CHUNK;
+	y0 = (key / rc->cw) * RENDER_CHUNK;
+	for (x = x0; x < x0 + RENDER_CHUNK && x < rc->map->width; x++) {
+		for (y = y0; y < y0 + RENDER_CHUNK && y < rc->map->height; y++) {
+			t = mapat(rc->map, 0, x, y);
+			if (istile(t) && !s_covered(rc, layer_get(rc->map->objects, x, y)))
+				s_tile(rc, c, x, y, t);
+		}
+	}
+
+	l.rc = rc;
+	l.c  = c;
+	layer_scan(rc->map->objects, x0, y0, x0 + RENDER_CHUNK, y0 + RENDER_CHUNK, s_object, &l);
+
+	s_index(rc, c);
+	return c;
+}
+
+/* redraw the animated cells whose frames have moved on */
+static void
+s_animate(struct rcache *rc, struct rchunk *c)
+{
+	int i, x, y, t, x0, y0, stale;
+
+	if (c->drawn == rc->map->ticks)
+		return;
+
+	x0 = (c->key % rc->cw) * RENDER_CHUNK;
+	y0 = (c->key / rc->cw) * RENDER_CHUNK;
+	for (i = 0; i < c->nanim; i++) {
+		x = x0 + c->anim[i] / RENDER_CHUNK;
+		y = y0 + c->anim[i] % RENDER_CHUNK;
+
+		t = map_get(rc->map, MAP_FLOOR, x, y);
+		stale = (t & TILE_ANIMATED) && rc->map->anims[tileno(t)].changed > c->drawn;
+		t = map_get(rc->map, MAP_OBJECTS, x, y);
+		stale = stale || ((t & TILE_ANIMATED) && rc->map->anims[tileno(t)].changed > c->drawn);
+		if (stale)
+			s_cell(rc, c, x, y);
+	}
+	c->drawn = rc->map->ticks;
+}
+
+struct rcache *
+rcache_new(struct map *map)
+{
+	struct rcache *rc;
+
+	assert(map != NULL);
+	assert(map->tiles != NULL);
+
+	rc = tallocate(MEM_RENDER, 1, sizeof(struct rcache));
+	rc->map   = map;
+	rc->watch = map_watch(map);
+	rc->cw    = (map->width  + RENDER_CHUNK - 1) / RENDER_CHUNK;
+	rc->ch    = (map->height + RENDER_CHUNK - 1) / RENDER_CHUNK;
+
+	rcache_fit(rc, RENDER_SLOTS);
+	return rc;
+}
+
+void
+rcache_free(struct rcache *rc)
+{
+	int i;
+
+	if (!rc) return;
+	map_unwatch(rc->map, rc->watch);
+	for (i = 0; i < rc->nslots; i++)
+		release_surface(rc->slots[i].surface);
+	release(rc->slots);
+	release(rc);
+}
+
+/* how many chunks a w x h view can touch at once, at the
+   given scale: one more than fit, each way, since the view
+   needn't start on a chunk boundary */
+int
+rcache_span(struct rcache *rc, int w, int h, int scale)
+{
+	int pw, ph;
+
+	pw = RENDER_CHUNK * s_tw(rc) * scale;
+	ph = RENDER_CHUNK * s_th(rc) * scale;
+	return ((w + pw - 1) / pw + 1) * ((h + ph - 1) / ph + 1);
+}
+
+unsigned long
+rcache_loads(struct rcache *rc)
+{
+	return rc->loads;
+}
+
+/* make room for at least n chunks; the cache never shrinks */
+void
+rcache_fit(struct rcache *rc, int n)
+{
+	int i;
+
+	if (n <= rc->nslots)
+		return;
+
+	rc->slots = reallocate(MEM_RENDER, rc->slots, n, sizeof(struct rchunk));
+	for (i = rc->nslots; i < n; i++) {
+		memset(&rc->slots[i], 0, sizeof(struct rchunk));
+		rc->slots[i].key = RENDER_EMPTY;
+		rc->slots[i].surface = mem_surface(MEM_RENDER,
+			SDL_CreateRGBSurface(0, RENDER_CHUNK * s_tw(rc), RENDER_CHUNK * s_th(rc), 32, 0, 0, 0, 0));
+		if (!rc->slots[i].surface) {
+			fprintf(stderr, "failed to create render cache surface: %s\n", SDL_GetError());
+			exit(EXIT_INT_FAILURE);
+		}
+	}
+	rc->nslots = n;
+}
+
+void
+rcache_draw(struct rcache *rc, SDL_Surface *dst, int scale, SDL_Rect *view)
+{
+	const struct mapchange *ch;
+	struct rchunk *c;
+	SDL_Rect to;
+	int i, n, cx, cy, pw, ph;
+
+	/* catch up on map changes, in whatever is cached */
+	n = map_changes(rc->map, rc->watch, &ch);
+	for (i = 0; i < n; i++) {
+		c = s_lookup(rc, (ch[i].y / RENDER_CHUNK) * rc->cw + ch[i].x / RENDER_CHUNK);
+		if (!c) continue;
+		s_cell(rc, c, ch[i].x, ch[i].y);
+		if ((ch[i].was ^ ch[i].now) & TILE_ANIMATED)
+			s_index(rc, c);
+	}
+
+	rc->frame++;
+	pw = RENDER_CHUNK * s_tw(rc) * scale;
+	ph = RENDER_CHUNK * s_th(rc) * scale;
+	for (cx = view->x / pw; cx < rc->cw && cx * pw < view->x + view->w; cx++) {
+		for (cy = view->y / ph; cy < rc->ch && cy * ph < view->y + view->h; cy++) {
+			c = s_lookup(rc, cy * rc->cw + cx);
+			if (!c) c = s_load(rc, cy * rc->cw + cx);
+			else    s_animate(rc, c);
+			c->used = rc->frame;
+
+			to.x = cx * pw - view->x;
+			to.y = cy * ph - view->y;
+			to.w = pw;
+			to.h = ph;
+			SDL_BlitScaled(c->surface, NULL, dst, &to);
+		}
+	}
+}
@@ -0,0 +1,387 @@
+#include "prisma.h"
+
+/* drawing, on a thread of its own.
+
+   the game thread runs the simulation, and at the end of each
+   tick publishes a frame: everything the screen needs, and
+   nothing it doesn't (where the heroes, viewports and npcs
+   are, which animation frames are up, what changed on the
+   map, the particles and the HUD).  the render thread draws
+   the newest frame there is, and presents it, while the
+   game thread gets on with the next tick.
+
+   frames go through a triple buffer.  the game thread fills
+   the back frame, then swaps it for the middle one; the
+   render thread swaps its front frame for the middle one,
+   whenever the middle one is fresh.  neither side ever waits
+   for the other, and a frame that is published over before
+   it's drawn is just skipped.
+
+   the render thread draws from a world of its own (see
+   world_shadow()), with its own copy of the map, so nothing
+   it reads can change underneath it.  changes to the real
+   map ride along in frames; each frame carries all of them
+   since the last frame the renderer is known to have drawn,
+   numbered, so that skipping frames loses none of them and
+   the renderer never applies one twice. */
+
+#define RENDER_FRESH 4   /* in middle, over a frame number */
+
+struct change {
+	uint64_t         seq;   /* the frame that made it */
+	struct mapchange c;
+};
+
+struct frame {
+	uint64_t seq;
+	uint64_t stamp;                 /* published, by clock_monotonic() */
+
+	int             nviews;
+	struct sprite   heroes[WORLD_VIEWS];
+	struct viewport viewports[WORLD_VIEWS];
+
+	int *anims;                     /* which frame each is on */
+
+	int            nnpcs;
+	struct sprite *npcs;
+
+	int            ndirty, cap;
+	struct change *dirty;
+
+	struct particles particles;     /* just the live ones' x, y and tile */
+
+	char hud[WORLD_HUD];
+	int  zoom, minimap;
+
+	struct capture *recording, *shots;
+	uint64_t        shot;           /* the last frame a screenshot was asked for */
+};
+
+struct renderer {
+	struct world *world;            /* the render thread's own */
+	struct frame  frames[3];
+	SDL_atomic_t  middle;           /* frame number | RENDER_FRESH */
+	SDL_sem      *ready;
+	SDL_Thread   *thread;
+	SDL_atomic_t  quit;
+
+	/* the game thread's */
+	int             back;
+	int             watch;          /* on the game's map */
+	uint64_t        seq;
+	int             npending, cap;
+	struct change  *pending;        /* not yet known to be drawn */
+	struct capture *recording, *shots;
+	uint64_t        shot;
+
+	/* the render thread's */
+	int           front;
+	uint64_t      applied;          /* last change applied */
+	uint64_t      taken;            /* last screenshot taken */
+	SDL_atomic_t  drawn;            /* seq of the last frame drawn */
+	SDL_mutex    *lock;             /* held to change drawn, */
+	SDL_cond     *shown;            /* which is signalled, for renderer_sync() */
+	unsigned long ndrawn;
+	double        sum, max;         /* publish to present, in usec */
+	double        busy;             /* drawing, in usec, all told */
+};
+
+static void
+s_apply(struct renderer *r, struct frame *f)
+{
+	struct world *w = r->world;
+	struct anim *a;
+	int i;
+
+	for (i = 0; i < f->ndirty; i++) {
+		if (f->dirty[i].seq <= r->applied)
+			continue;
+		map_set(w->map, f->dirty[i].c.layer, f->dirty[i].c.x, f->dirty[i].c.y, f->dirty[i].c.now);
+	}
+	r->applied = f->seq;
+
+	/* map->ticks only goes forward, as in snapshot_restore() */
+	for (i = 0; i < w->map->nanims; i++) {
+		a = &w->map->anims[i];
+		if (a->frame != f->anims[i]) {
+			a->frame   = f->anims[i];
+			a->changed = ++w->map->ticks;
+		}
+	}
+
+	if (w->nviews != f->nviews)
+		world_split(w, f->nviews);
+	for (i = 0; i < f->nviews; i++) {
+		*w->views[i].hero    = f->heroes[i];
+		w->views[i].viewport = f->viewports[i];
+	}
+	w->viewport  = w->views[0].viewport;
+	if (w->npcs)
+		memcpy(w->npcs->sprites, f->npcs, f->nnpcs * sizeof(struct sprite));
+	w->particles = f->particles.n ? &f->particles : NULL;
+	memcpy(w->hud, f->hud, WORLD_HUD);
+	w->zoom    = f->zoom;
+	w->minimap = f->minimap;
+}
+
+static int
+s_render(void *data)
+{
+	struct renderer *r = data;
+	struct frame *f;
+	uint64_t t0, t1;
+	double us;
+
+	for (;;) {
+		SDL_SemWait(r->ready);
+		if (SDL_AtomicGet(&r->quit))
+			return 0;
+		if (!(SDL_AtomicGet(&r->middle) & RENDER_FRESH))
+			continue;
+
+		r->front = SDL_AtomicSet(&r->middle, r->front) & ~RENDER_FRESH;
+		f = &r->frames[r->front];
+
+		t0 = clock_monotonic();
+		s_apply(r, f);
+		world_look(r->world);
+		world_render(r->world);
+		if (f->recording)
+			capture_frame(f->recording, r->world->surface);
+		if (f->shots && f->shot > r->taken) {
+			capture_frame(f->shots, r->world->surface);
+			r->taken = f->shot;
+		}
+		t1 = clock_monotonic();
+
+		us = (t1 - f->stamp) / 1e3;
+		r->ndrawn++;
+		r->sum  += us;
+		r->busy += (t1 - t0) / 1e3;
+		if (us > r->max)
+			r->max = us;
+		SDL_LockMutex(r->lock);
+		SDL_AtomicSet(&r->drawn, (int)f->seq);
+		SDL_CondBroadcast(r->shown);
+		SDL_UnlockMutex(r->lock);
+	}
+}
+
+static void
+s_frame(struct world *world, struct frame *f)
+{
+	f->anims = tallocate(MEM_RENDER, world->map->nanims + 1, sizeof(int));
+	if (world->npcs) {
+		f->nnpcs = world->npcs->n;
+		f->npcs  = tallocate(MEM_RENDER, f->nnpcs, sizeof(struct sprite));
+	}
+	if (world->particles) {
+		f->particles.tiles   = world->particles->tiles;
+		f->particles.cap     = world->particles->cap;
+		f->particles.x       = tallocate(MEM_RENDER, f->particles.cap, sizeof(float));
+		f->particles.y       = tallocate(MEM_RENDER, f->particles.cap, sizeof(float));
+		f->particles.tile    = tallocate(MEM_RENDER, f->particles.cap, sizeof(int32_t));
+		f->particles.visible = tallocate(MEM_RENDER, f->particles.cap, sizeof(int32_t));
+	}
+}
+
+/* take over drawing world, on a thread of its own; from here
+   on the game thread calls renderer_publish(), and never
+   world_render() */
+struct renderer *
+renderer_new(struct world *world)
+{
+	struct renderer *r;
+	int i;
+
+	r = tallocate(MEM_RENDER, 1, sizeof(struct renderer));
+	r->world = world_shadow(world);
+	for (i = 0; i < 3; i++)
+		s_frame(world, &r->frames[i]);
+	r->back  = 0;
+	r->front = 1;
+	SDL_AtomicSet(&r->middle, 2);
+
+	/* the game's own render cache and overview would only
+	   ever fall behind on the map's journal, now */
+	rcache_free(world->cache);
+	overview_free(world->overview);
+	world->cache    = NULL;
+	world->overview = NULL;
+	world->remote   = 1;
+	r->watch = map_watch(world->map);
+
+	r->ready  = SDL_CreateSemaphore(0);
+	r->lock   = SDL_CreateMutex();
+	r->shown  = SDL_CreateCond();
+	r->thread = r->ready && r->lock && r->shown ? SDL_CreateThread(s_render, "render", r) : NULL;
+	if (!r->thread) {
+		fprintf(stderr, "failed to start render thread: %s\n", SDL_GetError());
+		exit(EXIT_INT_FAILURE);
+	}
+	return r;
+}
+
+void
+renderer_free(struct renderer *r, struct world *world)
+{
+	struct frame *f;
+	int i;
+
+	if (!r) return;
+
+	SDL_AtomicSet(&r->quit, 1);
+	SDL_SemPost(r->ready);
+	SDL_WaitThread(r->thread, NULL);
+	SDL_DestroySemaphore(r->ready);
+	SDL_DestroyCond(r->shown);
+	SDL_DestroyMutex(r->lock);
+
+	/* all borrowed */
+	r->world->window    = NULL;
+	r->world->text      = NULL;
+	r->world->particles = NULL;
+	world_free(r->world);
+
+	map_unwatch(world->map, r->watch);
+	world->cache    = rcache_new(world->map);
+	world->overview = overview_new(world->map);
+	world->remote   = 0;
+
+	for (i = 0; i < 3; i++) {
+		f = &r->frames[i];
+		release(f->anims);
+		release(f->npcs);
+		release(f->dirty);
+		release(f->particles.x);
+		release(f->particles.y);
+		release(f->particles.tile);
+		release(f->particles.visible);
+	}
+	release(r->pending);
+	release(r);
+}
+
+/* hand the state of world, as of now, to the render thread */
+void
+renderer_publish(struct renderer *r, struct world *world)
+{
+	const struct mapchange *ch;
+	struct frame *f;
+	uint64_t drawn;
+	int i, k, n;
+
+	r->seq++;
+	f = &r->frames[r->back];
+
+	/* the changes the renderer has seen are done with; any
+	   new ones join the rest */
+	drawn = (uint64_t)SDL_AtomicGet(&r->drawn);
+	for (i = k = 0; i < r->npending; i++)
+		if (r->pending[i].seq > drawn)
+			r->pending[k++] = r->pending[i];
+	r->npending = k;
+
+	n = map_changes(world->map, r->watch, &ch);
+	if (r->npending + n > r->cap) {
+		r->cap     = (r->npending + n) * 2;
+		r->pending = reallocate(MEM_RENDER, r->pending, r->cap, sizeof(struct change));
+	}
+	for (i = 0; i < n; i++) {
+		r->pending[r->npending].seq = r->seq;
+		r->pending[r->npending].c   = ch[i];
+		r->npending++;
+	}
+
+	if (r->npending > f->cap) {
+		f->cap   = r->cap;
+		f->dirty = reallocate(MEM_RENDER, f->dirty, f->cap, sizeof(struct change));
+	}
+	memcpy(f->dirty, r->pending, r->npending * sizeof(struct change));
+	f->ndirty = r->npending;
+
+	for (i = 0; i < world->map->nanims; i++)
+		f->anims[i] = world->map->anims[i].frame;
+
+	f->nviews = world->nviews;
+	for (i = 0; i < world->nviews; i++) {
+		f->heroes[i]    = *world->views[i].hero;
+		f->viewports[i] = world->views[i].viewport;
+	}
+
+	if (world->npcs)
+		memcpy(f->npcs, world->npcs->sprites, f->nnpcs * sizeof(struct sprite));
+
+	f->particles.n = 0;
+	if (world->particles && f->particles.x) {
+		f->particles.n = world->particles->n;
+		memcpy(f->particles.x,    world->particles->x,    f->particles.n * sizeof(float));
+		memcpy(f->particles.y,    world->particles->y,    f->particles.n * sizeof(float));
+		memcpy(f->particles.tile, world->particles->tile, f->particles.n * sizeof(int32_t));
+	}
+
+	memcpy(f->hud, world->hud, WORLD_HUD);
+	f->zoom      = world->zoom;
+	f->minimap   = world->minimap;
+	f->recording = r->recording;
+	f->shots     = r->shots;
+	f->shot      = r->shot;
+
+	f->seq   = r->seq;
+	f->stamp = clock_monotonic();
+	r->back  = SDL_AtomicSet(&r->middle, r->back | RENDER_FRESH) & ~RENDER_FRESH;
+	SDL_SemPost(r->ready);
+}
+
+/* wait for the render thread to draw the last frame published */
+void
+renderer_sync(struct renderer *r)
+{
+	SDL_LockMutex(r->lock);
+	while ((uint64_t)SDL_AtomicGet(&r->drawn) < r->seq)
+		SDL_CondWait(r->shown, r->lock);
+	SDL_UnlockMutex(r->lock);
+}
+
+/* record every frame drawn from here on into c (or stop, for
+   NULL); the capture the renderer was using is done with by
+   the time this returns */
+void
+renderer_record(struct renderer *r, struct world *world, struct capture *c)
+{
+	r->recording = c;
+	renderer_publish(r, world);
+	renderer_sync(r);
+}
+
+/* screenshot the next frame drawn into c */
+void
+renderer_shoot(struct renderer *r, struct capture *c)
+{
+	r->shots = c;
+	r->shot  = r->seq + 1;
+}
+
+void
+renderer_stats(struct renderer *r, struct renderstats *st)
+{
+	st->published = r->seq;
+	st->drawn     = r->ndrawn;
+	st->skipped   = (unsigned long)SDL_AtomicGet(&r->drawn) - r->ndrawn;
+	st->mean      = r->ndrawn ? r->sum / r->ndrawn : 0;
+	st->max       = r->max;
+	st->busy      = r->ndrawn ? r->busy / r->ndrawn : 0;
+}
+
+void
+renderer_report(struct renderer *r, FILE *out)
+{
+	struct renderstats st;
+
+	if (!r) return;
+	renderer_stats(r, &st);
+	fprintf(out, "render: %lu frames published, %lu drawn, %lu skipped\n",
+		st.published, st.drawn, st.skipped);
+	fprintf(out, "render: %.1fus to draw, mean; %.1fus from publish to present, mean (%.1fus worst)\n",
+		st.busy, st.mean, st.max);
+}
@@ -0,0 +1,745 @@
+#include "prisma.h"
+#include <ctype.h>
+#include <limits.h>
+
+/* map scripts: what the map's non-player characters do.
+
+   each `npc' in a map key comes with a script, a handful of
+   lines like
+
+       loop: move 1 0
+             wait 8
+             a = solid 1 0
+             if a goto turn
+             goto loop
+       turn: ...
+
+   compiled, when the map is read, into register bytecode:
+   one 32-bit word an instruction (opcode, then up to three
+   one-byte operands), and a second word for the target of a
+   conditional jump.  a script has sixteen registers, a
+   through p, one set per npc; constants go in a pool after
+   them, so every operand is just an index into one array,
+   with nothing to decode.
+
+   the interpreter dispatches through a table of labels (GCC's
+   computed goto), with one indirect jump per instruction and
+   no switch.  every npc gets at most SCRIPT_SLICE instructions
+   a tick before it is made to yield, and the lot of them share
+   a budget; whoever doesn't get a turn before it runs out goes
+   first next tick.  so however badly a script loops, a tick's
+   worth of scripts has a ceiling.
+
+   the language:
+
+       NAME:                    a label
+       R = A                    R is a register, a..p; A and B
+       R = A OP B                 are registers or numbers; OP is
+                                  + - * / % & | == != < <= > >=
+       R = x | y                the npc's cell
+       R = hx | hy              the hero's cell
+       R = solid A B            is the cell A,B from here solid?
+       R = tile A B             the object there (-1 for none)
+       R = rand A               0 .. A-1
+       if A [CMP B] goto NAME
+       goto NAME
+       move A B                 walk (-1, 0 or 1 each way)
+       put A B T                place tile T at A,B from here
+                                  (-1 to clear it)
+       wait A                   sleep A ticks (wait 1 = yield)
+       yield
+       end                      stop for good (as does running
+                                  off the end)
+
+   statements end at a newline or a `;', and `#' comments to
+   the end of the line. */
+
+#define OP_END    0
+#define OP_MOV    1
+#define OP_ADD    2
+#define OP_SUB    3
+#define OP_MUL    4
+#define OP_DIV    5
+#define OP_MOD    6
+#define OP_AND    7
+#define OP_OR     8
+#define OP_EQ     9
+#define OP_NE    10
+#define OP_LT    11
+#define OP_LE    12
+#define OP_JMP   13   /* target in the top 24 bits */
+#define OP_JEQ   14   /* B, C, then the target in the next word */
+#define OP_JNE   15
+#define OP_JLT   16
+#define OP_JLE   17
+#define OP_X     18
+#define OP_Y     19
+#define OP_HX    20
+#define OP_HY    21
+#define OP_SOLID 22
+#define OP_TILE  23
+#define OP_RAND  24
+#define OP_MOVE  25
+#define OP_PUT   26
+#define OP_WAIT  27
+#define OP_YIELD 28
+
+#define SCRIPT_CODE   65536  /* instructions, at most */
+#define SCRIPT_CONSTS (256 - SCRIPT_REGS)
+#define SCRIPT_LABELS 64
+
+#define s_ins(op,a,b,c) ((uint32_t)(op) | (uint32_t)(a) << 8 | (uint32_t)(b) << 16 | (uint32_t)(c) << 24)
+
+struct program {
+	int       ncode, nk;
+	uint32_t *code;
+	int32_t  *k;       /* constants, as registers SCRIPT_REGS on */
+};
+
+
+/* compiling */
+
+#define S_END    0
+#define S_NL     1   /* or a `;' */
+#define S_NAME   2
+#define S_NUMBER 3
+#define S_OP     4   /* one or two characters, in op[] */
+
+struct label {
+	char name[16];
+	int  at;           /* -1 until it turns up */
+};
+
+struct fixup {
+	int at;            /* the word to patch */
+	int label;
+	int jmp;           /* in an OP_JMP, rather than the whole word */
+	int line;
+};
+
+struct compiler {
+	const char *src, *file;
+	int         line;      /* of the npc, in the map key */
+	int         sline;     /* within the script */
+
+	int   token, pushed;
+	char  name[16];
+	char  op[3];
+	long  number;
+
+	uint32_t *code;
+	int       ncode, cap;
+	int32_t   k[SCRIPT_CONSTS];
+	int       nk;
+
+	struct label  labels[SCRIPT_LABELS];
+	int           nlabels;
+	struct fixup *fixups;
+	int           nfixups, fcap;
+
+	int failed;
+};
+
+static void
+s_error(struct compiler *c, int line, const char *msg)
+{
+	if (c->failed++) return;
+	fprintf(stderr, "%s:%d: ", c->file, c->line);
+	fprintf(stderr, "npc script, line %d: %s\n", line, msg);
+}
+
+static int
+s_token(struct compiler *c)
+{
+	const char *p;
+	int n;
+
+	if (c->pushed) {
+		c->pushed = 0;
+		return c->token;
+	}
+
+	while (*c->src == ' ' || *c->src == '\t' || *c->src == '\r')
+		c->src++;
+	if (*c->src == '#')
+		while (*c->src && *c->src != '\n')
+			c->src++;
+
+	p = c->src;
+	if (!*p)
+		return c->token = S_END;
+	if (*p == '\n' || *p == ';') {
+		c->src++;
+		c->sline += *p == '\n';
+		return c->token = S_NL;
+	}
+
+	if (isalpha((unsigned char)*p) || *p == '_') {
+		for (n = 0; isalnum((unsigned char)*p) || *p == '_'; p++)
+			if (n < (int)sizeof(c->name) - 1)
+				c->name[n++] = *p;
+		c->name[n] = '\0';
+		c->src = p;
+		return c->token = S_NAME;
+	}
+
+	if (isdigit((unsigned char)*p)) {
+		for (c->number = 0; isdigit((unsigned char)*p); p++)
+			if (c->number <= INT32_MAX)
+				c->number = c->number * 10 + (*p - '0');
+		c->src = p;
+		if (c->number > INT32_MAX)
+			s_error(c, c->sline, "number out of range");
+		return c->token = S_NUMBER;
+	}
+
+	c->op[0] = *p++;
+	c->op[1] = c->op[2] = '\0';
+	if (*p == '=' && strchr("=!<>", c->op[0]))
+		c->op[1] = *p++;
+	c->src = p;
+	return c->token = S_OP;
+}
+
+static int
+s_is(struct compiler *c, int token, const char *s)
+{
+	return c->token == token && strcmp(token == S_NAME ? c->name : c->op, s) == 0;
+}
+
+static int
+s_register(const char *name)
+{
+	return name[0] >= 'a' && name[0] < 'a' + SCRIPT_REGS && !name[1]
+	     ? name[0] - 'a' : -1;
+}
+
+static int
+s_constant(struct compiler *c, int32_t v)
+{
+	int i;
+
+	for (i = 0; i < c->nk; i++)
+		if (c->k[i] == v)
+			return SCRIPT_REGS + i;
+	if (c->nk == SCRIPT_CONSTS) {
+		s_error(c, c->sline, "too many constants");
+		return SCRIPT_REGS;
+	}
+	c->k[c->nk] = v;
+	return SCRIPT_REGS + c->nk++;
+}
+
+static void
+s_emit(struct compiler *c, uint32_t w)
+{
+	if (c->ncode == SCRIPT_CODE) {
+		s_error(c, c->sline, "script too long");
+		return;
+	}
+	if (c->ncode == c->cap) {
+		c->cap  = c->cap ? c->cap * 2 : 64;
+		c->code = reallocate(MEM_PARSER, c->code, c->cap, sizeof(uint32_t));
+	}
+	c->code[c->ncode++] = w;
+}
+
+static int
+s_label(struct compiler *c, const char *name)
+{
+	int i;
+
+	for (i = 0; i < c->nlabels; i++)
+		if (strcmp(c->labels[i].name, name) == 0)
+			return i;
+	if (c->nlabels == SCRIPT_LABELS) {
+		s_error(c, c->sline, "too many labels");
+		return 0;
+	}
+	strcpy(c->labels[c->nlabels].name, name);
+	c->labels[c->nlabels].at = -1;
+	return c->nlabels++;
+}
+
+/* the last word emitted jumps to the label named next */
+static void
+s_target(struct compiler *c, int jmp)
+{
+	struct fixup *f;
+
+	if (s_token(c) != S_NAME) {
+		s_error(c, c->sline, "`goto' needs a label");
+		return;
+	}
+	if (c->nfixups == c->fcap) {
+		c->fcap   = c->fcap ? c->fcap * 2 : 16;
+		c->fixups = reallocate(MEM_PARSER, c->fixups, c->fcap, sizeof(struct fixup));
+	}
+	f = &c->fixups[c->nfixups++];
+	f->at    = c->ncode - 1;
+	f->label = s_label(c, c->name);
+	f->jmp   = jmp;
+	f->line  = c->sline;
+}
+
+/* a register, or a (possibly negative) number */
+static int
+s_operand(struct compiler *c)
+{
+	int r;
+
+	s_token(c);
+	if (s_is(c, S_OP, "-")) {
+		if (s_token(c) == S_NUMBER)
+			return s_constant(c, (int32_t)-c->number);
+	} else if (c->token == S_NUMBER) {
+		return s_constant(c, (int32_t)c->number);
+	} else if (c->token == S_NAME && (r = s_register(c->name)) >= 0) {
+		return r;
+	}
+	s_error(c, c->sline, "expected a register (a-p) or a number");
+	return 0;
+}
+
+/* an arithmetic or comparison operator; comparisons the VM
+   doesn't have come back negated, to be done with their
+   operands swapped */
+static int
+s_binop(const char *op)
+{
+	static const struct { const char *op; int code; } OPS[] = {
+		{ "+",  OP_ADD }, { "-",  OP_SUB }, { "*", OP_MUL }, { "/",  OP_DIV },
+		{ "%",  OP_MOD }, { "&",  OP_AND }, { "|", OP_OR  },
+		{ "==", OP_EQ  }, { "!=", OP_NE  }, { "<", OP_LT  }, { "<=", OP_LE  },
+		{ ">", -OP_LT  }, { ">=", -OP_LE },
+	};
+	int i;
+
+	for (i = 0; i < (int)(sizeof(OPS) / sizeof(OPS[0])); i++)
+		if (strcmp(OPS[i].op, op) == 0)
+			return OPS[i].code;
+	return 0;
+}
+
+/* R = ... */
+static void
+s_assign(struct compiler *c, int r)
+{
+	int a, b, op;
+
+	s_token(c);
+	if (c->token == S_NAME && s_register(c->name) < 0) {
+		if      (s_is(c, S_NAME, "x"))  s_emit(c, s_ins(OP_X,  r, 0, 0));
+		else if (s_is(c, S_NAME, "y"))  s_emit(c, s_ins(OP_Y,  r, 0, 0));
+		else if (s_is(c, S_NAME, "hx")) s_emit(c, s_ins(OP_HX, r, 0, 0));
+		else if (s_is(c, S_NAME, "hy")) s_emit(c, s_ins(OP_HY, r, 0, 0));
+		else if (s_is(c, S_NAME, "rand")) {
+			s_emit(c, s_ins(OP_RAND, r, s_operand(c), 0));
+		} else if (s_is(c, S_NAME, "solid") || s_is(c, S_NAME, "tile")) {
+			op = c->name[0] == 's' ? OP_SOLID : OP_TILE;
+			a  = s_operand(c);
+			b  = s_operand(c);
+			s_emit(c, s_ins(op, r, a, b));
+		} else {
+			s_error(c, c->sline, "unknown value");
+		}
+		return;
+	}
+
+	c->pushed = 1;
+	a = s_operand(c);
+	if (s_token(c) != S_OP) {
+		c->pushed = 1;
+		s_emit(c, s_ins(OP_MOV, r, a, 0));
+		return;
+	}
+
+	op = s_binop(c->op);
+	if (!op) {
+		s_error(c, c->sline, "unknown operator");
+		return;
+	}
+	b = s_operand(c);
+	s_emit(c, op > 0 ? s_ins(op, r, a, b) : s_ins(-op, r, b, a));
+}
+
+/* if A [CMP B] goto NAME */
+static void
+s_if(struct compiler *c)
+{
+	int a, b, op;
+
+	a = s_operand(c);
+	if (s_token(c) == S_OP) {
+		op = s_binop(c->op);
+		if (op < OP_EQ && op > -OP_EQ) {
+			s_error(c, c->sline, "expected a comparison");
+			return;
+		}
+		b = s_operand(c);
+		s_token(c);
+	} else {
+		op = OP_NE;
+		b  = s_constant(c, 0);
+	}
+	if (!s_is(c, S_NAME, "goto")) {
+		s_error(c, c->sline, "expected `goto'");
+		return;
+	}
+
+	op = op > 0 ? op - OP_EQ + OP_JEQ : op + OP_EQ - OP_JEQ;
+	s_emit(c, op > 0 ? s_ins(op, 0, a, b) : s_ins(-op, 0, b, a));
+	s_emit(c, 0);
+	s_target(c, 0);
+}
+
+static void
+s_statement(struct compiler *c)
+{
+	char name[sizeof(c->name)];
+	int r, a, b;
+
+	if (c->token != S_NAME) {
+		s_error(c, c->sline, "expected a statement");
+		return;
+	}
+	strcpy(name, c->name);
+	s_token(c);
+
+	if (s_is(c, S_OP, ":")) {
+		r = s_label(c, name);
+		if (c->labels[r].at >= 0)
+			s_error(c, c->sline, "label defined twice");
+		c->labels[r].at = c->ncode;
+
+		/* and maybe a statement, on the same line */
+		if (s_token(c) != S_NL && c->token != S_END)
+			s_statement(c);
+		else
+			c->pushed = 1;
+		return;
+	}
+
+	if (s_is(c, S_OP, "=")) {
+		if ((r = s_register(name)) < 0)
+			s_error(c, c->sline, "can only assign to a register (a-p)");
+		s_assign(c, r < 0 ? 0 : r);
+		return;
+	}
+
+	c->pushed = 1;
+	if (strcmp(name, "if") == 0) {
+		s_if(c);
+	} else if (strcmp(name, "goto") == 0) {
+		s_emit(c, s_ins(OP_JMP, 0, 0, 0));
+		s_target(c, 1);
+	} else if (strcmp(name, "move") == 0) {
+		a = s_operand(c);
+		b = s_operand(c);
+		s_emit(c, s_ins(OP_MOVE, a, b, 0));
+	} else if (strcmp(name, "put") == 0) {
+		a = s_operand(c);
+		b = s_operand(c);
+		s_emit(c, s_ins(OP_PUT, s_operand(c), a, b));
+	} else if (strcmp(name, "wait") == 0) {
+		s_emit(c, s_ins(OP_WAIT, s_operand(c), 0, 0));
+	} else if (strcmp(name, "yield") == 0) {
+		s_emit(c, s_ins(OP_YIELD, 0, 0, 0));
+	} else if (strcmp(name, "end") == 0) {
+		s_emit(c, s_ins(OP_END, 0, 0, 0));
+	} else {
+		s_error(c, c->sline, "unknown statement");
+	}
+}
+
+/* compile the script of the npc on line of file; the program
+   (and only that) goes in arena */
+struct program *
+script_compile(struct arena *arena, const char *src, const char *file, int line)
+{
+	struct compiler c;
+	struct program *p = NULL;
+	struct fixup *f;
+	int i, at;
+
+	memset(&c, 0, sizeof(c));
+	c.src   = src;
+	c.file  = file;
+	c.line  = line;
+	c.sline = 1;
+
+	while (s_token(&c) != S_END) {
+		if (c.token == S_NL)
+			continue;
+		s_statement(&c);
+		if (s_token(&c) != S_NL && c.token != S_END)
+			s_error(&c, c.sline, "expected the end of the statement");
+		while (c.token != S_NL && c.token != S_END)
+			s_token(&c);
+		if (c.token == S_END)
+			break;
+	}
+	s_emit(&c, s_ins(OP_END, 0, 0, 0));
+
+	for (i = 0; i < c.nfixups; i++) {
+		f  = &c.fixups[i];
+		at = c.labels[f->label].at;
+		if (at < 0) {
+			s_error(&c, f->line, "no such label");
+			break;
+		}
+		c.code[f->at] = f->jmp ? s_ins(OP_JMP, 0, 0, 0) | (uint32_t)at << 8 : (uint32_t)at;
+	}
+
+	if (!c.failed) {
+		p = arena_alloc(arena, 1, sizeof(struct program));
+		p->ncode = c.ncode;
+		p->nk    = c.nk;
+		p->code  = arena_alloc(arena, c.ncode, sizeof(uint32_t));
+		p->k     = arena_alloc(arena, c.nk + 1, sizeof(int32_t));
+		memcpy(p->code, c.code, c.ncode * sizeof(uint32_t));
+		memcpy(p->k, c.k, c.nk * sizeof(int32_t));
+	}
+	release(c.code);
+	release(c.fixups);
+	return p;
+}
+
+int
+script_length(const struct program *p)
+{
+	return p->ncode;
+}
+
+/* running */
+
+struct npcs *
+npcs_new(struct map *map, int dx, int dy)
+{
+	struct npcs *ns;
+	struct npcdef *d;
+	int i;
+
+	if (!map->nnpcs)
+		return NULL;
+
+	ns = tallocate(MEM_ENTITY, 1, sizeof(struct npcs));
+	ns->n       = map->nnpcs;
+	ns->dx      = dx;
+	ns->dy      = dy;
+	ns->sprites = tallocate(MEM_ENTITY, ns->n, sizeof(struct sprite));
+	ns->state   = tallocate(MEM_ENTITY, ns->n, sizeof(struct npc));
+
+	for (i = 0; i < ns->n; i++) {
+		d = &map->npcs[i];
+		ns->sprites[i].tileset = map->tiles;
+		ns->sprites[i].tile    = d->tile;
+		ns->sprites[i].at.x    = d->at.x * dx;
+		ns->sprites[i].at.y    = d->at.y * dy;
+		ns->state[i].program   = d->program;
+		ns->state[i].seed      = 2654435761u * (i + 1) | 1;
+	}
+	return ns;
+}
+
+void
+npcs_free(struct npcs *ns)
+{
+	if (!ns) return;
+	release(ns->sprites);
+	release(ns->state);
+	release(ns);
+}
+
+static uint32_t
+s_rand(uint32_t *seed)
+{
+	uint32_t x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *seed = x;
+}
+
+/* arithmetic wraps, rather than overflowing */
+#define s_wrap(a,op,b) ((int32_t)((uint32_t)(a) op (uint32_t)(b)))
+
+/* run npc i until it yields, or slice instructions are up;
+   returns how many it ran */
+static int
+s_run(struct npcs *ns, int i, struct map *map, int hx, int hy, int shared, int slice)
+{
+	static const void *OPS[] = {
+		[OP_END]   = __extension__ &&op_end,
+		[OP_MOV]   = __extension__ &&op_mov,
+		[OP_ADD]   = __extension__ &&op_add,
+		[OP_SUB]   = __extension__ &&op_sub,
+		[OP_MUL]   = __extension__ &&op_mul,
+		[OP_DIV]   = __extension__ &&op_div,
+		[OP_MOD]   = __extension__ &&op_mod,
+		[OP_AND]   = __extension__ &&op_and,
+		[OP_OR]    = __extension__ &&op_or,
+		[OP_EQ]    = __extension__ &&op_eq,
+		[OP_NE]    = __extension__ &&op_ne,
+		[OP_LT]    = __extension__ &&op_lt,
+		[OP_LE]    = __extension__ &&op_le,
+		[OP_JMP]   = __extension__ &&op_jmp,
+		[OP_JEQ]   = __extension__ &&op_jeq,
+		[OP_JNE]   = __extension__ &&op_jne,
+		[OP_JLT]   = __extension__ &&op_jlt,
+		[OP_JLE]   = __extension__ &&op_jle,
+		[OP_X]     = __extension__ &&op_x,
+		[OP_Y]     = __extension__ &&op_y,
+		[OP_HX]    = __extension__ &&op_hx,
+		[OP_HY]    = __extension__ &&op_hy,
+		[OP_SOLID] = __extension__ &&op_solid,
+		[OP_TILE]  = __extension__ &&op_tile,
+		[OP_RAND]  = __extension__ &&op_rand,
+		[OP_MOVE]  = __extension__ &&op_move,
+		[OP_PUT]   = __extension__ &&op_put,
+		[OP_WAIT]  = __extension__ &&op_wait,
+		[OP_YIELD] = __extension__ &&op_yield,
+	};
+
+	struct npc *npc = &ns->state[i];
+	struct sprite *s = &ns->sprites[i];
+	const uint32_t *code, *pc;
+	uint32_t ins;
+	int32_t r[SCRIPT_REGS + SCRIPT_CONSTS];
+	int left, x, y, v;
+
+	code = npc->program->code;
+	pc   = code + npc->pc;
+	left = slice;
+	memcpy(r, npc->r, sizeof(npc->r));
+	memcpy(r + SCRIPT_REGS, npc->program->k, npc->program->nk * sizeof(int32_t));
+
+	/* where it stands (it won't move until the world says so) */
+	x = (s->at.x + ns->dx / 2) / ns->dx;
+	y = (s->at.y + ns->dy / 2) / ns->dy;
+
+#define A (ins >> 8 & 0xff)
+#define B (ins >> 16 & 0xff)
+#define C (ins >> 24)
+#define NEXT() __extension__ ({ if (left-- == 0) goto preempt; ins = *pc++; goto *OPS[ins & 0xff]; })
+
+	NEXT();
+
+op_mov:   r[A] = r[B];                      NEXT();
+op_add:   r[A] = s_wrap(r[B], +, r[C]);     NEXT();
+op_sub:   r[A] = s_wrap(r[B], -, r[C]);     NEXT();
+op_mul:   r[A] = s_wrap(r[B], *, r[C]);     NEXT();
+op_div:   r[A] = r[C] ? (int32_t)((int64_t)r[B] / r[C]) : 0; NEXT();
+op_mod:   r[A] = r[C] ? (int32_t)((int64_t)r[B] % r[C]) : 0; NEXT();
+op_and:   r[A] = r[B] & r[C];               NEXT();
+op_or:    r[A] = r[B] | r[C];               NEXT();
+op_eq:    r[A] = r[B] == r[C];              NEXT();
+op_ne:    r[A] = r[B] != r[C];              NEXT();
+op_lt:    r[A] = r[B] <  r[C];              NEXT();
+op_le:    r[A] = r[B] <= r[C];              NEXT();
+
+op_jmp:   pc = code + (ins >> 8);                        NEXT();
+op_jeq:   pc = r[B] == r[C] ? code + *pc : pc + 1;       NEXT();
+op_jne:   pc = r[B] != r[C] ? code + *pc : pc + 1;       NEXT();
+op_jlt:   pc = r[B] <  r[C] ? code + *pc : pc + 1;       NEXT();
+op_jle:   pc = r[B] <= r[C] ? code + *pc : pc + 1;       NEXT();
+
+op_x:     r[A] = x;  NEXT();
+op_y:     r[A] = y;  NEXT();
+op_hx:    r[A] = hx; NEXT();
+op_hy:    r[A] = hy; NEXT();
+
+op_solid:
+	r[A] = map_solid(map, s_wrap(x, +, r[B]), s_wrap(y, +, r[C]));
+	NEXT();
+op_tile:
+	v = map_get(map, MAP_OBJECTS, s_wrap(x, +, r[B]), s_wrap(y, +, r[C]));
+	r[A] = istile(v) ? tileno(v) : -1;
+	NEXT();
+op_rand:
+	r[A] = r[B] > 0 ? (int32_t)(s_rand(&npc->seed) % (uint32_t)r[B]) : 0;
+	NEXT();
+
+op_move:
+	sprite_move_x(s, bounded(-1, r[A], 1));
+	sprite_move_y(s, bounded(-1, r[B], 1));
+	NEXT();
+
+	/* headless worlds share their map, so leave it be */
+op_put:
+	v = r[A];
+	if (!shared && v < 127 && (!map->tiles || v < map->tiles->count))
+		map_set(map, MAP_OBJECTS, s_wrap(x, +, r[B]), s_wrap(y, +, r[C]),
+		        v < 0 ? TILE_NONE : (1 + v) << 24);
+	NEXT();
+
+op_wait:
+	npc->wait = r[A] > 1 ? r[A] - 1 : 0;
+	goto yield;
+op_yield:
+	goto yield;
+op_end:
+	npc->wait = -1;
+	pc--;
+	goto yield;
+
+preempt:
+	ns->preempted++;
+	left = 0;
+yield:
+	npc->pc = pc - code;
+	memcpy(npc->r, r, sizeof(npc->r));
+	return slice - left;
+
+#undef A
+#undef B
+#undef C
+#undef NEXT
+}
+
+/* a tick's worth of every npc's script, budget instructions
+   at most; returns how many were run */
+int
+npcs_run(struct npcs *ns, struct world *world, int budget)
+{
+	struct npc *npc;
+	int hx, hy, i, k, total;
+
+	hx = (world->hero->at.x + ns->dx / 2) / ns->dx;
+	hy = (world->hero->at.y + ns->dy / 2) / ns->dy;
+
+	total = 0;
+	for (k = 0; k < ns->n; k++) {
+		i = ns->next + k;
+		if (i >= ns->n) i -= ns->n;
+		npc = &ns->state[i];
+
+		if (npc->wait) {
+			if (npc->wait > 0) npc->wait--;
+			continue;
+		}
+		if (total == budget) {
+			/* out of time; the rest go first next tick */
+			ns->starved += ns->n - k;
+			ns->next = i;
+			break;
+		}
+		total += s_run(ns, i, world->map, hx, hy, world->shared,
+		               budget - total < SCRIPT_SLICE ? budget - total : SCRIPT_SLICE);
+	}
+
+	ns->ticks++;
+	ns->executed += total;
+	return total;
+}
+
+void
+npcs_report(struct npcs *ns, FILE *out)
+{
+	if (!ns) return;
+	fprintf(out, "npcs: %d, over %lu ticks, %.1f instructions a tick\n",
+		ns->n, ns->ticks, ns->ticks ? (double)ns->executed / ns->ticks : 0);
+	fprintf(out, "npcs: %lu slices used up, %lu turns missed for the budget\n",
+		ns->preempted, ns->starved);
+}
@@ -0,0 +1,611 @@
+#include "prisma.h"
+
+/* world snapshots, for save, load and rollback.
+
+   a snapshot is one flat, versioned buffer: a header holding
+   the clock, the hero and the viewport, then every npc (where
+   it is, and where its script is at), then each animated
+   tile type's frame, then the map: every floor cell as-is,
+   and every placed object, in layer_scan() order.  saving is
+   a handful of memcpy()s and one pass over the objects;
+   nothing is ever parsed back out of the map or tileset files.
+
+   the buffer is in native byte order, and can be written
+   out and read back (snapshot_write(), snapshot_read()) as
+   a save game, so long as it goes back into the same map.
+   since a file can hold anything, a snapshot's shape and
+   every value in it are checked before any of it is put
+   back (see s_valid() and s_sane()).
+
+   a delta snapshot is taken against a full one (its base),
+   and only holds the floor cells and objects that differ
+   from it, so a rollback buffer can keep one full snapshot
+   and a short delta for every frame since.
+
+   restoring goes through map_set(), and only for the cells
+   that actually differ, so fov, paths and the render cache
+   find out about it the way they do any other change.
+   headless worlds share their map with other worlds, so
+   theirs is left out of the snapshot altogether. */
+
+#define SNAPSHOT_MAGIC   "PSNP"
+#define SNAPSHOT_VERSION 2
+
+#define SNAPSHOT_DELTA   0x01  /* against a base snapshot */
+#define SNAPSHOT_MAP     0x02  /* holds the map's cells */
+
+#define SNAPSHOT_BLOCK   64    /* floor cells compared at a time */
+
+struct shead {
+	char     magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t size;          /* of the whole snapshot */
+	uint64_t id;
+	uint64_t base;          /* id of the base, for a delta */
+
+	int32_t  width, height;
+	int32_t  nanims;
+	int32_t  ncells;        /* floor cells (or changes) that follow */
+	int32_t  nobjects;      /* objects (or changes) after those */
+	int32_t  nnpcs;         /* always all of them, even in a delta */
+
+	uint64_t now;           /* game clock, in ns */
+	double   scale;
+	int32_t  paused;
+
+	int32_t  at[2], delta[2], frame;  /* the hero */
+	int32_t  view[2];
+	uint64_t animate;       /* ticks until the hero's next frame; 0 if idle */
+};
+
+struct snpc {
+	int32_t  at[2], delta[2];
+	int32_t  pc, wait;
+	uint32_t seed;
+	int32_t  unused;
+	int32_t  r[SCRIPT_REGS];
+};
+
+struct sanim {
+	int32_t  frame;
+	int32_t  unused;
+	uint64_t next;          /* ticks until the next frame; 0 if idle */
+};
+
+struct scell {
+	int32_t i, v;           /* index into the floor, new value */
+};
+
+struct sobject {
+	int32_t x, y, v;        /* v == TILE_NONE for a removal */
+};
+
+#define s_head(s)    ((struct shead *)(s)->data)
+#define s_npcs(h)    ((struct snpc *)((h) + 1))
+#define s_anims(h)   ((struct sanim *)(s_npcs(h) + (h)->nnpcs))
+#define s_cells(h)   ((int32_t *)(s_anims(h) + (h)->nanims))
+#define s_changes(h) ((struct scell *)(s_anims(h) + (h)->nanims))
+#define s_objects(h) ((struct sobject *)((h)->flags & SNAPSHOT_DELTA \
+                         ? (unsigned char *)(s_changes(h) + (h)->ncells) \
+                         : (unsigned char *)(s_cells(h) + (h)->ncells)))
+
+static SDL_atomic_t SERIAL;
+
+static void
+s_reserve(struct snapshot *s, size_t n)
+{
+	if (n <= s->cap) return;
+	s->cap  = n + n / 4;
+	s->data = reallocate(MEM_ENTITY, s->data, s->cap, 1);
+}
+
+static uint64_t
+s_pending(struct timers *w, struct timer *t)
+{
+	return t->next ? t->due - w->now : 0;
+}
+
+/* is s a snapshot, of a map shaped like this one, with all
+   the records it says it has, and nothing more? */
+static int
+s_valid(const struct snapshot *s, struct world *w)
+{
+	struct shead *h;
+	uint64_t size;
+
+	if (!s || s->size < sizeof(struct shead))
+		return 0;
+	h = s_head(s);
+	if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0
+	 || h->version != SNAPSHOT_VERSION
+	 || h->size    != s->size
+	 || h->nnpcs   != (w->npcs ? w->npcs->n : 0)
+	 || h->width   != w->map->width
+	 || h->height  != w->map->height
+	 || h->nanims  != ((h->flags & SNAPSHOT_MAP) ? w->map->nanims : 0))
+		return 0;
+
+	if (h->ncells < 0 || h->nobjects < 0)
+		return 0;
+	if (!(h->flags & SNAPSHOT_MAP) && (h->ncells || h->nobjects))
+		return 0;
+	if ((h->flags & SNAPSHOT_MAP) && !(h->flags & SNAPSHOT_DELTA)
+	 && h->ncells != h->width * h->height)
+		return 0;
+
+	size = sizeof(struct shead)
+	     + (uint64_t)h->nnpcs    * sizeof(struct snpc)
+	     + (uint64_t)h->nanims   * sizeof(struct sanim)
+	     + (uint64_t)h->ncells   * (h->flags & SNAPSHOT_DELTA ? sizeof(struct scell) : sizeof(int32_t))
+	     + (uint64_t)h->nobjects * sizeof(struct sobject);
+	return size == h->size;
+}
+
+/* does v decode to a tile this map can draw (or to none)? */
+static int
+s_tile(struct map *map, int32_t v)
+{
+	unsigned t = (uint32_t)v >> 24;
+
+	if (t == 0)
+		return !(v & TILE_ANIMATED);
+	if (v & TILE_ANIMATED)
+		return (int)t <= map->nanims;
+	return !map->tiles || (int)t <= map->tiles->count;
+}
+
+/* are the values in h (shaped as s_valid() says) ones that
+   can be put back: every npc somewhere in its script, every
+   animation on one of its frames, every cell and object in
+   the map, and a tile?  nothing is restored unless so. */
+static int
+s_sane(struct shead *h, struct world *w)
+{
+	struct map *map = w->map;
+	struct snpc *n;
+	struct sanim *a;
+	struct scell *c;
+	struct sobject *o;
+	int32_t *cells;
+	int i;
+
+	for (i = 0; i < h->nnpcs; i++) {
+		n = &s_npcs(h)[i];
+		if (n->pc < 0 || n->pc >= script_length(w->npcs->state[i].program))
+			return 0;
+	}
+	if (!(h->flags & SNAPSHOT_MAP))
+		return 1;
+
+	a = s_anims(h);
+	for (i = 0; i < h->nanims; i++)
+		if (a[i].frame < 0 || a[i].frame >= map->anims[i].nframes)
+			return 0;
+
+	if (h->flags & SNAPSHOT_DELTA) {
+		c = s_changes(h);
+		for (i = 0; i < h->ncells; i++)
+			if (c[i].i < 0 || c[i].i >= map->width * map->height || !s_tile(map, c[i].v))
+				return 0;
+	} else {
+		cells = s_cells(h);
+		for (i = 0; i < h->ncells; i++)
+			if (!s_tile(map, cells[i]))
+				return 0;
+	}
+
+	o = s_objects(h);
+	for (i = 0; i < h->nobjects; i++)
+		if (o[i].x < 0 || o[i].x >= map->width || o[i].y < 0 || o[i].y >= map->height
+		 || !s_tile(map, o[i].v))
+			return 0;
+	return 1;
+}
+
+struct objects {
+	struct sobject *out;
+	int n;
+
+	/* for a delta, the base's objects, merged against */
+	struct layer   *l;
+	struct sobject *base;
+	int nbase, j;
+};
+
+static void
+s_object(int x, int y, int v, void *data)
+{
+	struct objects *o = data;
+
+	o->out[o->n].x = x;
+	o->out[o->n].y = y;
+	o->out[o->n].v = v;
+	o->n++;
+}
+
+/* both the layer and the base list are in layer_order(), so
+   a single merge pass finds what was added, changed and
+   removed since the base was taken */
+static void
+s_object_delta(int x, int y, int v, void *data)
+{
+	struct objects *o = data;
+	struct sobject *b;
+	unsigned k, bk;
+
+	k = layer_order(o->l, x, y);
+	for (; o->j < o->nbase; o->j++) {
+		b  = &o->base[o->j];
+		bk = layer_order(o->l, b->x, b->y);
+		if (bk > k) break;
+		if (bk == k) {
+			o->j++;
+			if (b->v != v)
+				s_object(x, y, v, o);
+			return;
+		}
+		s_object(b->x, b->y, TILE_NONE, o);
+	}
+	s_object(x, y, v, o);
+}
+
+static void
+s_save_npc(struct snpc *o, struct sprite *s, struct npc *n)
+{
+	o->at[0]    = s->at.x;
+	o->at[1]    = s->at.y;
+	o->delta[0] = s->delta.x;
+	o->delta[1] = s->delta.y;
+	o->pc       = n->pc;
+	o->wait     = n->wait;
+	o->seed     = n->seed;
+	o->unused   = 0;
+	memcpy(o->r, n->r, sizeof(o->r));
+}
+
+int
+snapshot_save(struct world *w, const struct snapshot *base, struct snapshot *s)
+{
+	struct map *map = w->map;
+	struct shead *h, *bh = NULL;
+	struct sanim *a;
+	struct scell *c;
+	struct objects o;
+	int32_t *from;
+	size_t size;
+	int i, j, k, n, cells;
+
+	assert(w->map != NULL);
+	assert(base != s);
+
+	cells = map->width * map->height;
+	if (base) {
+		if (w->shared || !s_valid(base, w))
+			return -1;
+		bh = s_head(base);
+		if (bh->flags & SNAPSHOT_DELTA || !(bh->flags & SNAPSHOT_MAP))
+			return -1;
+	}
+
+	/* worst case: every cell and object changed, and every
+	   one of the base's objects gone */
+	size = sizeof(struct shead);
+	size += (w->npcs ? w->npcs->n : 0) * sizeof(struct snpc);
+	if (!w->shared) {
+		size += map->nanims * sizeof(struct sanim);
+		size += base ? cells * sizeof(struct scell) : cells * sizeof(int32_t);
+		size += (layer_count(map->objects) + (bh ? bh->nobjects : 0)) * sizeof(struct sobject);
+	}
+	s_reserve(s, size);
+
+	h = s_head(s);
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+	h->version  = SNAPSHOT_VERSION;
+	h->flags    = (base ? SNAPSHOT_DELTA : 0) | (w->shared ? 0 : SNAPSHOT_MAP);
+	h->id       = (clock_monotonic() << 16) ^ (uint64_t)SDL_AtomicAdd(&SERIAL, 1);
+	h->base     = bh ? bh->id : 0;
+	h->width    = map->width;
+	h->height   = map->height;
+	h->nanims   = w->shared ? 0 : map->nanims;
+	h->now      = w->clock.now;
+	h->scale    = w->clock.scale;
+	h->paused   = w->clock.paused;
+	h->at[0]    = w->hero->at.x;
+	h->at[1]    = w->hero->at.y;
+	h->delta[0] = w->hero->delta.x;
+	h->delta[1] = w->hero->delta.y;
+	h->frame    = w->hero->frame;
+	h->view[0]  = w->viewport.at.x;
+	h->view[1]  = w->viewport.at.y;
+	h->animate  = s_pending(&w->timers, &w->animate);
+
+	h->nnpcs = w->npcs ? w->npcs->n : 0;
+	for (i = 0; i < h->nnpcs; i++)
+		s_save_npc(&s_npcs(h)[i], &w->npcs->sprites[i], &w->npcs->state[i]);
+
+	if (!(h->flags & SNAPSHOT_MAP)) {
+		s->size = h->size = (unsigned char *)s_anims(h) - s->data;
+		s->id   = h->id;
+		return 0;
+	}
+
+	a = s_anims(h);
+	for (i = 0; i < h->nanims; i++) {
+		a[i].frame  = map->anims[i].frame;
+		a[i].unused = 0;
+		a[i].next   = s_pending(&w->timers, &map->anims[i].timer);
+	}
+
+	memset(&o, 0, sizeof(o));
+	if (!base) {
+		h->ncells = cells;
+		memcpy(s_cells(h), map->cells[0], cells * sizeof(int32_t));
+		o.out = s_objects(h);
+		layer_scan(map->objects, 0, 0, map->width, map->height, s_object, &o);
+	} else {
+		/* most of the floor never changes; skip it a block
+		   at a time, and only look closer where it has */
+		from = s_cells(bh);
+		c = s_changes(h);
+		for (i = n = 0; i < cells; i += SNAPSHOT_BLOCK) {
+			k = cells - i < SNAPSHOT_BLOCK ? cells - i : SNAPSHOT_BLOCK;
+			if (memcmp(&map->cells[0][i], &from[i], k * sizeof(int32_t)) == 0)
+				continue;
+			for (k += i, j = i; j < k; j++) {
+				if (map->cells[0][j] == from[j]) continue;
+				c[n].i = j;
+				c[n].v = map->cells[0][j];
+				n++;
+			}
+		}
+		h->ncells = n;
+
+		o.out   = s_objects(h);
+		o.l     = map->objects;
+		o.base  = s_objects(bh);
+		o.nbase = bh->nobjects;
+		layer_scan(map->objects, 0, 0, map->width, map->height, s_object_delta, &o);
+		for (; o.j < o.nbase; o.j++)
+			s_object(o.base[o.j].x, o.base[o.j].y, TILE_NONE, &o);
+	}
+	h->nobjects = o.n;
+
+	s->size = h->size = (unsigned char *)(s_objects(h) + h->nobjects) - s->data;
+	s->id   = h->id;
+	return 0;
+}
+
+/* bring the map's objects in line with want (n of them, in
+   layer_order(); a TILE_NONE is one that should be gone) */
+static void
+s_restore_objects(struct map *map, struct sobject *want, int n)
+{
+	struct objects have;
+	int i, j;
+	unsigned hk, wk;
+
+	memset(&have, 0, sizeof(have));
+	have.out = tallocate(MEM_ENTITY, layer_count(map->objects) + 1, sizeof(struct sobject));
+	layer_scan(map->objects, 0, 0, map->width, map->height, s_object, &have);
+
+	for (i = j = 0; i < have.n || j < n; ) {
+		hk = i < have.n ? layer_order(map->objects, have.out[i].x, have.out[i].y) : ~0u;
+		wk = j < n      ? layer_order(map->objects, want[j].x, want[j].y)         : ~0u;
+		if (hk < wk) {
+			map_set(map, MAP_OBJECTS, have.out[i].x, have.out[i].y, TILE_NONE);
+			i++;
+		} else {
+			if (hk == wk) i++;
+			map_set(map, MAP_OBJECTS, want[j].x, want[j].y, want[j].v);
+			j++;
+		}
+	}
+	release(have.out);
+}
+
+/* a delta's objects, laid over its base's: both lists are in
+   layer_order(), and so is what comes out */
+static struct sobject *
+s_merge_objects(struct map *map, struct shead *base, struct shead *h, int *n)
+{
+	struct sobject *out, *b, *d;
+	int i, j, k;
+	unsigned bk, dk;
+
+	b   = s_objects(base);
+	d   = s_objects(h);
+	out = tallocate(MEM_ENTITY, base->nobjects + h->nobjects + 1, sizeof(struct sobject));
+	for (i = j = k = 0; i < base->nobjects || j < h->nobjects; ) {
+		bk = i < base->nobjects ? layer_order(map->objects, b[i].x, b[i].y) : ~0u;
+		dk = j < h->nobjects    ? layer_order(map->objects, d[j].x, d[j].y) : ~0u;
+		if (bk < dk) {
+			out[k++] = b[i++];
+		} else {
+			if (bk == dk) i++;
+			out[k++] = d[j++];
+		}
+	}
+	*n = k;
+	return out;
+}
+
+int
+snapshot_restore(struct world *w, const struct snapshot *s, const struct snapshot *base)
+{
+	struct map *map = w->map;
+	struct shead *h, *full;
+	struct snpc *n;
+	struct sanim *a;
+	struct scell *c;
+	struct sobject *o;
+	int32_t *from, v;
+	int i, j, k, no, ic, nc, cells;
+
+	assert(w->map != NULL);
+
+	if (!s_valid(s, w))
+		return -1;
+	h = full = s_head(s);
+	if (h->flags & SNAPSHOT_DELTA) {
+		if (!s_valid(base, w) || s_head(base)->id != h->base
+		 || s_head(base)->flags & SNAPSHOT_DELTA)
+			return -1;
+		full = s_head(base);
+	}
+	if (!!(h->flags & SNAPSHOT_MAP) == !!w->shared)
+		return -1;
+	if (!s_sane(h, w) || (full != h && !s_sane(full, w)))
+		return -1;
+
+	/* the timers go back to how they were, relative to the
+	   clock; there's no picking them out of the wheel, so
+	   it's emptied and they are all scheduled afresh, with
+	   whatever callbacks world_load() gave them */
+	timer_cancel(&w->timers, &w->animate);
+	for (i = 0; i < h->nanims; i++)
+		timer_cancel(&w->timers, &map->anims[i].timer);
+	for (i = 1; i < w->nviews; i++)
+		timer_cancel(&w->timers, &w->views[i].animate);
+
+	w->clock.now    = h->now;
+	w->clock.scale  = h->scale;
+	w->clock.paused = h->paused;
+	timers_init(&w->timers, w->clock.now);
+
+	w->hero->at.x    = h->at[0];
+	w->hero->at.y    = h->at[1];
+	w->hero->delta.x = h->delta[0];
+	w->hero->delta.y = h->delta[1];
+	w->hero->frame   = h->frame;
+	w->viewport.at.x = h->view[0];
+	w->viewport.at.y = h->view[1];
+
+	for (i = 0; i < h->nnpcs; i++) {
+		n = &s_npcs(h)[i];
+		w->npcs->sprites[i].at.x    = n->at[0];
+		w->npcs->sprites[i].at.y    = n->at[1];
+		w->npcs->sprites[i].delta.x = n->delta[0];
+		w->npcs->sprites[i].delta.y = n->delta[1];
+		w->npcs->state[i].pc   = n->pc;
+		w->npcs->state[i].wait = n->wait;
+		w->npcs->state[i].seed = n->seed;
+		memcpy(w->npcs->state[i].r, n->r, sizeof(n->r));
+	}
+	if (h->animate && w->animate.fn)
+		timer_schedule(&w->timers, &w->animate, h->animate * TIMER_RESOLUTION,
+		               w->animate.period * TIMER_RESOLUTION, w->animate.fn, w->animate.data);
+
+	/* other players (in split screen) aren't saved; they
+	   stay put, and their walk cycles just carry on */
+	for (i = 1; i < w->nviews; i++)
+		timer_schedule(&w->timers, &w->views[i].animate, w->views[i].animate.period * TIMER_RESOLUTION,
+		               w->views[i].animate.period * TIMER_RESOLUTION, w->views[i].animate.fn, w->views[i].animate.data);
+
+	if (!(h->flags & SNAPSHOT_MAP))
+		return 0;
+
+	/* map->ticks only ever goes forward, or the render cache
+	   would think its chunks newer than the frames on them */
+	a = s_anims(h);
+	for (i = 0; i < h->nanims; i++) {
+		if (map->anims[i].frame != a[i].frame) {
+			map->anims[i].frame   = a[i].frame;
+			map->anims[i].changed = ++map->ticks;
+		}
+		if (a[i].next && map->anims[i].timer.fn)
+			timer_schedule(&w->timers, &map->anims[i].timer, a[i].next * TIMER_RESOLUTION,
+			               map->anims[i].period, map->anims[i].timer.fn, map->anims[i].timer.data);
+	}
+
+	/* what each cell should be is the base's, unless the
+	   delta (in cell order) changes it; blocks where the map
+	   matches the base, and the delta has nothing, are skipped */
+	cells = map->width * map->height;
+	from  = s_cells(full);
+	c     = h != full ? s_changes(h) : NULL;
+	nc    = h != full ? h->ncells : 0;
+	for (i = ic = 0; i < cells; i += SNAPSHOT_BLOCK) {
+		k = cells - i < SNAPSHOT_BLOCK ? cells - i : SNAPSHOT_BLOCK;
+		while (ic < nc && c[ic].i < i)
+			ic++;
+		if ((ic == nc || c[ic].i >= i + k)
+		 && memcmp(&map->cells[0][i], &from[i], k * sizeof(int32_t)) == 0)
+			continue;
+		for (k += i, j = i; j < k; j++) {
+			v = ic < nc && c[ic].i == j ? c[ic++].v : from[j];
+			if (map->cells[0][j] != v)
+				map_set(map, MAP_FLOOR, j / map->height, j % map->height, v);
+		}
+	}
+
+	if (h != full) {
+		o = s_merge_objects(map, full, h, &no);
+		s_restore_objects(map, o, no);
+		release(o);
+	} else {
+		s_restore_objects(map, s_objects(full), full->nobjects);
+	}
+	return 0;
+}
+
+int
+snapshot_write(const struct snapshot *s, const char *path)
+{
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "failed to write snapshot %s: %s (error %d)\n",
+				path, strerror(errno), errno);
+		return -1;
+	}
+	ok = fwrite(s->data, 1, s->size, f) == s->size;
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "failed to write snapshot %s: %s (error %d)\n",
+				path, strerror(errno), errno);
+		return -1;
+	}
+	return 0;
+}
+
+int
+snapshot_read(struct snapshot *s, const char *path)
+{
+	FILE *f;
+	long n;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "failed to read snapshot %s: %s (error %d)\n",
+				path, strerror(errno), errno);
+		return -1;
+	}
+	if (fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < (long)sizeof(struct shead)
+	 || fseek(f, 0, SEEK_SET) != 0) {
+		fprintf(stderr, "failed to read snapshot %s: not a snapshot\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	s_reserve(s, n);
+	s->size = fread(s->data, 1, n, f);
+	fclose(f);
+	if (s->size != (size_t)n || memcmp(s_head(s)->magic, SNAPSHOT_MAGIC, 4) != 0) {
+		fprintf(stderr, "failed to read snapshot %s: not a snapshot\n", path);
+		s->size = 0;
+		return -1;
+	}
+	s->id = s_head(s)->id;
+	return 0;
+}
+
+void
+snapshot_release(struct snapshot *s)
+{
+	release(s->data);
+	memset(s, 0, sizeof(*s));
+}
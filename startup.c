@@ -0,0 +1,174 @@
+#include "prisma.h"
+
+/* startup, as a dependency graph.
+
+   parsing the map, decoding tilesets and bringing up video
+   and input have little to do with one another, so instead
+   of running them one after the other, each is a stage that
+   lists the stages it has to wait for.  stages flagged
+   STAGE_MAIN (anything touching video or input, which SDL
+   wants on the main thread) run there, in order, as they
+   become ready; every other stage gets a thread of its own.
+
+   each stage is timed against startup_begin(), so that
+   startup_report() can show where time-to-first-frame went,
+   and what overlapped with what. */
+
+void
+startup_begin(struct startup *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->epoch = clock_monotonic();
+}
+
+int
+startup_stage(struct startup *s, const char *name, void (*fn)(void *), void *data,
+              int flags, unsigned after)
+{
+	struct stage *st;
+
+	assert(s->n < STARTUP_STAGES);
+	assert(after < (1u << s->n) || after == 0);  /* only earlier stages */
+
+	st = &s->stages[s->n];
+	st->name  = name;
+	st->fn    = fn;
+	st->data  = data;
+	st->flags = flags;
+	st->after = after;
+	st->owner = s;
+	return s->n++;
+}
+
+void
+startup_mark(struct startup *s, const char *name)
+{
+	struct stage *st;
+
+	assert(s->n < STARTUP_STAGES);
+	st = &s->stages[s->n++];
+	st->name  = name;
+	st->flags = STAGE_MAIN;
+	st->start = st->end = clock_monotonic() - s->epoch;
+}
+
+static void
+s_run(struct startup *s, struct stage *st)
+{
+	st->start = clock_monotonic() - s->epoch;
+	st->fn(st->data);
+	st->end = clock_monotonic() - s->epoch;
+}
+
+static int
+s_worker(void *p)
+{
+	struct stage *st = p;
+	struct startup *s = st->owner;
+
+	SDL_LockMutex(s->lock);
+	while ((s->done & st->after) != st->after)
+		SDL_CondWait(s->cond, s->lock);
+	SDL_UnlockMutex(s->lock);
+
+	s_run(s, st);
+
+	SDL_LockMutex(s->lock);
+	s->done |= 1u << (st - s->stages);
+	SDL_CondBroadcast(s->cond);
+	SDL_UnlockMutex(s->lock);
+	return 0;
+}
+
+void
+startup_run(struct startup *s)
+{
+	SDL_Thread *threads[STARTUP_STAGES];
+	unsigned all, started;
+	int i;
+
+	s->lock = SDL_CreateMutex();
+	s->cond = SDL_CreateCond();
+	if (!s->lock || !s->cond) {
+		fprintf(stderr, "failed to set up startup: %s\n", SDL_GetError());
+		exit(EXIT_INT_FAILURE);
+	}
+
+	all = (1u << s->n) - 1;
+	started = 0;
+	for (i = 0; i < s->n; i++) {
+		threads[i] = NULL;
+		if (s->stages[i].flags & STAGE_MAIN)
+			continue;
+		threads[i] = SDL_CreateThread(s_worker, s->stages[i].name, &s->stages[i]);
+		if (threads[i]) {
+			s->stages[i].thread = i + 1;
+			started |= 1u << i;
+		} else {
+			/* no thread; it can just as well run here */
+			s->stages[i].flags |= STAGE_MAIN;
+		}
+	}
+
+	SDL_LockMutex(s->lock);
+	while (s->done != all) {
+		for (i = 0; i < s->n; i++)
+			if (!(started & (1u << i)) && (s->done & s->stages[i].after) == s->stages[i].after)
+				break;
+		if (i == s->n) {
+			SDL_CondWait(s->cond, s->lock);
+			continue;
+		}
+
+		started |= 1u << i;
+		SDL_UnlockMutex(s->lock);
+		s_run(s, &s->stages[i]);
+		SDL_LockMutex(s->lock);
+		s->done |= 1u << i;
+		SDL_CondBroadcast(s->cond);
+	}
+	SDL_UnlockMutex(s->lock);
+
+	for (i = 0; i < s->n; i++)
+		if (threads[i])
+			SDL_WaitThread(threads[i], NULL);
+	SDL_DestroyCond(s->cond);
+	SDL_DestroyMutex(s->lock);
+}
+
+#define STARTUP_BAR 40
+
+void
+startup_report(struct startup *s, FILE *out)
+{
+	struct stage *st;
+	uint64_t total, busy;
+	char bar[STARTUP_BAR + 1];
+	int i, a, b;
+
+	total = busy = 0;
+	for (i = 0; i < s->n; i++) {
+		if (s->stages[i].end > total)
+			total = s->stages[i].end;
+		busy += s->stages[i].end - s->stages[i].start;
+	}
+	if (!total) total = 1;
+
+	fprintf(out, "startup: %-12s %-6s %9s %9s %9s\n", "stage", "thread", "start", "end", "took");
+	for (i = 0; i < s->n; i++) {
+		st = &s->stages[i];
+		a = st->start * STARTUP_BAR / total;
+		b = st->end   * STARTUP_BAR / total;
+		if (a >= STARTUP_BAR) a = STARTUP_BAR - 1;
+		memset(bar, ' ', STARTUP_BAR);
+		memset(bar + a, st->fn ? '#' : '|', b > a ? b - a : 1);
+		bar[STARTUP_BAR] = '\0';
+
+		if (st->thread) fprintf(out, "startup: %-12s %-6d", st->name, st->thread);
+		else            fprintf(out, "startup: %-12s %-6s", st->name, "main");
+		fprintf(out, " %7.2fms %7.2fms %7.2fms [%s]\n",
+			st->start / 1e6, st->end / 1e6, (st->end - st->start) / 1e6, bar);
+	}
+	fprintf(out, "startup: %.2fms to %s; %.2fms of work (%.2fx overlap)\n",
+		total / 1e6, s->stages[s->n - 1].name, busy / 1e6, (double)busy / total);
+}
@@ -0,0 +1,174 @@
+#include "prisma.h"
+#include <ctype.h>
+
+/* on-screen text, from a bitmap font.
+
+   the font is an ordinary tileset (a .png and a .nfo), with
+   one glyph per tile, starting at TEXT_FIRST; anything it has
+   no glyph for comes out as a '?'.
+
+   putting a string up glyph by glyph, every frame, would cost
+   a blit per character.  instead, text_layout() composites the
+   whole string into a strip, once, and hands it back dressed
+   up as a one-tile tileset, so it goes to the screen through
+   the same draw() as any tile, in a single blit.  strips are
+   kept in a small LRU cache, keyed by the string, so a HUD
+   that says the same thing from one frame to the next is only
+   laid out when it changes. */
+
+#define TEXT_SLOTS  32
+#define TEXT_FIRST  ' '
+
+struct strip {
+	char          *s;       /* NULL while the slot is free */
+	uint32_t       hash;
+	unsigned long  used;
+	struct tileset tiles;   /* one tile, the size of the text */
+	unsigned char  opacity;
+};
+
+struct text {
+	struct arena   *arena;  /* owns the font */
+	struct tileset *font;
+	unsigned long   clock;
+	struct strip    slots[TEXT_SLOTS];
+};
+
+struct text *
+text_new(const char *path)
+{
+	struct text *t;
+
+	t = tallocate(MEM_RENDER, 1, sizeof(struct text));
+	t->arena = arena_new(MEM_RENDER);
+	t->font  = tileset_read(t->arena, path);
+	if (!t->font) {
+		arena_free(t->arena);
+		release(t);
+		return NULL;
+	}
+	return t;
+}
+
+void
+text_free(struct text *t)
+{
+	int i;
+
+	if (!t) return;
+	for (i = 0; i < TEXT_SLOTS; i++) {
+		release(t->slots[i].s);
+		release_surface(t->slots[i].tiles.surface);
+	}
+	arena_free(t->arena);
+	release(t);
+}
+
+static uint32_t
+s_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* composite s into the slot's strip, growing it if need be */
+static int
+s_layout(struct text *t, struct strip *st, const char *s)
+{
+	SDL_Surface *strip;
+	SDL_Rect src, dst, box;
+	const char *p;
+	int gw, gh, cols, lines, n, g;
+
+	gw = t->font->tile.width;
+	gh = t->font->tile.height;
+
+	cols = lines = 1;
+	for (p = s, n = 0; *p; p++) {
+		if (*p == '\n') { lines++; n = 0; continue; }
+		if (++n > cols) cols = n;
+	}
+
+	/* a pixel of margin on the top and left, to match the
+	   space each glyph leaves on its bottom and right */
+	box.x = box.y = 0;
+	box.w = cols  * gw + 1;
+	box.h = lines * gh + 1;
+
+	strip = st->tiles.surface;
+	if (!strip || strip->w < box.w || strip->h < box.h) {
+		release_surface(strip);
+		strip = mem_surface(MEM_RENDER,
+			SDL_CreateRGBSurface(0, box.w, box.h, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000));
+		st->tiles.surface = strip;
+		if (!strip) {
+			fprintf(stderr, "failed to create text surface: %s\n", SDL_GetError());
+			return -1;
+		}
+		SDL_SetSurfaceBlendMode(strip, SDL_BLENDMODE_BLEND);
+	}
+	SDL_FillRect(strip, &box, SDL_MapRGBA(strip->format, 0, 0, 0, 160));
+
+	src.w = gw;
+	src.h = gh;
+	dst.x = dst.y = 1;
+	for (p = s; *p; p++) {
+		if (*p == '\n') {
+			dst.x  = 1;
+			dst.y += gh;
+			continue;
+		}
+
+		g = toupper((unsigned char)*p) - TEXT_FIRST;
+		if (g < 0 || g >= t->font->count)
+			g = '?' - TEXT_FIRST;
+		if (tileset_opacity(t->font, g) != OPACITY_CLEAR) {
+			src.x = gw * (g % t->font->width);
+			src.y = gh * (g / t->font->width);
+			SDL_BlitSurface(t->font->surface, &src, strip, &dst);
+		}
+		dst.x += gw;
+	}
+
+	st->opacity            = OPACITY_MIXED;
+	st->tiles.opacity      = &st->opacity;
+	st->tiles.width        = 1;
+	st->tiles.count        = 1;
+	st->tiles.tile.width   = box.w;
+	st->tiles.tile.height  = box.h;
+	return 0;
+}
+
+struct tileset *
+text_layout(struct text *t, const char *s)
+{
+	struct strip *st, *lru;
+	uint32_t h;
+	int i;
+
+	h   = s_hash(s);
+	lru = &t->slots[0];
+	for (i = 0; i < TEXT_SLOTS; i++) {
+		st = &t->slots[i];
+		if (st->s && st->hash == h && strcmp(st->s, s) == 0) {
+			st->used = ++t->clock;
+			return &st->tiles;
+		}
+		if (!st->s || (lru->s && st->used < lru->used))
+			lru = st;
+	}
+
+	release(lru->s);
+	lru->s = NULL;
+	if (s_layout(t, lru, s) != 0)
+		return NULL;
+
+	lru->s    = astring("%s", s);
+	lru->hash = h;
+	lru->used = ++t->clock;
+	return &lru->tiles;
+}
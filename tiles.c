@@ -1,55 +1,365 @@
 #include "prisma.h"
 
-struct tileset *
-tileset_read(const char *path)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* tileset atlas cache.
+
+   decoding a .png is most of what it costs to load a tileset,
+   so the decoded pixels (in the 32-bit ARGB layout the window
+   surface and the render cache blit fastest from) are kept in
+   an .atlas file, along with the .nfo geometry and each tile's
+   opacity class.  on the next start the file is mmap()ed and
+   handed to SDL as-is; nothing is decoded, parsed or copied.
+
+   the cache lives next to the tileset, or in $PRISMA_CACHE if
+   that is set.  it is keyed by a hash of the .png and the .nfo,
+   so editing either one (or a half-written cache) just means
+   decoding the .png again, and rewriting the atlas. */
+
+#define ATLAS_MAGIC    "PRISMATL"
+#define ATLAS_VERSION  1
+#define ATLAS_ALIGN    64
+
+struct atlas {
+	char     magic[8];
+	uint32_t version;
+	uint32_t format;        /* SDL_PIXELFORMAT_* of the pixels */
+	uint64_t hash;          /* of the .png, then the .nfo */
+	int32_t  w, h, pitch;
+	int32_t  tile_w, tile_h;
+	int32_t  width;         /* tiles per row */
+	int32_t  count;         /* opacity bytes, right after the header */
+	uint32_t pixels;        /* offset of the first row */
+};
+
+struct mapping {
+	void  *base;
+	size_t len;
+};
+
+static void
+s_free_surface(void *surface)
 {
-	struct tileset *tiles;
-	char *p   = NULL;
-	FILE *nfo = NULL;
+	release_surface(surface);
+}
+
+static void
+s_unmap(void *p)
+{
+	struct mapping *m = p;
+	munmap(m->base, m->len);
+}
+
+int
+tileset_opacity(struct tileset *tiles, int t)
+{
+	return t >= 0 && t < tiles->count ? tiles->opacity[t] : OPACITY_CLEAR;
+}
+
+/* sort every tile into clear, opaque or mixed, by alpha */
+static void
+s_classify(struct tileset *tiles)
+{
+	SDL_Surface *s = tiles->surface;
+	Uint8 r, g, b, a;
+	int t, x, y, x0, y0, seen;
+
+	for (t = 0; t < tiles->count; t++) {
+		if (!s->format->Amask) {
+			tiles->opacity[t] = OPACITY_OPAQUE;
+			continue;
+		}
+		if (s->format->BytesPerPixel != 4) {
+			tiles->opacity[t] = OPACITY_MIXED;
+			continue;
+		}
+
+		x0 = tiles->tile.width  * (t % tiles->width);
+		y0 = tiles->tile.height * (t / tiles->width);
+		seen = 0;
+		for (y = y0; y < y0 + tiles->tile.height; y++) {
+			for (x = x0; x < x0 + tiles->tile.width; x++) {
+				SDL_GetRGBA(((Uint32 *)((Uint8 *)s->pixels + y * s->pitch))[x], s->format, &r, &g, &b, &a);
+				seen |= a == 0   ? 1
+				      : a == 255 ? 2 : 3;
+			}
+		}
+		tiles->opacity[t] = seen == 1 ? OPACITY_CLEAR
+		                  : seen == 2 ? OPACITY_OPAQUE : OPACITY_MIXED;
+	}
+}
+
+/* FNV-1a, 64-bit */
+static uint64_t
+s_hash(uint64_t h, const unsigned char *p, size_t n)
+{
+	while (n--) {
+		h ^= *p++;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+/* the whole of a file, NUL-terminated; release() it */
+static char *
+s_slurp(const char *file, size_t *n)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = tallocate(MEM_TILESET, st.st_size + 1, 1);
+	for (*n = 0; *n < (size_t)st.st_size; ) {
+		ssize_t got = read(fd, buf + *n, st.st_size - *n);
+		if (got <= 0) break;
+		*n += got;
+	}
+	close(fd);
+	if (*n != (size_t)st.st_size) {
+		release(buf);
+		return NULL;
+	}
+	buf[*n] = '\0';
+	return buf;
+}
+
+char *
+tileset_cachefile(const char *path)
+{
+	const char *dir, *base;
+
+	dir = getenv("PRISMA_CACHE");
+	if (!dir || !*dir)
+		return astring("%s.atlas", path);
+
+	base = strrchr(path, '/');
+	return astring("%s/%s.atlas", dir, base ? base + 1 : path);
+}
+
+/* map a cached atlas in, if there is one, and it is current */
+static int
+s_warm(struct arena *arena, struct tileset *tiles, const char *file, uint64_t hash)
+{
+	struct mapping *m;
+	struct atlas *a;
+	struct stat st;
+	SDL_Surface *s;
+	void *base;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct atlas)) {
+		close(fd);
+		return -1;
+	}
+	/* private and writable, so that nothing SDL does to the
+	   pixels can ever reach the file */
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+
+	a = base;
+	if (memcmp(a->magic, ATLAS_MAGIC, sizeof(a->magic)) != 0
+	 || a->version != ATLAS_VERSION
+	 || a->format  != SDL_PIXELFORMAT_ARGB8888
+	 || a->hash    != hash
+	 || a->w <= 0 || a->h <= 0 || a->pitch < a->w * 4
+	 || a->tile_w <= 0 || a->tile_h <= 0 || a->width <= 0
+	 || a->count != a->width * (a->h / a->tile_h)
+	 || a->pixels < sizeof(struct atlas) + a->count
+	 || a->pixels % ATLAS_ALIGN != 0
+	 || a->pixels + (uint64_t)a->pitch * a->h != (uint64_t)st.st_size) {
+		munmap(base, st.st_size);
+		return -1;
+	}
+
+	s = SDL_CreateRGBSurfaceFrom((char *)base + a->pixels, a->w, a->h, 32, a->pitch,
+	                             0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+	if (!s) {
+		munmap(base, st.st_size);
+		return -1;
+	}
+
+	/* the surface goes first; cleanups run last-in, first-out */
+	m = arena_alloc(arena, 1, sizeof(struct mapping));
+	m->base = base;
+	m->len  = st.st_size;
+	arena_defer(arena, s_unmap, m);
+
+	SDL_SetSurfaceBlendMode(s, SDL_BLENDMODE_BLEND);
+	tiles->surface     = mem_surface(MEM_TILESET, s);
+	arena_defer(arena, s_free_surface, tiles->surface);
+	tiles->tile.width  = a->tile_w;
+	tiles->tile.height = a->tile_h;
+	tiles->width       = a->width;
+	tiles->count       = a->count;
+	tiles->opacity     = (unsigned char *)base + sizeof(struct atlas);
+	return 0;
+}
+
+/* decode the .png the slow way, into the atlas pixel format */
+static int
+s_cold(struct arena *arena, struct tileset *tiles, const char *path, const char *nfo)
+{
+	SDL_Surface *img;
+	char *p;
 	int rc;
 
-	tiles = allocate(1, sizeof(struct tileset));
 	p = astring("%s.png", path);
-
-	tiles->surface = IMG_Load(p);
+	img = IMG_Load(p);
+	if (!img) {
+		fprintf(stderr, "failed to load tileset image %s: %s (error %d)\n",
+				p, strerror(errno), errno);
+		release(p);
+		return -1;
+	}
+	tiles->surface = mem_surface(MEM_TILESET, SDL_ConvertSurfaceFormat(img, SDL_PIXELFORMAT_ARGB8888, 0));
+	SDL_FreeSurface(img);
 	if (!tiles->surface) {
+		fprintf(stderr, "failed to convert tileset image %s: %s\n", p, SDL_GetError());
+		release(p);
+		return -1;
+	}
+	SDL_SetSurfaceBlendMode(tiles->surface, SDL_BLENDMODE_BLEND);
+	arena_defer(arena, s_free_surface, tiles->surface);
+	release(p);
+
+	rc = sscanf(nfo, "SPRITES %dx%d %d\n",
+		&tiles->tile.width,
+		&tiles->tile.height,
+		&tiles->width);
+	if (rc != 3 || tiles->tile.width <= 0 || tiles->tile.height <= 0 || tiles->width <= 0) {
+		fprintf(stderr, "failed to parse tileset metadata from %s.nfo: invalid format.\n", path);
+		return -1;
+	}
+
+	tiles->count   = tiles->width * (tiles->surface->h / tiles->tile.height);
+	tiles->opacity = arena_alloc(arena, tiles->count, sizeof(unsigned char));
+	if (SDL_MUSTLOCK(tiles->surface)) SDL_LockSurface(tiles->surface);
+	s_classify(tiles);
+	if (SDL_MUSTLOCK(tiles->surface)) SDL_UnlockSurface(tiles->surface);
+	return 0;
+}
+
+/* write the atlas out for next time.  it goes to a temporary
+   file first, so a reader never maps a partial one; failing
+   to write it (say, a read-only install) is not an error. */
+static void
+s_save(struct tileset *tiles, const char *file, uint64_t hash)
+{
+	static const char zeros[ATLAS_ALIGN];
+	SDL_Surface *s = tiles->surface;
+	struct atlas a;
+	char *tmp;
+	FILE *f;
+	int y, ok;
+
+	memset(&a, 0, sizeof(a));
+	memcpy(a.magic, ATLAS_MAGIC, sizeof(a.magic));
+	a.version = ATLAS_VERSION;
+	a.format  = SDL_PIXELFORMAT_ARGB8888;
+	a.hash    = hash;
+	a.w       = s->w;
+	a.h       = s->h;
+	a.pitch   = s->w * 4;
+	a.tile_w  = tiles->tile.width;
+	a.tile_h  = tiles->tile.height;
+	a.width   = tiles->width;
+	a.count   = tiles->count;
+	a.pixels  = (sizeof(a) + a.count + ATLAS_ALIGN - 1) / ATLAS_ALIGN * ATLAS_ALIGN;
+
+	tmp = astring("%s.%ld", file, (long)getpid());
+	f = fopen(tmp, "wb");
+	if (!f) {
+		release(tmp);
+		return;
+	}
+
+	ok = fwrite(&a, sizeof(a), 1, f) == 1
+	  && fwrite(tiles->opacity, 1, a.count, f) == (size_t)a.count
+	  && fwrite(zeros, 1, a.pixels - sizeof(a) - a.count, f) == a.pixels - sizeof(a) - a.count;
+
+	if (SDL_MUSTLOCK(s)) SDL_LockSurface(s);
+	for (y = 0; ok && y < s->h; y++)
+		ok = fwrite((Uint8 *)s->pixels + y * s->pitch, 4, s->w, f) == (size_t)s->w;
+	if (SDL_MUSTLOCK(s)) SDL_UnlockSurface(s);
+
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp, file) != 0)
+		unlink(tmp);
+	release(tmp);
+}
+
+struct tileset *
+tileset_read(struct arena *arena, const char *path)
+{
+	struct tileset *tiles;
+	char *p     = NULL;
+	char *png   = NULL;
+	char *nfo   = NULL;
+	char *cache = NULL;
+	size_t npng, nnfo;
+	uint64_t hash;
+
+	tiles = arena_alloc(arena, 1, sizeof(struct tileset));
+
+	p = astring("%s.png", path);
+	png = s_slurp(p, &npng);
+	if (!png) {
 		fprintf(stderr, "failed to load tileset image %s: %s (error %d)\n",
 				p, strerror(errno), errno);
 		goto failed;
 	}
-
-	free(p);
+	release(p);
 	p = astring("%s.nfo", path);
-
-	nfo = fopen(p, "r");
+	nfo = s_slurp(p, &nnfo);
 	if (!nfo) {
 		fprintf(stderr, "failed to load tileset metadata %s: %s (error %d)\n",
 				p, strerror(errno), errno);
 		goto failed;
 	}
-	rc = fscanf(nfo, "SPRITES %dx%d %d\n",
-		&tiles->tile.width,
-		&tiles->tile.height,
-		&tiles->width);
-	if (rc != 3) {
-		fprintf(stderr, "failed to parse tileset metadata from %s: invalid format.\n", p);
-		goto failed;
+
+	hash  = s_hash(0xcbf29ce484222325ull, (unsigned char *)png, npng);
+	hash  = s_hash(hash, (unsigned char *)nfo, nnfo);
+	cache = tileset_cachefile(path);
+
+	/* clear tiles need never be drawn, and nothing under an
+	   opaque one need be either.  a decoded tileset is also
+	   RLE-encoded, so its transparent runs are skipped
+	   wholesale; a mapped one is not, since SDL would encode
+	   it into a copy on the heap, and the mapping would have
+	   saved nothing. */
+	if (s_warm(arena, tiles, cache, hash) != 0) {
+		if (s_cold(arena, tiles, path, nfo) != 0)
+			goto failed;
+		s_save(tiles, cache, hash);
+		SDL_SetSurfaceRLE(tiles->surface, 1);
 	}
 
-	free(p);
-	fclose(nfo);
+	release(cache);
+	release(nfo);
+	release(png);
+	release(p);
 	return tiles;
 
 failed:
-	if (nfo) fclose(nfo);
-	free(p);
-	tileset_free(tiles);
+	release(cache);
+	release(nfo);
+	release(png);
+	release(p);
 	return NULL;
 }
-
-void
-tileset_free(struct tileset *t)
-{
-	if (t && t->surface) SDL_FreeSurface(t->surface);
-	free(t);
-}
@@ -0,0 +1,170 @@
+#include "prisma.h"
+
+/* a hierarchical timing wheel, a la Varghese & Lauck.
+
+   level 0 has one slot per tick; level L has one slot per
+   256^L ticks.  a timer is filed by how far away it is, so
+   scheduling and cancelling are O(1).  each time a level
+   wraps, the next slot up is re-filed ("cascaded") into the
+   finer levels below it, which amortizes to O(1) per timer. */
+
+#define SLOT_BITS  8
+#define SLOT_MASK  (TIMER_SLOTS - 1)
+
+#define s_empty(t)  ((t)->next == (t))
+
+static inline void
+s_unlink(struct timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+static inline void
+s_append(struct timer *head, struct timer *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void
+s_file(struct timers *w, struct timer *t)
+{
+	uint64_t due, delta;
+	int level;
+
+	due = t->due;
+	if (due < w->now) due = w->now; /* overdue; fire on the next tick */
+
+	delta = due - w->now;
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < (1ull << (SLOT_BITS * (level + 1))))
+			break;
+
+	/* too far out for the top level; park it in the farthest
+	   slot and let the cascade re-file it when it comes up. */
+	if (delta >= (1ull << (SLOT_BITS * TIMER_LEVELS)))
+		due = w->now + (1ull << (SLOT_BITS * TIMER_LEVELS)) - 1;
+
+	s_append(&w->slots[level][(due >> (SLOT_BITS * level)) & SLOT_MASK], t);
+}
+
+static void
+s_cascade(struct timers *w, int level)
+{
+	struct timer *head, *t;
+	struct timer list;
+
+	head = &w->slots[level][(w->now >> (SLOT_BITS * level)) & SLOT_MASK];
+	if (s_empty(head)) return;
+
+	/* move the whole slot aside, then re-file each timer */
+	list.next = head->next; list.next->prev = &list;
+	list.prev = head->prev; list.prev->next = &list;
+	head->next = head->prev = head;
+
+	while (!s_empty(&list)) {
+		t = list.next;
+		s_unlink(t);
+		s_file(w, t);
+	}
+}
+
+static void
+s_fire(struct timers *w)
+{
+	struct timer *head, *t;
+	struct timer list;
+
+	head = &w->slots[0][w->now & SLOT_MASK];
+	if (s_empty(head)) return;
+
+	list.next = head->next; list.next->prev = &list;
+	list.prev = head->prev; list.prev->next = &list;
+	head->next = head->prev = head;
+
+	/* callbacks may cancel or re-arm any timer, including
+	   ones still waiting in our local list; timer_cancel()
+	   just unlinks, so that is safe. */
+	while (!s_empty(&list)) {
+		t = list.next;
+		s_unlink(t);
+
+		if (t->due > w->now) { /* parked past the top level */
+			s_file(w, t);
+			continue;
+		}
+
+		w->pending--;
+		if (t->period) {
+			t->due += t->period;
+			s_file(w, t);
+			w->pending++;
+		}
+		t->fn(t, t->data);
+	}
+}
+
+void
+timers_init(struct timers *w, uint64_t now)
+{
+	int l, s;
+
+	w->now = now / TIMER_RESOLUTION;
+	w->pending = 0;
+	for (l = 0; l < TIMER_LEVELS; l++)
+		for (s = 0; s < TIMER_SLOTS; s++)
+			w->slots[l][s].next = w->slots[l][s].prev = &w->slots[l][s];
+}
+
+void
+timers_advance(struct timers *w, uint64_t now)
+{
+	uint64_t until;
+	int level;
+
+	until = now / TIMER_RESOLUTION;
+	while (w->now < until) {
+		if (!w->pending) { /* nothing to cascade or fire */
+			w->now = until;
+			break;
+		}
+
+		w->now++;
+		for (level = 1; level < TIMER_LEVELS; level++) {
+			if (w->now & ((1ull << (SLOT_BITS * level)) - 1))
+				break;
+			s_cascade(w, level);
+		}
+		s_fire(w);
+	}
+}
+
+void
+timer_schedule(struct timers *w, struct timer *t, uint64_t delay, uint64_t period,
+               void (*fn)(struct timer *, void *), void *data)
+{
+	assert(fn != NULL);
+
+	timer_cancel(w, t);
+	t->fn     = fn;
+	t->data   = data;
+	t->due    = w->now + (delay + TIMER_RESOLUTION - 1) / TIMER_RESOLUTION;
+	t->period = period / TIMER_RESOLUTION;
+	if (period && !t->period) t->period = 1;
+	if (t->due == w->now) t->due++;
+
+	s_file(w, t);
+	w->pending++;
+}
+
+void
+timer_cancel(struct timers *w, struct timer *t)
+{
+	if (!t->next) return;
+	s_unlink(t);
+	w->pending--;
+}
@@ -5,13 +5,7 @@
 void *
 allocate(size_t n, size_t size)
 {
-	void *p = calloc(n, size);
-	if (!p) {
-		fprintf(stderr, "failed to allocate memory: %s (error %d)\n",
-				strerror(errno), errno);
-		exit(EXIT_INT_FAILURE);
-	}
-	return p;
+	return tallocate(MEM_MISC, n, size);
 }
 
 void *
@@ -22,15 +16,19 @@ astring(const char *fmt, ...)
 	int rc;
 
 	va_start(ap, fmt);
-	rc = vasprintf(&s, fmt, ap);
+	rc = vsnprintf(NULL, 0, fmt, ap);
 	va_end(ap);
 
-	if (rc <= 0) {
+	if (rc < 0) {
 		fprintf(stderr, "failed to allocate memory: %s (error %d)\n",
 				strerror(errno), errno);
 		exit(EXIT_INT_FAILURE);
 	}
 
+	s = allocate(rc + 1, sizeof(char));
+	va_start(ap, fmt);
+	vsnprintf(s, rc + 1, fmt, ap);
+	va_end(ap);
 	return s;
 }
 
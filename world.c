@@ -1,25 +1,21 @@
 #include "prisma.h"
-#include <time.h>
-
-#define TILE_NONE      0
-#define TILE_SOLID  0x01
 
 #define world_dx(w) ((w)->map->tiles->tile.width  * (w)->scale)
 #define world_dy(w) ((w)->map->tiles->tile.height * (w)->scale)
 
+#define HERO_FRAME_TIME (200 * NSEC_PER_MSEC)
+#define HERO_SIGHT      9  /* field of view radius, in cells */
+
 static int inmap(struct map *map, int x, int y);
 static void draw(struct world *world, struct tileset *tiles, int t, int x, int y);
 
 static int
 inmap(struct map *map, int x, int y)
 {
-	return !(x < 0 || x > map->width ||
-	         y < 0 || y > map->height);
+	return !(x < 0 || x >= map->width ||
+	         y < 0 || y >= map->height);
 }
 
-#define istile(t) (((t) >> 24) != 0)
-#define tileno(t) (((t) >> 24) - 1)
-
 static void
 draw(struct world *world, struct tileset *tiles, int t, int x, int y)
 {
@@ -28,6 +24,8 @@ draw(struct world *world, struct tileset *tiles, int t, int x, int y)
 
 	if (tiles == NULL)
 		tiles = world->map->tiles;
+	if (tileset_opacity(tiles, t) == OPACITY_CLEAR)
+		return;
 
 	SDL_Rect src = {
 		.x = tiles->tile.width  * (t % tiles->width),
@@ -46,22 +44,135 @@ draw(struct world *world, struct tileset *tiles, int t, int x, int y)
 	SDL_BlitScaled(tiles->surface, &src, world->surface, &dst);
 }
 
+void world_draw(struct world *world, struct tileset *tiles, int t, int x, int y)
+{
+	draw(world, tiles, t, x, y);
+}
+
+/* put a string up at (x,y), in screen pixels */
+void world_text(struct world *world, int x, int y, const char *s)
+{
+	struct tileset *strip;
+
+	if (!world->text || !*s)
+		return;
+	strip = text_layout(world->text, s);
+	if (strip)
+		draw(world, strip, 0, x, y);
+}
+
+/* darken the cell drawn at (x,y) to the given light level */
+static void
+shade(struct world *world, int light, int x, int y)
+{
+	SDL_Rect dst = {
+		.x = x,
+		.y = y,
+		.w = world_dx(world),
+		.h = world_dy(world),
+	};
+
+	if (light >= 255)
+		return;
+	if (light == 0) {
+		/* no need to blend, if nothing will show through */
+		SDL_FillRect(world->surface, &dst, SDL_MapRGB(world->surface->format, 0, 0, 0));
+		return;
+	}
+
+	if (!world->shade) {
+		world->shade = mem_surface(MEM_RENDER,
+			SDL_CreateRGBSurface(0, dst.w, dst.h, 32, 0, 0, 0, 0));
+		if (!world->shade) {
+			fprintf(stderr, "failed to create shading surface: %s\n", SDL_GetError());
+			exit(EXIT_INT_FAILURE);
+		}
+		SDL_FillRect(world->shade, NULL, SDL_MapRGB(world->shade->format, 0, 0, 0));
+		SDL_SetSurfaceBlendMode(world->shade, SDL_BLENDMODE_BLEND);
+	}
+
+	SDL_SetSurfaceAlphaMod(world->shade, 255 - light);
+	SDL_BlitSurface(world->shade, NULL, world->surface, &dst);
+}
+
 
 struct world * world_new(int scale)
 {
 	struct world *world;
 
-	world = allocate(1, sizeof(struct world));
+	world = tallocate(MEM_ENTITY, 1, sizeof(struct world));
 	world->scale = scale;
+	clock_init(&world->clock, 0);
+	timers_init(&world->timers, world->clock.now);
 	return world;
 }
 
+/* let go of a view, and (past the first, which has the
+   world's own) its hero and fov */
+static void
+s_unview(struct world *world, int i)
+{
+	struct view *v = &world->views[i];
+
+	if (v->surface != world->surface)
+		SDL_FreeSurface(v->surface);
+	if (i > 0) {
+		timer_cancel(&world->timers, &v->animate);
+		fov_free(v->fov);
+		release(v->hero);
+	}
+	memset(v, 0, sizeof(*v));
+}
+
+/* release everything world_load() set up */
+static void
+s_unload(struct world *world)
+{
+	int i;
+
+	for (i = world->nviews - 1; i >= 0; i--)
+		s_unview(world, i);
+	world->nviews = 0;
+
+	/* whatever watches the map goes before the map does */
+	release_surface(world->shade);
+	rcache_free(world->cache);
+	overview_free(world->overview);
+	fov_free(world->fov);
+	npcs_free(world->npcs);
+
+	timer_cancel(&world->timers, &world->animate);
+	if (world->shared) {
+		/* the map (and its animation timers) belong to whoever
+		   passed them to world_headless(); the hero is ours */
+		release(world->hero);
+	} else {
+		for (i = 0; world->map && i < world->map->nanims; i++)
+			timer_cancel(&world->timers, &world->map->anims[i].timer);
+		map_free(world->map);
+		arena_free(world->arena);
+	}
+
+	world->npcs  = NULL;
+	world->shade = NULL;
+	world->cache = NULL;
+	world->overview = NULL;
+	world->fov   = NULL;
+	world->map   = NULL;
+	world->hero  = NULL;
+	world->arena = NULL;
+	world->shared = 0;
+}
+
 void world_free(struct world * world)
 {
 	if (!world) return;
 
+	s_unload(world);
+	particles_free(world->particles);
+	text_free(world->text);
 	if (world->window) SDL_DestroyWindow(world->window);
-	free(world);
+	release(world);
 }
 
 void world_unveil(struct world * world, const char *title, int w, int h)
@@ -84,31 +195,151 @@ void world_unveil(struct world * world, const char *title, int w, int h)
 		fprintf(stderr, "failed to get surface from window: %s\n", SDL_GetError());
 		exit(EXIT_INT_FAILURE);
 	}
+
+	/* a world loaded before its window is shown */
+	if (world->nviews)
+		world_split(world, world->nviews);
 }
 
-void world_load(struct world *world, const char *map, const char *hero)
+static void
+s_animate(struct timer *t, void *data)
+{
+	struct sprite *sprite = data;
+	sprite->frame = (sprite->frame + 1) % 2;
+}
+
+/* one timer per animated tile type, not per cell; each
+   is told which it is */
+struct tileanim {
+	struct map *map;
+	int id;
+};
+
+static void
+s_animate_tile(struct timer *t, void *data)
+{
+	struct tileanim *a = data;
+	map_animate(a->map, a->id);
+}
+
+/* a world with no window, no rendering and a virtual clock,
+   for simulation.  the map and the hero's tileset are only
+   ever read, so any number of headless worlds (on any number
+   of threads) can share one copy of them. */
+struct world * world_headless(struct map *map, struct tileset *hero, int scale)
+{
+	struct world *world;
+
+	assert(map != NULL);
+	assert(hero != NULL);
+
+	world = tallocate(MEM_ENTITY, 1, sizeof(struct world));
+	world->scale  = scale;
+	world->shared = 1;
+	clock_init(&world->clock, 1);
+	timers_init(&world->timers, world->clock.now);
+
+	world->map  = map;
+	world->hero = tallocate(MEM_ENTITY, 1, sizeof(struct sprite));
+	world->hero->tileset = hero;
+	world->hero->at.x = map->entry.x * world_dx(world);
+	world->hero->at.y = map->entry.y * world_dy(world);
+	world->npcs = npcs_new(map, world_dx(world), world_dy(world));
+
+	timer_schedule(&world->timers, &world->animate, HERO_FRAME_TIME, HERO_FRAME_TIME,
+	               s_animate, world->hero);
+	return world;
+}
+
+/* a world to draw another's frames in (on another thread):
+   the same window, but its own copy of the map, render cache
+   and fovs.  the hero's tileset and the text are borrowed,
+   and must be handed back before world_free(). */
+struct world * world_shadow(struct world *src)
+{
+	struct world *world;
+
+	world = world_new(src->scale);
+	world->window   = src->window;
+	world->surface  = src->surface;
+	world->viewport = src->viewport;
+	world->text     = src->text;
+
+	world->arena = arena_new(MEM_RENDER);
+	world->map   = map_clone(src->map);
+	world->hero  = arena_alloc(world->arena, 1, sizeof(struct sprite));
+	*world->hero = *src->hero;
+
+	world_finish(world);
+	world_split(world, src->nviews);
+	return world;
+}
+
+void world_begin(struct world *world)
 {
 	assert(world != NULL);
 
+	s_unload(world);
+	world->arena = arena_new(MEM_ENTITY);
+}
+
+void world_load_map(struct world *world, const char *map)
+{
 	world->map = map_read(map);
 	assert(world->map != NULL);
+}
+
+void world_load_hero(struct world *world, const char *hero)
+{
+	world->hero = arena_alloc(world->arena, 1, sizeof(struct sprite));
+	world->hero->tileset = tileset_read(world->arena, hero);
+	assert(world->hero->tileset != NULL);
+}
+
+void world_finish(struct world *world)
+{
+	struct tileanim *ta;
+	int i;
 
-	world->hero = allocate(1, sizeof(struct sprite));
-	world->hero->tileset = tileset_read(hero);
 	world->hero->at.x = world->map->entry.x * world_dx(world);
 	world->hero->at.y = world->map->entry.y * world_dy(world);
+	world->fov = fov_new(world->map, HERO_SIGHT);
+	world->cache = rcache_new(world->map);
+	world->overview = overview_new(world->map);
+	world->npcs = npcs_new(world->map, world_dx(world), world_dy(world));
+
+	world->nviews = 1;
+	world->views[0].hero     = world->hero;
+	world->views[0].fov      = world->fov;
+	world->views[0].viewport = world->viewport;
+	world->views[0].surface  = world->surface;
+	world->views[0].screen.w = world->viewport.width;
+	world->views[0].screen.h = world->viewport.height;
+
+	timer_schedule(&world->timers, &world->animate, HERO_FRAME_TIME, HERO_FRAME_TIME,
+	               s_animate, world->hero);
+	ta = arena_alloc(world->arena, world->map->nanims + 1, sizeof(struct tileanim));
+	for (i = 0; i < world->map->nanims; i++) {
+		ta[i].map = world->map;
+		ta[i].id  = i;
+		timer_schedule(&world->timers, &world->map->anims[i].timer,
+		               world->map->anims[i].period, world->map->anims[i].period,
+		               s_animate_tile, &ta[i]);
+	}
+}
+
+void world_load(struct world *world, const char *map, const char *hero)
+{
+	world_begin(world);
+	world_load_map(world, map);
+	world_load_hero(world, hero);
+	world_finish(world);
 }
 
 static int
 s_solid(struct world * world, int x, int y)
 {
-	x /= world_dx(world);
-	y /= world_dy(world);
-
-	return x < 0 || x > world->map->width
-	    || y < 0 || y > world->map->height
-	    || mapat(world->map, 0, x, y) & TILE_SOLID
-	    || mapat(world->map, 1, x, y);
+	return map_solid(world->map, x / world_dx(world), y / world_dy(world));
 }
 
 static int
@@ -128,102 +359,455 @@ s_collide(struct world * world, int x, int y)
 static void
 s_tick_tock(struct world * world)
 {
-	int rc;
-	struct timespec now;
-
-	rc = clock_gettime(CLOCK_MONOTONIC, &now);
-	if (rc != 0) {
-		fprintf(stderr, "failed to update world tocks from CLOCK_MONOTONIC: %s (error %d)\n",
-			strerror(errno), errno);
-		exit(EXIT_ENV_FAILURE);
-	}
-	world->tocks = (now.tv_sec % 10) * 1000
-	             + (now.tv_nsec / 1000000);
+	uint64_t elapsed;
 
-	world->hero->frame = (world->tocks / 200) % 2;
+	elapsed = clock_tick(&world->clock);
+	timers_advance(&world->timers, world->clock.now);
+	if (world->particles)
+		particles_update(world->particles, elapsed / 1e9);
 }
 
 static void
-s_hero_collision(struct world * world)
+s_hero_collision(struct world * world, struct sprite *hero)
 {
 	int x, y;
 
-	x = world->hero->at.x;
-	y = world->hero->at.y;
+	x = hero->at.x;
+	y = hero->at.y;
 
-	if (world->hero->delta.x) {
-		x += world->hero->delta.x;
+	if (hero->delta.x) {
+		x += hero->delta.x;
 		if (x < 0) x = 0;
 		if (!s_collide(world, x, y)) {
-			world->hero->at.x += world->hero->delta.x;
+			hero->at.x += hero->delta.x;
 		}
 	}
 
-	if (world->hero->delta.y) {
-		y += world->hero->delta.y;
+	if (hero->delta.y) {
+		y += hero->delta.y;
 		if (y < 0) y = 0;
 		if (!s_collide(world, x, y)) {
-			world->hero->at.y += world->hero->delta.y;
+			hero->at.y += hero->delta.y;
 		}
 	}
 }
 
+/* let the npcs' scripts have their say, then move them along */
 static void
-s_focus(struct world *world, int x, int y)
+s_npcs(struct world * world)
+{
+	int i;
+
+	if (!world->npcs)
+		return;
+	npcs_run(world->npcs, world, SCRIPT_BUDGET);
+	for (i = 0; i < world->npcs->n; i++)
+		if (sprite_moving(&world->npcs->sprites[i]))
+			s_hero_collision(world, &world->npcs->sprites[i]);
+}
+
+static void
+s_focus(struct world *world, struct viewport *viewport, int x, int y)
 {
 	int vw, vh, dx, dy;
-	vw = world->viewport.width;
-	vh = world->viewport.height;
+	vw = viewport->width;
+	vh = viewport->height;
 	dx = world_dx(world);
 	dy = world_dy(world);
 
-	world->viewport.at.x = bounded(0, x - vw / 2, world->map->width  * dx - vw);
-	world->viewport.at.y = bounded(0, y - vh / 2, world->map->height * dy - vh);
+	viewport->at.x = bounded(0, x - vw / 2, world->map->width  * dx - vw);
+	viewport->at.y = bounded(0, y - vh / 2, world->map->height * dy - vh);
 }
 
 void world_update(struct world * world)
 {
+	struct view *v;
+	int i;
+
 	s_tick_tock(world);
-	s_hero_collision(world);
-	s_focus(world, world->hero->at.x, world->hero->at.y);
+	s_npcs(world);
+	for (i = 0; i < world->nviews; i++) {
+		v = &world->views[i];
+		s_hero_collision(world, v->hero);
+		s_focus(world, &v->viewport, v->hero->at.x, v->hero->at.y);
+	}
+	world->viewport = world->views[0].viewport;
+
+	/* a renderer looks for itself, on its own map; all
+	   that's left here is to let go of the journal */
+	if (world->remote) {
+		for (i = 0; i < world->nviews; i++)
+			fov_forget(world->views[i].fov);
+	} else {
+		world_look(world);
+	}
 }
 
-void world_render(struct world * world)
+/* bring what each hero can see up to date */
+void world_look(struct world * world)
 {
-	assert(world != NULL);
-	assert(world->map != NULL);
-	assert(world->surface != NULL);
+	struct view *v;
+	int i;
+
+	for (i = 0; i < world->nviews; i++) {
+		v = &world->views[i];
+		fov_update(v->fov, (v->hero->at.x + world_dx(world) / 2) / world_dx(world),
+		                   (v->hero->at.y + world_dy(world) / 2) / world_dy(world));
+	}
+
+	/* shown or not, the overview keeps up with the journal,
+	   which can be trimmed no further than it has read */
+	if (world->overview)
+		overview_update(world->overview);
+}
+
+/* the headless counterpart to world_update(): move the game
+   clock on by ns, and the hero by whatever it was told. */
+void world_step(struct world * world, uint64_t ns)
+{
+	clock_advance(&world->clock, ns);
+	timers_advance(&world->timers, world->clock.now);
+	if (world->particles)
+		particles_update(world->particles, ns / 1e9);
+	s_npcs(world);
+	s_hero_collision(world, world->hero);
+}
+
+/* is the hero standing somewhere this view can see? */
+static int
+s_sees(struct world *world, struct view *v, struct sprite *hero)
+{
+	return fov_light(v->fov, (hero->at.x + world_dx(world) / 2) / world_dx(world),
+	                         (hero->at.y + world_dy(world) / 2) / world_dy(world)) > 0;
+}
+
+/* where a span of w starts, to be centred on c, within
+   [0, size); or centred on the map, if it is all in view */
+static int
+s_span(int c, int w, int size)
+{
+	if (size <= w)
+		return (size - w) / 2;
+	return bounded(0, c - w / 2, size - w);
+}
+
+/* a square dot, for world pixel (x, y), on a picture of
+   view stretched over to */
+static void
+s_mark(SDL_Surface *dst, SDL_Rect *view, SDL_Rect *to, int x, int y, int size, Uint32 colour)
+{
+	SDL_Rect r;
+
+	r.x = to->x + (int64_t)(x - view->x) * to->w / view->w - size / 2;
+	r.y = to->y + (int64_t)(y - view->y) * to->h / view->h - size / 2;
+	r.w = size;
+	r.h = size;
+	if (r.x + size <= to->x || r.y + size <= to->y || r.x >= to->x + to->w || r.y >= to->y + to->h)
+		return;
+	SDL_FillRect(dst, &r, colour);
+}
+
+/* a one pixel frame, just inside r */
+static void
+s_outline(SDL_Surface *dst, SDL_Rect *r, Uint32 colour)
+{
+	SDL_Rect e;
+
+	e   = *r;
+	e.h = 1;
+	SDL_FillRect(dst, &e, colour);
+	e.y = r->y + r->h - 1;
+	SDL_FillRect(dst, &e, colour);
+
+	e   = *r;
+	e.w = 1;
+	SDL_FillRect(dst, &e, colour);
+	e.x = r->x + r->w - 1;
+	SDL_FillRect(dst, &e, colour);
+}
+
+/* the part of the map (in world pixels) a view shows */
+static void
+s_shown(struct world * world, struct view *v, struct viewport *vp, SDL_Rect *view)
+{
+	if (world->zoom == 0) {
+		view->x = vp->at.x;
+		view->y = vp->at.y;
+		view->w = vp->width;
+		view->h = vp->height;
+		return;
+	}
+	view->w = vp->width  << world->zoom;
+	view->h = vp->height << world->zoom;
+	view->x = s_span(v->hero->at.x + world_dx(world) / 2, view->w, world->map->width  * world_dx(world));
+	view->y = s_span(v->hero->at.y + world_dy(world) / 2, view->h, world->map->height * world_dy(world));
+}
+
+/* a view, zoomed out: the map from its overview, and
+   everyone on it as dots, in one blit and a few fills */
+static void
+s_render_zoomed(struct world * world, struct view *v)
+{
+	SDL_Rect view, to;
+	struct sprite *s;
+	Uint32 hero, npc;
+	int i, dx, dy, size;
+
+	dx = world_dx(world);
+	dy = world_dy(world);
+	s_shown(world, v, &world->viewport, &view);
+	to.x = 0;
+	to.y = 0;
+	to.w = world->viewport.width;
+	to.h = world->viewport.height;
+	overview_draw(world->overview, world->surface, &view, dx, dy, &to);
+
+	hero = SDL_MapRGB(world->surface->format, 255, 255, 255);
+	npc  = SDL_MapRGB(world->surface->format, 255, 64, 64);
+	size = 2 * world->scale;
+	if (size < (dx >> world->zoom))
+		size = dx >> world->zoom;
+
+	for (i = 0; world->npcs && i < world->npcs->n; i++) {
+		s = &world->npcs->sprites[i];
+		if (istile(s->tile) && s_sees(world, v, s))
+			s_mark(world->surface, &view, &to, s->at.x + dx / 2, s->at.y + dy / 2, size, npc);
+	}
+	for (i = 0; i < world->nviews; i++) {
+		s = world->views[i].hero;
+		if (&world->views[i] == v || s_sees(world, v, s))
+			s_mark(world->surface, &view, &to, s->at.x + dx / 2, s->at.y + dy / 2, size, hero);
+	}
+}
+
+/* draw one view; world->viewport, ->surface and ->fov are
+   the view's own, for the duration */
+static void
+s_render_view(struct world * world, struct view *v)
+{
+	SDL_Rect view;
+	struct sprite *s;
+	int i, x, y, cx, cy, l, dx, dy, ox, oy;
+
+	if (world->zoom > 0) {
+		s_render_zoomed(world, v);
+		return;
+	}
 
-	int x, y, t, dx, dy, ox, oy;
 	dx = world_dx(world);
 	dy = world_dy(world);
 	ox = world->viewport.at.x % dx * -1;
 	oy = world->viewport.at.y % dy * -1;
 
-	/* background image */
-	SDL_FillRect(world->surface, NULL, SDL_MapRGB(world->surface->format, 0, 0, 0));
+	/* draw the map (floor and objects, from the chunk
+	   cache), darkened by what the hero can see */
+	view.x = world->viewport.at.x;
+	view.y = world->viewport.at.y;
+	view.w = world->viewport.width;
+	view.h = world->viewport.height;
+	rcache_draw(world->cache, world->surface, world->scale, &view);
 
-	/* draw the tiled map background layer */
 	for (x = ox; x <= world->viewport.width; x += dx) {
 		for (y = oy; y <= world->viewport.height; y += dy) {
-			if (inmap(world->map, (x + world->viewport.at.x) / dx,
-			                      (y + world->viewport.at.y) / dy)) {
-				t = mapat(world->map, 0, (x + world->viewport.at.x) / dx,
-				                         (y + world->viewport.at.y) / dy);
-				if (istile(t)) {
-					draw(world, NULL, tileno(t), x, y);
-					t = mapat(world->map, 1, (x + world->viewport.at.x) / dx,
-					                         (y + world->viewport.at.y) / dy);
-					if (istile(t)) {
-						draw(world, NULL, tileno(t), x, y);
-					}
-				}
-			}
+			cx = (x + world->viewport.at.x) / dx;
+			cy = (y + world->viewport.at.y) / dy;
+			if (!inmap(world->map, cx, cy) || !istile(mapat(world->map, 0, cx, cy)))
+				continue;
+
+			/* never-seen cells (light 0) go fully black */
+			l = fov_light(world->fov, cx, cy);
+			shade(world, l, x, y);
 		}
 	}
 
-	/* draw the hero avatar */
-	draw(world, world->hero->tileset, sprite_tile(world->hero), world->hero->at.x - world->viewport.at.x, world->hero->at.y - world->viewport.at.y);
+	/* the map's own characters, wherever this view can see them */
+	for (i = 0; world->npcs && i < world->npcs->n; i++) {
+		s = &world->npcs->sprites[i];
+		if (!istile(s->tile) || !s_sees(world, v, s))
+			continue;
+		draw(world, s->tileset, tileof(world->map, s->tile),
+		     s->at.x - world->viewport.at.x,
+		     s->at.y - world->viewport.at.y);
+	}
+
+	/* draw the hero avatars: this view's own, and any other
+	   player's, if this one can see them */
+	for (i = 0; i < world->nviews; i++) {
+		if (&world->views[i] != v && !s_sees(world, v, world->views[i].hero))
+			continue;
+		draw(world, world->views[i].hero->tileset, sprite_tile(world->views[i].hero),
+		     world->views[i].hero->at.x - world->viewport.at.x,
+		     world->views[i].hero->at.y - world->viewport.at.y);
+	}
+
+	/* sparks and dust fly over everyone */
+	if (world->particles)
+		particles_draw(world->particles, world);
+}
+
+/* the minimap, in the top right corner: the map around
+   the first hero, with every view's outline and hero on it */
+static void
+s_minimap(struct world * world)
+{
+	SDL_Rect view, to, r, clip;
+	struct view *v;
+	Uint32 white;
+	int i, dx, dy, side, span;
+
+	dx   = world_dx(world);
+	dy   = world_dy(world);
+	side = (world->surface->w < world->surface->h ? world->surface->w : world->surface->h) / 4;
+	to.w = side;
+	to.h = side;
+	to.x = world->surface->w - side - world->scale;
+	to.y = world->scale;
+
+	span = world->map->width > world->map->height ? world->map->width : world->map->height;
+	span >>= world->minimap - 1;
+	if (span < 8) span = 8;
+	view.w = span * dx;
+	view.h = span * dy;
+	view.x = s_span(world->views[0].hero->at.x + dx / 2, view.w, world->map->width  * dx);
+	view.y = s_span(world->views[0].hero->at.y + dy / 2, view.h, world->map->height * dy);
+
+	white = SDL_MapRGB(world->surface->format, 255, 255, 255);
+	SDL_GetClipRect(world->surface, &clip);
+	SDL_SetClipRect(world->surface, &to);
+	SDL_FillRect(world->surface, &to, SDL_MapRGB(world->surface->format, 0, 0, 0));
+	overview_draw(world->overview, world->surface, &view, dx, dy, &to);
+
+	for (i = 0; i < world->nviews; i++) {
+		v = &world->views[i];
+		s_shown(world, v, &v->viewport, &r);
+		r.x = to.x + (int64_t)(r.x - view.x) * to.w / view.w;
+		r.y = to.y + (int64_t)(r.y - view.y) * to.h / view.h;
+		r.w = (int64_t)r.w * to.w / view.w;
+		r.h = (int64_t)r.h * to.h / view.h;
+		s_outline(world->surface, &r, SDL_MapRGB(world->surface->format, 128, 128, 128));
+		s_mark(world->surface, &view, &to, v->hero->at.x + dx / 2, v->hero->at.y + dy / 2, 3, white);
+	}
+	s_outline(world->surface, &to, white);
+	SDL_SetClipRect(world->surface, &clip);
+}
+
+void world_render(struct world * world)
+{
+	assert(world != NULL);
+	assert(world->map != NULL);
+	assert(world->surface != NULL);
+
+	SDL_Surface *screen;
+	struct view *v;
+	int i, n;
+
+	/* enough cached chunks for every view on screen at
+	   once, or the views take turns evicting each other's */
+	for (i = n = 0; i < world->nviews; i++)
+		n += rcache_span(world->cache, world->views[i].viewport.width,
+		                 world->views[i].viewport.height, world->scale);
+	rcache_fit(world->cache, n);
+
+	/* background image */
+	SDL_FillRect(world->surface, NULL, SDL_MapRGB(world->surface->format, 0, 0, 0));
+
+	screen = world->surface;
+	for (i = 0; i < world->nviews; i++) {
+		v = &world->views[i];
+		world->viewport = v->viewport;
+		world->surface  = v->surface;
+		world->fov      = v->fov;
+		s_render_view(world, v);
+	}
+	world->viewport = world->views[0].viewport;
+	world->surface  = screen;
+	world->fov      = world->views[0].fov;
+
+	if (world->minimap > 0)
+		s_minimap(world);
+
+	/* and anything the game has to say, on top */
+	world_text(world, world->scale, world->scale, world->hud);
 
 	SDL_UpdateWindowSurface(world->window);
 }
+
+/* lay the views out in a row (two), or a grid (three or
+   four), a pixel or so apart */
+static void
+s_layout(struct world *world, int n, int i, SDL_Rect *r)
+{
+	int w, h, gap, cols, rows;
+
+	w    = world->surface->w;
+	h    = world->surface->h;
+	gap  = n > 1 ? world->scale : 0;
+	cols = n > 1 ? 2 : 1;
+	rows = n > 2 ? 2 : 1;
+
+	r->w = (w - gap * (cols - 1)) / cols;
+	r->h = (h - gap * (rows - 1)) / rows;
+	r->x = (i % cols) * (r->w + gap);
+	r->y = (i / cols) * (r->h + gap);
+}
+
+/* a surface onto part of the window's own pixels */
+static SDL_Surface *
+s_subsurface(SDL_Surface *s, SDL_Rect *r)
+{
+	SDL_Surface *sub;
+
+	sub = SDL_CreateRGBSurfaceFrom(
+		(char *)s->pixels + r->y * s->pitch + r->x * s->format->BytesPerPixel,
+		r->w, r->h, s->format->BitsPerPixel, s->pitch,
+		s->format->Rmask, s->format->Gmask, s->format->Bmask, s->format->Amask);
+	if (!sub) {
+		fprintf(stderr, "failed to create view surface: %s\n", SDL_GetError());
+		exit(EXIT_INT_FAILURE);
+	}
+	return sub;
+}
+
+void world_split(struct world * world, int n)
+{
+	struct view *v;
+	int i;
+
+	assert(n >= 1 && n <= WORLD_VIEWS);
+	if (world->nviews == 0)
+		return;
+
+	/* players leaving */
+	for (i = n; i < world->nviews; i++)
+		s_unview(world, i);
+
+	/* players joining, at the map's entrance */
+	for (i = world->nviews; i < n; i++) {
+		v = &world->views[i];
+		v->hero = tallocate(MEM_ENTITY, 1, sizeof(struct sprite));
+		v->hero->tileset = world->hero->tileset;
+		v->hero->at.x = world->map->entry.x * world_dx(world);
+		v->hero->at.y = world->map->entry.y * world_dy(world);
+		v->fov = fov_new(world->map, HERO_SIGHT);
+		timer_schedule(&world->timers, &v->animate, HERO_FRAME_TIME, HERO_FRAME_TIME,
+		               s_animate, v->hero);
+	}
+
+	/* and everyone gets a new share of the screen */
+	for (i = 0; i < n; i++) {
+		v = &world->views[i];
+		if (v->surface != world->surface)
+			SDL_FreeSurface(v->surface);
+		v->surface = NULL;
+		if (!world->surface)
+			continue;  /* until world_unveil() */
+
+		s_layout(world, n, i, &v->screen);
+		v->surface = n == 1 ? world->surface : s_subsurface(world->surface, &v->screen);
+		v->viewport.width  = v->screen.w;
+		v->viewport.height = v->screen.h;
+		s_focus(world, &v->viewport, v->hero->at.x, v->hero->at.y);
+	}
+	world->nviews   = n;
+	world->viewport = world->views[0].viewport;
+}